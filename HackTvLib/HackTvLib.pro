@@ -77,9 +77,13 @@ SOURCES += \
     hacktv/mac.c \
     hacktv/nicam728.c \
     hacktv/rf.c \
+    hacktv/rf_convert.c \
     hacktv/rf_file.c \
     hacktv/rf_fl2k.c \
     hacktv/rf_hackrf.c \
+    hacktv/rf_loopback.c \
+    hacktv/rf_mmap.c \
+    hacktv/rf_null.c \
     hacktv/rf_soapysdr.c \
     hacktv/sis.c \
     hacktv/syster.c \
@@ -91,6 +95,7 @@ SOURCES += \
     hacktv/vitc.c \
     hacktv/vits.c \
     hacktv/wss.c \
+    hacktv/yiq.c \
     hacktvlib.cpp \
     rtlsdrdevice.cpp
 
@@ -111,9 +116,13 @@ HEADERS += \
     hacktv/mac.h \
     hacktv/nicam728.h \
     hacktv/rf.h \
+    hacktv/rf_convert.h \
     hacktv/rf_file.h \
     hacktv/rf_fl2k.h \
     hacktv/rf_hackrf.h \
+    hacktv/rf_loopback.h \
+    hacktv/rf_mmap.h \
+    hacktv/rf_null.h \
     hacktv/rf_soapysdr.h \
     hacktv/sis.h \
     hacktv/syster.h \
@@ -126,6 +135,7 @@ HEADERS += \
     hacktv/vitc.h \
     hacktv/vits.h \
     hacktv/wss.h \
+    hacktv/yiq.h \
     hacktvlib.h \
     modulation.h \
     rtlsdrdevice.h \
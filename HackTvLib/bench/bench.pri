@@ -0,0 +1,31 @@
+# Settings shared by the benchmarks. Each one builds the hacktv
+# sources it needs directly, no Qt and no library
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt app_bundle
+
+HACKTV = $$PWD/../hacktv
+
+DEFINES += _USE_MATH_DEFINES
+INCLUDEPATH += $$HACKTV
+
+QMAKE_CFLAGS += -std=gnu11
+
+win32 {
+    TOOLCHAIN_PATH = C:/msys64/ucrt64
+    INCLUDEPATH += $$TOOLCHAIN_PATH/include
+    LIBS += -L$$TOOLCHAIN_PATH/lib
+}
+
+unix {
+    INCLUDEPATH += /usr/local/include
+    LIBS += -L/usr/local/lib -lpthread
+
+    macx {
+        HOMEBREW_PREFIX = $$system(brew --prefix)
+        INCLUDEPATH += $$HOMEBREW_PREFIX/include
+        LIBS += -L$$HOMEBREW_PREFIX/lib
+    }
+}
+
+LIBS += -lm
@@ -0,0 +1,9 @@
+# Microbenchmarks for the hacktv DSP and output code. Build with
+# qmake && make, then run each program from its own directory
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    fir \
+    file \
+    hackrf \
+    sink
@@ -0,0 +1,10 @@
+include(../bench.pri)
+
+TARGET = file_bench
+
+SOURCES += \
+    file_bench.c \
+    $$HACKTV/common.c \
+    $$HACKTV/rf.c \
+    $$HACKTV/rf_convert.c \
+    $$HACKTV/rf_file.c
@@ -0,0 +1,127 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Reports the throughput of the file sink, writing a few GB of
+ * complex IQ through rf_file.c in 64k sample blocks. The rate is
+ * given both while writing, which is what rendering sees, and
+ * including the final flush in rf_close(). An optional amount of
+ * busy work per block stands in for the cost of rendering, to show
+ * how much of the disk time the writer thread hides.
+ * 
+ * Usage: file_bench <file> [int16|float|int8|uint8] [GB] [direct] [work]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "rf.h"
+#include "rf_file.h"
+
+#define _BLOCK_SAMPLES 65536
+
+static double _now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *type_name = argc > 2 ? argv[2] : "int16";
+	double gb = argc > 3 ? atof(argv[3]) : 3;
+	int direct = argc > 4 ? atoi(argv[4]) : 0;
+	long work = argc > 5 ? atol(argv[5]) : 0;
+	volatile double busy = 0;
+	int16_t *iq;
+	uint64_t total, done = 0;
+	size_t size;
+	double t, tw, tc;
+	long w;
+	int type;
+	rf_t rf;
+	
+	if(argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <file> [int16|float|int8|uint8] [GB] [direct] [work]\n", argv[0]);
+		return(1);
+	}
+	
+	if(strcmp(type_name, "int16") == 0) { type = RF_INT16; size = 4; }
+	else if(strcmp(type_name, "float") == 0) { type = RF_FLOAT; size = 8; }
+	else if(strcmp(type_name, "int8") == 0) { type = RF_INT8; size = 2; }
+	else if(strcmp(type_name, "uint8") == 0) { type = RF_UINT8; size = 2; }
+	else
+	{
+		fprintf(stderr, "Unrecognised type '%s'\n", type_name);
+		return(1);
+	}
+	
+	iq = malloc(sizeof(int16_t) * 2 * _BLOCK_SAMPLES);
+	if(iq == NULL) return(1);
+	
+	for(w = 0; w < 2 * _BLOCK_SAMPLES; w++)
+	{
+		iq[w] = rand();
+	}
+	
+	if(rf_file_open(&rf, argv[1], type, 1, direct) != RF_OK)
+	{
+		free(iq);
+		return(1);
+	}
+	
+	total = (uint64_t) (gb * 1e9) / size;
+	
+	t = _now();
+	
+	while(done < total)
+	{
+		for(w = 0; w < work; w++)
+		{
+			busy += iq[w & 1023] * 1.0001;
+		}
+		
+		if(rf_write(&rf, iq, _BLOCK_SAMPLES) != RF_OK)
+		{
+			fprintf(stderr, "Write failed\n");
+			break;
+		}
+		
+		done += _BLOCK_SAMPLES;
+	}
+	
+	tw = _now() - t;
+	
+	if(rf_close(&rf) != RF_OK)
+	{
+		fprintf(stderr, "Close failed\n");
+	}
+	
+	tc = _now() - t;
+	
+	printf("%s, %.2f GB%s: %.0f MB/s while writing, %.0f MB/s including close\n",
+		type_name, done * size / 1e9, direct ? ", direct" : "",
+		done * size / tw / 1e6, done * size / tc / 1e6);
+	
+	free(iq);
+	
+	return(0);
+}
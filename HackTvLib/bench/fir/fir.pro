@@ -0,0 +1,10 @@
+include(../bench.pri)
+
+TARGET = fir_bench
+
+LIBS += -lfftw3f
+
+# fir_bench.c includes fir.c, to reach each dot product kernel
+SOURCES += \
+    fir_bench.c \
+    $$HACKTV/common.c
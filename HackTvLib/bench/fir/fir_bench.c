@@ -0,0 +1,209 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Reports the throughput of fir_int16_process() and
+ * fir_int16_complex_process() in MSamples/s for a range of tap
+ * counts, with each of the dot product kernels this CPU can run.
+ * The kernels are also checked against the scalar one first. Each
+ * figure is the best of three runs.
+ * 
+ * Usage: fir_bench [samples]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Built in, to reach the kernels */
+#include "fir.c"
+
+typedef struct {
+	const char *name;
+	_fir_dot_int16_t dot;
+	unsigned int features;
+} _kernel_t;
+
+static const _kernel_t _kernels[] = {
+	{ "scalar", _dot_int16_scalar, 0 },
+#if defined(CPU_X86)
+	{ "sse2",   _dot_int16_sse2,   CPU_SSE2 },
+	{ "avx2",   _dot_int16_avx2,   CPU_AVX2 },
+#elif defined(CPU_ARM)
+	{ "neon",   _dot_int16_neon,   CPU_NEON },
+#endif
+};
+
+#define _KERNELS (sizeof(_kernels) / sizeof(_kernel_t))
+
+static const unsigned int _taps[] = { 7, 15, 21, 33, 51, 101, 255 };
+
+static double _now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+typedef void (*_process_t)(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples);
+
+static void _process_real(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples)
+{
+	fir_int16_process(s, out, in, samples, 1);
+}
+
+static void _process_complex(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples)
+{
+	fir_int16_complex_process(s, out, in, samples);
+}
+
+static double _measure(fir_int16_t *s, _process_t process, int16_t *out, const int16_t *in, size_t samples)
+{
+	double t, best = 0;
+	int r;
+	
+	for(r = 0; r < 3; r++)
+	{
+		t = _now();
+		process(s, out, in, samples);
+		t = _now() - t;
+		
+		if(r == 0 || t < best) best = t;
+	}
+	
+	return(samples / best / 1e6);
+}
+
+static int _supported(const _kernel_t *k)
+{
+	return((cpu_features() & k->features) == k->features);
+}
+
+static int _check_kernels(void)
+{
+	int16_t a[300], b[300];
+	int32_t r;
+	unsigned int n;
+	int i, j, bad = 0;
+	
+	/* Random vectors, and full scale ones to check the sums wrap
+	 * around the same way. Every length covers the scalar tails */
+	for(i = 0; i < 200000; i++)
+	{
+		n = rand() % 300;
+		
+		for(j = 0; j < 300; j++)
+		{
+			a[j] = i & 1 ? (rand() & 1 ? INT16_MIN : INT16_MAX) : rand();
+			b[j] = i & 1 ? INT16_MIN : rand();
+		}
+		
+		r = _dot_int16_scalar(a, b, n);
+		
+		for(j = 1; j < _KERNELS; j++)
+		{
+			if(_supported(&_kernels[j]) && _kernels[j].dot(a, b, n) != r)
+			{
+				bad++;
+			}
+		}
+	}
+	
+	return(bad);
+}
+
+int main(int argc, char *argv[])
+{
+	size_t samples = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+	int16_t *in, *out;
+	double *taps;
+	fir_int16_t f;
+	size_t i;
+	int j, k;
+	
+	srand(1);
+	
+	if(_check_kernels() != 0)
+	{
+		fprintf(stderr, "The vector kernels don't match the scalar one\n");
+		return(1);
+	}
+	
+	in = malloc(sizeof(int16_t) * 2 * samples);
+	out = malloc(sizeof(int16_t) * 2 * samples);
+	taps = malloc(sizeof(double) * 2 * 255);
+	
+	if(!in || !out || !taps)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return(1);
+	}
+	
+	for(i = 0; i < samples * 2; i++)
+	{
+		in[i] = rand();
+	}
+	
+	printf("MSamples/s over %zu samples, real / complex\n\n", samples);
+	printf("taps");
+	
+	for(k = 0; k < _KERNELS; k++)
+	{
+		if(_supported(&_kernels[k])) printf(" %15s", _kernels[k].name);
+	}
+	
+	printf("\n");
+	
+	for(j = 0; j < sizeof(_taps) / sizeof(unsigned int); j++)
+	{
+		printf("%4u", _taps[j]);
+		
+		for(k = 0; k < _KERNELS; k++)
+		{
+			double real, complex;
+			
+			if(!_supported(&_kernels[k])) continue;
+			
+			fir_low_pass(taps, _taps[j], 1, 0.2, 0.05, 1);
+			fir_int16_init(&f, taps, _taps[j], 1, 1, 0);
+			f.dot = _kernels[k].dot;
+			
+			real = _measure(&f, _process_real, out, in, samples);
+			
+			fir_int16_free(&f);
+			
+			fir_complex_band_pass(taps, _taps[j], 1, 0.1, 0.2, 0.05, 1);
+			fir_int16_complex_init(&f, taps, _taps[j], 1, 1, 0);
+			f.dot = _kernels[k].dot;
+			
+			complex = _measure(&f, _process_complex, out, in, samples);
+			
+			fir_int16_free(&f);
+			
+			printf(" %7.1f / %5.1f", real, complex);
+		}
+		
+		printf("\n");
+	}
+	
+	free(in);
+	free(out);
+	free(taps);
+	
+	return(0);
+}
@@ -0,0 +1,11 @@
+include(../bench.pri)
+
+TARGET = hackrf_bench
+
+LIBS += -lhackrf
+
+# hackrf_bench.c includes rf_hackrf.c, to reach the ring and callbacks
+SOURCES += \
+    hackrf_bench.c \
+    $$HACKTV/common.c \
+    $$HACKTV/rf_convert.c
@@ -0,0 +1,162 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Reports the CPU time the HackRF TX path costs per MSample/s,
+ * without a device. A thread stands in for libhackrf, calling
+ * _tx_callback() with a transfer buffer at the given sample rate,
+ * while the main thread feeds the ring through _rf_write(). The
+ * narrowing is timed with rf_convert(), and with the byte at a time
+ * loop it replaced.
+ * 
+ * Usage: hackrf_bench [sample rate] [seconds]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+/* Built in, to reach the ring and the callbacks */
+#include "rf_hackrf.c"
+
+static atomic_int _stop;
+static double _rate;
+
+static double _now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void *_usb_thread(void *arg)
+{
+	hackrf_transfer transfer = {
+		.buffer = malloc(TRANSFER_BUFFER_SIZE),
+		.buffer_length = TRANSFER_BUFFER_SIZE,
+		.valid_length = TRANSFER_BUFFER_SIZE,
+		.tx_ctx = arg,
+	};
+	struct timespec ts;
+	double t = _now();
+	
+	/* One transfer each time the device would have sent the last */
+	while(!atomic_load(&_stop))
+	{
+		_tx_callback(&transfer);
+		
+		t += TRANSFER_BUFFER_SIZE / 2 / _rate;
+		ts.tv_sec = (time_t) t;
+		ts.tv_nsec = (long) ((t - ts.tv_sec) * 1e9);
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+	}
+	
+	free(transfer.buffer);
+	
+	return(NULL);
+}
+
+/* The TX path before rf_convert(), one byte at a time */
+static int _rf_write_bytes(void *private, int16_t *iq_data, size_t samples)
+{
+	hackrf_t *rf = private;
+	int8_t *iq8 = NULL;
+	size_t i, r;
+	
+	samples *= 2;
+	
+	while(samples > 0)
+	{
+		r = _buffer_write_ptr(&rf->buffers, &iq8, 1);
+		if(r > samples) r = samples;
+		
+		for(i = 0; i < r; i++)
+		{
+			iq8[i] = iq_data[i] >> 8;
+		}
+		
+		_buffer_write(&rf->buffers, r);
+		
+		iq_data += r;
+		samples -= r;
+	}
+	
+	return(RF_OK);
+}
+
+static void _run(const char *name, int (*write)(void *, int16_t *, size_t), int16_t *iq, size_t block, double seconds)
+{
+	hackrf_t rf = { 0 };
+	pthread_t thread;
+	size_t samples = 0, total = (size_t) (_rate * seconds);
+	clock_t c;
+	double t, cpu;
+	
+	if(_buffer_init(&rf.buffers, 16, TRANSFER_BUFFER_SIZE) != 0) return;
+	
+	atomic_store(&_stop, 0);
+	pthread_create(&thread, NULL, _usb_thread, &rf);
+	
+	c = clock();
+	t = _now();
+	
+	while(samples < total)
+	{
+		write(&rf, iq, block);
+		samples += block;
+	}
+	
+	t = _now() - t;
+	cpu = (double) (clock() - c) / CLOCKS_PER_SEC;
+	
+	atomic_store(&_stop, 1);
+	pthread_join(thread, NULL);
+	_buffer_free(&rf.buffers);
+	
+	/* CPU seconds per second of output at 1 MS/s, covering
+	 * both the writer and the callback thread */
+	printf("%-8s %.0f MS in %.2f s: %.2f ms CPU per MS/s, %.1f%% of a core at %.0f MS/s\n",
+		name, samples / 1e6, t, cpu / (samples / 1e6) * 1e3,
+		cpu / (samples / _rate) * 100, _rate / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+	double seconds;
+	size_t i, block = 65536;
+	int16_t *iq;
+	
+	_rate = argc > 1 ? atof(argv[1]) : 20e6;
+	seconds = argc > 2 ? atof(argv[2]) : 10;
+	
+	iq = malloc(sizeof(int16_t) * 2 * block);
+	if(iq == NULL) return(1);
+	
+	for(i = 0; i < block * 2; i++)
+	{
+		iq[i] = rand();
+	}
+	
+	_run("bytes", _rf_write_bytes, iq, block, seconds);
+	_run("convert", _rf_write, iq, block, seconds);
+	
+	free(iq);
+	
+	return(0);
+}
@@ -0,0 +1,35 @@
+include(../bench.pri)
+
+TARGET = sink_bench
+
+LIBS += -lfftw3f
+
+# Everything but the hardware sinks and the ffmpeg source
+SOURCES += \
+    sink_bench.c \
+    $$HACKTV/acp.c \
+    $$HACKTV/av.c \
+    $$HACKTV/av_test.c \
+    $$HACKTV/common.c \
+    $$HACKTV/dance.c \
+    $$HACKTV/eurocrypt.c \
+    $$HACKTV/fir.c \
+    $$HACKTV/mac.c \
+    $$HACKTV/nicam728.c \
+    $$HACKTV/rf.c \
+    $$HACKTV/rf_convert.c \
+    $$HACKTV/rf_file.c \
+    $$HACKTV/rf_loopback.c \
+    $$HACKTV/rf_mmap.c \
+    $$HACKTV/rf_null.c \
+    $$HACKTV/sis.c \
+    $$HACKTV/syster.c \
+    $$HACKTV/teletext.c \
+    $$HACKTV/vbidata.c \
+    $$HACKTV/video.c \
+    $$HACKTV/videocrypt.c \
+    $$HACKTV/videocrypts.c \
+    $$HACKTV/vitc.c \
+    $$HACKTV/vits.c \
+    $$HACKTV/wss.c \
+    $$HACKTV/yiq.c
@@ -0,0 +1,222 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Reports the lines/s hacktv passes to the file sink, one line per
+ * rf_write() call as before vid_next_block(), and in blocks of
+ * whole lines as rfTxLoop does now. The test pattern is rendered
+ * in the given mode, and the sink alone is then timed with lines
+ * that are already rendered, for each output type.
+ * 
+ * Usage: sink_bench [file] [mode] [frames]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hacktv.h"
+#include "av_test.h"
+#include "rf_file.h"
+
+/* The same block size as rfTxLoop */
+#define _BLOCK_SAMPLES 65536
+
+static double _now(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	
+	return(ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static int _open_video(vid_t *v, const char *mode)
+{
+	const vid_configs_t *c;
+	
+	for(c = vid_configs; c->id != NULL; c++)
+	{
+		if(strcmp(c->id, mode) == 0) break;
+	}
+	
+	if(c->id == NULL)
+	{
+		fprintf(stderr, "Unrecognised mode '%s'\n", mode);
+		return(-1);
+	}
+	
+	if(vid_init(v, 16000000, 0, c->conf) != VID_OK)
+	{
+		fprintf(stderr, "Unable to initialise video\n");
+		return(-1);
+	}
+	
+	v->av = (av_t) {
+		.width = v->active_width,
+		.height = v->conf.active_lines,
+		.frame_rate = (rational_t) {
+			.num = v->conf.frame_rate.num * (v->conf.interlace ? 2 : 1),
+			.den = v->conf.frame_rate.den,
+		},
+		.display_aspect_ratios = {
+			v->conf.frame_aspects[0],
+			v->conf.frame_aspects[1]
+		},
+		.fit_mode = AV_FIT_FIT,
+		.sample_rate = (rational_t) {
+			.num = v->audio ? HACKTV_AUDIO_SAMPLE_RATE : 0,
+			.den = 1,
+		},
+	};
+	
+	if(av_test_open(&v->av) != AV_OK)
+	{
+		vid_free(v);
+		return(-1);
+	}
+	
+	return(0);
+}
+
+/* Render and write the given number of lines, one line or one block
+ * per rf_write() call. Returns lines/s, or -1 on error */
+static double _render(const char *filename, const char *mode, long lines, int block)
+{
+	vid_t v;
+	rf_t rf;
+	int16_t *buf = NULL, *l;
+	size_t samples;
+	long n = 0;
+	double t;
+	int r;
+	
+	if(_open_video(&v, mode) != 0) return(-1);
+	
+	if(rf_file_open(&rf, (char *) filename, RF_INT16, 1, 0) != RF_OK)
+	{
+		vid_free(&v);
+		return(-1);
+	}
+	
+	if(block)
+	{
+		buf = malloc(sizeof(int16_t) * 2 * (_BLOCK_SAMPLES > v.max_width ? _BLOCK_SAMPLES : v.max_width));
+		if(buf == NULL) lines = 0;
+	}
+	
+	t = _now();
+	
+	while(n < lines)
+	{
+		if(block)
+		{
+			r = vid_next_block(&v, buf, _BLOCK_SAMPLES > v.max_width ? _BLOCK_SAMPLES : v.max_width, &samples);
+			if(r <= 0) break;
+			
+			if(rf_write(&rf, buf, samples) != RF_OK) break;
+			n += r;
+		}
+		else
+		{
+			l = vid_next_line(&v, &samples);
+			if(l == NULL) break;
+			
+			if(rf_write(&rf, l, samples) != RF_OK) break;
+			n++;
+		}
+	}
+	
+	rf_close(&rf);
+	t = _now() - t;
+	
+	free(buf);
+	vid_free(&v);
+	
+	return(n / t);
+}
+
+/* Write pre-rendered 1024 sample lines straight to the sink */
+static double _sink(const char *filename, int type, int16_t *lines, int nlines, int width, int reps, int block)
+{
+	rf_t rf;
+	double t;
+	int i, j;
+	
+	if(rf_file_open(&rf, (char *) filename, type, 1, 0) != RF_OK) return(-1);
+	
+	t = _now();
+	
+	for(i = 0; i < reps; i++)
+	{
+		if(block)
+		{
+			rf_write(&rf, lines, width * nlines);
+			continue;
+		}
+		
+		for(j = 0; j < nlines; j++)
+		{
+			rf_write(&rf, &lines[j * width * 2], width);
+		}
+	}
+	
+	rf_close(&rf);
+	t = _now() - t;
+	
+	return((double) reps * nlines / t);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *filename = argc > 1 ? argv[1] : "/dev/null";
+	const char *mode = argc > 2 ? argv[2] : "i";
+	int frames = argc > 3 ? atoi(argv[3]) : 250;
+	const int types[] = { RF_INT16, RF_INT8, RF_FLOAT };
+	const char *names[] = { "int16", "int8", "float" };
+	const int width = 1024, nlines = 64;
+	int16_t *lines;
+	vid_t v;
+	long total;
+	int i;
+	
+	/* Find the number of lines in the requested frames */
+	if(_open_video(&v, mode) != 0) return(1);
+	total = (long) frames * v.conf.lines;
+	vid_free(&v);
+	
+	printf("Mode %s, %d frames to %s\n\n", mode, frames, filename);
+	printf("render + sink, line:  %.0f lines/s\n", _render(filename, mode, total, 0));
+	printf("render + sink, block: %.0f lines/s\n\n", _render(filename, mode, total, 1));
+	
+	lines = malloc(sizeof(int16_t) * 2 * width * nlines);
+	if(lines == NULL) return(1);
+	
+	for(i = 0; i < 2 * width * nlines; i++)
+	{
+		lines[i] = rand();
+	}
+	
+	for(i = 0; i < 3; i++)
+	{
+		printf("sink %-5s, line:  %.2f M lines/s\n", names[i], _sink(filename, types[i], lines, nlines, width, 20000, 0) / 1e6);
+		printf("sink %-5s, block: %.2f M lines/s\n", names[i], _sink(filename, types[i], lines, nlines, width, 20000, 1) / 1e6);
+	}
+	
+	free(lines);
+	
+	return(0);
+}
@@ -69,21 +69,49 @@ int av_eof(av_t *s)
 	return(s->eof ? s->eof(s->av_source_ctx) : 0);
 }
 
-int av_close(av_t *s)
+int av_fill(av_t *s, int *video_frames, int *audio_frames, int *depth)
+{
+	/* Decoded frames queued in the source, if it can say */
+	return(s->fill ? s->fill(s->av_source_ctx, video_frames, audio_frames, depth) : AV_ERROR);
+}
+
+static void _av_clear_source(av_t *s)
 {
-	int r;
-	
-	r = s->close ? s->close(s->av_source_ctx) : AV_ERROR;
-	
 	s->av_source_ctx = NULL;
 	s->read_video = NULL;
 	s->read_audio = NULL;
 	s->eof = NULL;
+	s->fill = NULL;
 	s->close = NULL;
+	s->period = (rational_t) { 0, 0 };
+}
+
+int av_close(av_t *s)
+{
+	int r;
+	
+	r = s->close ? s->close(s->av_source_ctx) : AV_ERROR;
+	
+	_av_clear_source(s);
 	
 	return(r);
 }
 
+void av_move(av_t *dst, av_t *src)
+{
+	/* Hand the source opened in src over to dst, which must not
+	 * have one open. The settings in dst are left as they are */
+	dst->av_source_ctx = src->av_source_ctx;
+	dst->read_video = src->read_video;
+	dst->read_audio = src->read_audio;
+	dst->eof = src->eof;
+	dst->fill = src->fill;
+	dst->close = src->close;
+	dst->period = src->period;
+	
+	_av_clear_source(src);
+}
+
 rational_t av_calculate_frame_size(av_t *av, rational_t resolution, rational_t aspect)
 {
 	rational_t r = { av->width, av->height };
@@ -187,14 +215,62 @@ void av_set_display_aspect_ratio(av_frame_t *frame, rational_t display_aspect_ra
 	);
 }
 
+static void _yuv_offset(av_frame_t *frame, int x, int y)
+{
+	/* Move the origin of the YUV planes, keeping
+	 * track of where it falls in the chroma samples */
+	frame->yuv[0] += y * frame->yuv_line_stride[0] + x * frame->yuv_pixel_stride[0];
+	
+	x += frame->yuv_cx;
+	y += frame->yuv_cy;
+	
+	frame->yuv[1] += (y >> 1) * frame->yuv_line_stride[1] + (x >> 1) * frame->yuv_pixel_stride[1];
+	frame->yuv[2] += (y >> 1) * frame->yuv_line_stride[1] + (x >> 1) * frame->yuv_pixel_stride[1];
+	
+	frame->yuv_cx = x & 1;
+	frame->yuv_cy = y & 1;
+}
+
+static void _yuv_hflip(av_frame_t *frame)
+{
+	_yuv_offset(frame, frame->width - 1, 0);
+	
+	/* The last pixel becomes the first, so a chroma sample
+	 * the new origin doesn't start now ends on it */
+	frame->yuv_cx ^= 1;
+	frame->yuv_pixel_stride[0] = -frame->yuv_pixel_stride[0];
+	frame->yuv_pixel_stride[1] = -frame->yuv_pixel_stride[1];
+}
+
+static void _yuv_vflip(av_frame_t *frame)
+{
+	_yuv_offset(frame, 0, frame->height - 1);
+	
+	frame->yuv_cy ^= 1;
+	frame->yuv_line_stride[0] = -frame->yuv_line_stride[0];
+	frame->yuv_line_stride[1] = -frame->yuv_line_stride[1];
+}
+
 void av_hflip_frame(av_frame_t *frame)
 {
+	if(frame->yuv[0] != NULL)
+	{
+		_yuv_hflip(frame);
+		return;
+	}
+	
 	frame->framebuffer += (frame->width - 1) * frame->pixel_stride;
 	frame->pixel_stride = -frame->pixel_stride;
 }
 
 void av_vflip_frame(av_frame_t *frame)
 {
+	if(frame->yuv[0] != NULL)
+	{
+		_yuv_vflip(frame);
+		return;
+	}
+	
 	frame->framebuffer += (frame->height - 1) * frame->line_stride;
 	frame->line_stride = -frame->line_stride;
 }
@@ -210,19 +286,38 @@ void av_rotate_frame(av_frame_t *frame, int a)
 	{
 		/* Rotate the frame 90 degrees clockwise */
 		
-		/* Move the origin to the bottom left of the image */
-		frame->framebuffer += (frame->height - 1) * frame->line_stride;
+		if(frame->yuv[0] != NULL)
+		{
+			/* Flip vertically, then swap the axes */
+			_yuv_vflip(frame);
+			
+			for(i = 0; i < 2; i++)
+			{
+				int t = frame->yuv_pixel_stride[i];
+				frame->yuv_pixel_stride[i] = frame->yuv_line_stride[i];
+				frame->yuv_line_stride[i] = t;
+			}
+			
+			i = frame->yuv_cx;
+			frame->yuv_cx = frame->yuv_cy;
+			frame->yuv_cy = i;
+		}
+		else
+		{
+			/* Move the origin to the bottom left of the image */
+			frame->framebuffer += (frame->height - 1) * frame->line_stride;
+			
+			/* Reverse the line and pixel strides */
+			i = frame->pixel_stride;
+			frame->pixel_stride = -frame->line_stride;
+			frame->line_stride = i;
+		}
 		
 		/* Reverse the image dimensions */
 		i = frame->width;
 		frame->width = frame->height;
 		frame->height = i;
 		
-		/* Reverse the line and pixel strides */
-		i = frame->pixel_stride;
-		frame->pixel_stride = -frame->line_stride;
-		frame->line_stride = i;
-		
 		/* Reverse the pixel aspect ratio (r = 1 / r) */
 		frame->pixel_aspect_ratio = (rational_t) {
 			frame->pixel_aspect_ratio.den,
@@ -245,7 +340,15 @@ void av_crop_frame(av_frame_t *frame, int x, int y, int width, int height)
 	if(x + width > frame->width) width = frame->width - x;
 	if(y + height > frame->height) height = frame->height - y;
 	
-	frame->framebuffer += y * frame->line_stride + x * frame->pixel_stride;
+	if(frame->yuv[0] != NULL)
+	{
+		_yuv_offset(frame, x, y);
+	}
+	else
+	{
+		frame->framebuffer += y * frame->line_stride + x * frame->pixel_stride;
+	}
+	
 	frame->width = width;
 	frame->height = height;
 }
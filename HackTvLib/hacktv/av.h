@@ -26,6 +26,10 @@
 #define AV_ERROR         -1
 #define AV_OUT_OF_MEMORY -2
 
+/* YUV matrix coefficients */
+#define AV_YUV_BT601 0
+#define AV_YUV_BT709 1
+
 typedef struct {
 
     /* Dimensions */
@@ -37,6 +41,17 @@ typedef struct {
     int pixel_stride;
     int line_stride;
 
+    /* Planar limited range YUV 4:2:0, used when there is no
+     * framebuffer. Index 0 of the strides is for the Y plane and
+     * 1 for both chroma planes, in bytes. Pixel x, y takes its
+     * chroma from sample (x + yuv_cx) / 2, (y + yuv_cy) / 2 */
+    const uint8_t *yuv[3];
+    int yuv_pixel_stride[2];
+    int yuv_line_stride[2];
+    int yuv_cx;
+    int yuv_cy;
+    int yuv_matrix;
+
     /* The pixel aspect ratio */
     rational_t pixel_aspect_ratio;
 
@@ -48,6 +63,7 @@ typedef struct {
 typedef int (*av_read_video_t)(void *ctx, av_frame_t *frame);
 typedef int16_t *(*av_read_audio_t)(void *ctx, size_t *samples);
 typedef int (*av_eof_t)(void *ctx);
+typedef int (*av_fill_t)(void *ctx, int *video_frames, int *audio_frames, int *depth);
 typedef int (*av_close_t)(void *ctx);
 
 /* Frame fit/crop modes */
@@ -70,6 +86,22 @@ typedef struct {
     rational_t max_display_aspect_ratio;
     av_frame_t default_frame;
 
+    /* Sources may return planar YUV frames if set */
+    int yuv;
+
+    /* Decoded frames a source may queue ahead, 0 for its default */
+    int frame_queue;
+
+    /* Video scaler algorithm (NULL for the default), and
+     * the scaler's thread count, 0 for automatic */
+    char *scaler;
+    int scaler_threads;
+
+    /* Polled by a source while it opens or waits on input, it
+     * gives up once this returns non-zero. May be NULL */
+    int (*interrupt)(void *opaque);
+    void *interrupt_opaque;
+
     /* Video state */
     unsigned int frames;
 
@@ -79,11 +111,17 @@ typedef struct {
     /* Audio state */
     unsigned int samples;
 
+    /* Length in seconds of one cycle of a source that repeats.
+     * Sources set 0/1 for a still image. Left at 0/0, the source
+     * doesn't repeat or can't say, and the output won't be looped */
+    rational_t period;
+
     /* AV source data and callbacks */
     void *av_source_ctx;
     av_read_video_t read_video;
     av_read_audio_t read_audio;
     av_eof_t eof;
+    av_fill_t fill;
     av_close_t close;
 
 } av_t;
@@ -97,7 +135,9 @@ void av_frame_init(av_frame_t *frame, int width, int height, uint32_t *framebuff
 int av_read_video(av_t *s, av_frame_t *frame);
 int16_t *av_read_audio(av_t *s, size_t *samples);
 int av_eof(av_t *s);
+int av_fill(av_t *s, int *video_frames, int *audio_frames, int *depth);
 int av_close(av_t *s);
+void av_move(av_t *dst, av_t *src);
 
 rational_t av_display_aspect_ratio(av_frame_t *frame);
 void av_set_display_aspect_ratio(av_frame_t *frame, rational_t display_aspect_ratio);
@@ -33,9 +33,15 @@
  *
  * Audio resampler - Resamples the decoded audio frames to the format
  *                   required by hacktv (32000Hz, Stereo, 16-bit)
+ * 
+ * Frames are passed between the threads through rings of preallocated
+ * AVFrames, so a slow frame on one side doesn't stall the other.
+ * Each packet queue is a fixed pool of AVPackets with its own lock,
+ * so the audio and video streams never wait on each other's lock.
 */
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
 #include <libavdevice/avdevice.h>
@@ -44,6 +50,7 @@
 #include <libavutil/opt.h>
 #include <libavutil/time.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 #include <libavutil/cpu.h>
 #include "hacktv.h"
 
@@ -51,44 +58,63 @@
 /* Taken from ffplay.c */
 #define MAX_QUEUE_SIZE (15 * 1024 * 1024)
 
-typedef struct __packet_queue_item_t {
-	
-	AVPacket pkt;
-	struct __packet_queue_item_t *next;
-	
-} _packet_queue_item_t;
+/* Maximum number of packets in each packet queue */
+#define _PACKET_QUEUE 1024
 
 typedef struct {
 	
+	/* A fixed pool of packets, used as a ring */
+	int count;
+	AVPacket *pkt;
+	int first;	/* Position of the first packet */
+	
 	int length;	/* Number of packets */
 	int size;       /* Number of bytes used */
 	int eof;        /* End of stream / file flag */
 	int abort;      /* Abort flag */
 	
-	/* Pointers to the first and last packets in the queue */
-	_packet_queue_item_t *first;
-	_packet_queue_item_t *last;
+	/* Each queue has its own lock, so the streams don't contend */
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
 	
 } _packet_queue_t;
 
+/* Decoded frames queued between two threads by default */
+#define _FRAME_QUEUE 8
+
 typedef struct {
 	
-	int ready;	/* Frame ready flag */
-	int repeat;	/* Repeat the previous frame */
-	int abort;	/* Abort flag */
+	/* The AVFrame buffers, and for each the number of times
+	 * the previous frame is to be repeated before it */
+	int count;
+	AVFrame **frame;
+	int *repeat;
+	
+	/* Repeats for the next frame, producer only */
+	int next_repeat;
+	
+	/* Producer and consumer positions, modulo count * 2. The
+	 * consumer keeps the frame at tail until its next read */
+	atomic_int head;
+	atomic_int tail;
+	atomic_int held;
+	
+	/* A frame without data, returned for repeats before the first frame */
+	AVFrame *blank;
 	
-	/* The AVFrame buffers */
-	AVFrame *frame[2];
+	atomic_int eof;		/* No more frames will be added */
+	atomic_int abort;	/* Abort flag */
 	
-	/* Thread locking and signaling */
+	/* Sleeping while the ring is full or empty */
+	atomic_int waiting;
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
 	
-} _frame_dbuffer_t;
+} _frame_ring_t;
 
 typedef struct {
 	
-	av_t *av;
+	av_t av;
 	
 	AVFormatContext *format_ctx;
 	
@@ -98,12 +124,15 @@ typedef struct {
 	_packet_queue_t video_queue;
 	AVStream *video_stream;
 	AVCodecContext *video_codec_ctx;
-	_frame_dbuffer_t in_video_buffer;
+	_frame_ring_t in_video_buffer;
 	int video_eof;
 	
-	/* Video scaling */
+	/* Video scaling, and the frame sizes and formats the context is for */
 	struct SwsContext *sws_ctx;
-	_frame_dbuffer_t out_video_buffer;
+	int sws_key[6];
+	int sws_flags;
+	int sws_threads;
+	_frame_ring_t out_video_buffer;
 	
 	/* Audio decoder */
 	AVRational audio_time_base;
@@ -111,15 +140,18 @@ typedef struct {
 	_packet_queue_t audio_queue;
 	AVStream *audio_stream;
 	AVCodecContext *audio_codec_ctx;
-	_frame_dbuffer_t in_audio_buffer;
+	_frame_ring_t in_audio_buffer;
 	int audio_eof;
 	
 	/* Audio resampler */
 	struct SwrContext *swr_ctx;
-	_frame_dbuffer_t out_audio_buffer;
+	_frame_ring_t out_audio_buffer;
 	int out_frame_size;
 	int allowed_error;
 	
+	/* Decoded frames queued between each pair of threads */
+	int frame_queue;
+	
 	/* Threads */
 	pthread_t input_thread;
 	pthread_t video_decode_thread;
@@ -127,11 +159,7 @@ typedef struct {
 	pthread_t audio_decode_thread;
 	pthread_t audio_scaler_thread;
 	volatile int thread_abort;
-	int input_stall;
-	
-	/* Thread locking and signaling for input queues */
-	pthread_mutex_t mutex;
-	pthread_cond_t cond;
+	atomic_int input_stall;
 	
 } av_ffmpeg_t;
 
@@ -163,34 +191,41 @@ void _audio_offset(uint8_t const **dst, uint8_t const * const *src, int offset,
 	}
 }
 
-static int _packet_queue_init(av_ffmpeg_t *s, _packet_queue_t *q)
+static int _packet_queue_init(av_ffmpeg_t *s, _packet_queue_t *q, int count)
 {
+	q->count = count;
+	q->pkt = calloc(count, sizeof(AVPacket));
+	q->first = 0;
 	q->length = 0;
 	q->size = 0;
 	q->eof = 0;
 	q->abort = 0;
 	
+	if(q->pkt == NULL)
+	{
+		return(-1);
+	}
+	
+	pthread_mutex_init(&q->mutex, NULL);
+	pthread_cond_init(&q->cond, NULL);
+	
 	return(0);
 }
 
 static int _packet_queue_flush(av_ffmpeg_t *s, _packet_queue_t *q)
 {
-	_packet_queue_item_t *p;
-	
-	pthread_mutex_lock(&s->mutex);
+	pthread_mutex_lock(&q->mutex);
 	
-	while(q->length--)
+	for(; q->length > 0; q->length--)
 	{
-		/* Pop the first item off the list */
-		p = q->first;
-		q->first = p->next;
-		
-		av_packet_unref(&p->pkt);
-		free(p);
+		av_packet_unref(&q->pkt[q->first]);
+		q->first = (q->first + 1) % q->count;
 	}
 	
-	pthread_cond_signal(&s->cond);
-	pthread_mutex_unlock(&s->mutex);
+	q->size = 0;
+	
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
 	
 	return(0);
 }
@@ -198,23 +233,40 @@ static int _packet_queue_flush(av_ffmpeg_t *s, _packet_queue_t *q)
 static void _packet_queue_free(av_ffmpeg_t *s, _packet_queue_t *q)
 {
 	_packet_queue_flush(s, q);
+	
+	pthread_cond_destroy(&q->cond);
+	pthread_mutex_destroy(&q->mutex);
+	
+	free(q->pkt);
 }
 
 static void _packet_queue_abort(av_ffmpeg_t *s, _packet_queue_t *q)
 {
-	pthread_mutex_lock(&s->mutex);
+	pthread_mutex_lock(&q->mutex);
 	
 	q->abort = 1;
 	
-	pthread_cond_signal(&s->cond);
-	pthread_mutex_unlock(&s->mutex);
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
 }
 
-static int _packet_queue_write(av_ffmpeg_t *s, _packet_queue_t *q, AVPacket *pkt)
+static void _packet_queue_stall(av_ffmpeg_t *s, _packet_queue_t *q)
 {
-	_packet_queue_item_t *p;
+	_packet_queue_t *o = (q == &s->video_queue ? &s->audio_queue : &s->video_queue);
+	
+	/* The input is waiting on queue q, let the other
+	 * stream's decoder know. Only the input thread ever
+	 * holds two queue locks, so this can't deadlock */
+	atomic_store(&s->input_stall, 1);
 	
-	pthread_mutex_lock(&s->mutex);
+	pthread_mutex_lock(&o->mutex);
+	pthread_cond_signal(&o->cond);
+	pthread_mutex_unlock(&o->mutex);
+}
+
+static int _packet_queue_write(av_ffmpeg_t *s, _packet_queue_t *q, AVPacket *pkt)
+{
+	pthread_mutex_lock(&q->mutex);
 	
 	/* A NULL packet signals the end of the stream / file */
 	if(pkt == NULL)
@@ -223,203 +275,298 @@ static int _packet_queue_write(av_ffmpeg_t *s, _packet_queue_t *q, AVPacket *pkt
 	}
 	else
 	{
-		/* Limit the size of the queue */
-		while(q->abort == 0 && q->size + pkt->size + sizeof(_packet_queue_item_t) > MAX_QUEUE_SIZE)
+		/* Limit the size of the queue. A packet larger than
+		 * the limit is still let through into an empty queue */
+		while(q->abort == 0 && (q->length == q->count ||
+		      (q->length > 0 && q->size + pkt->size > MAX_QUEUE_SIZE)))
 		{
-			s->input_stall = 1;
-			pthread_cond_signal(&s->cond);
-			pthread_cond_wait(&s->cond, &s->mutex);
+			_packet_queue_stall(s, q);
+			pthread_cond_wait(&q->cond, &q->mutex);
 		}
 		
-		s->input_stall = 0;
+		atomic_store(&s->input_stall, 0);
 		
 		if(q->abort == 1)
 		{
 			/* Abort was called while waiting for the queue size to drop */
 			av_packet_unref(pkt);
 			
-			pthread_cond_signal(&s->cond);
-			pthread_mutex_unlock(&s->mutex);
+			pthread_cond_signal(&q->cond);
+			pthread_mutex_unlock(&q->mutex);
 			
 			return(-2);
 		}
 		
-		/* Allocate memory for queue item and copy packet */
-		p = malloc(sizeof(_packet_queue_item_t));
-		p->pkt = *pkt;
-		p->next = NULL;
-		
-		/* Add the item to the end of the queue */
-		if(q->length == 0)
-		{
-			q->first = p;
-		}
-		else
-		{
-			q->last->next = p;
-		}
-		
-		q->last = p;
+		/* Copy the packet into the next free slot */
+		q->pkt[(q->first + q->length) % q->count] = *pkt;
 		q->length++;
-		q->size += pkt->size + sizeof(_packet_queue_item_t);
+		q->size += pkt->size;
 	}
 	
-	pthread_cond_signal(&s->cond);
-	pthread_mutex_unlock(&s->mutex);
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
 	
 	return(0);
 }
 
 static int _packet_queue_read(av_ffmpeg_t *s, _packet_queue_t *q, AVPacket *pkt)
 {
-	_packet_queue_item_t *p;
-	
-	pthread_mutex_lock(&s->mutex);
+	pthread_mutex_lock(&q->mutex);
 	
 	while(q->length == 0)
 	{
-		if(s->input_stall)
+		if(atomic_load(&s->input_stall))
 		{
-			pthread_mutex_unlock(&s->mutex);
+			pthread_mutex_unlock(&q->mutex);
 			return(0);
 		}
 		
 		if(q->abort == 1 || q->eof == 1)
 		{
-			pthread_mutex_unlock(&s->mutex);
+			pthread_mutex_unlock(&q->mutex);
 			return(q->abort == 1 ? -2 : -1);
 		}
 		
-		pthread_cond_wait(&s->cond, &s->mutex);
+		pthread_cond_wait(&q->cond, &q->mutex);
 	}
 	
-	p = q->first;
-	
-	*pkt = p->pkt;
-	q->first = p->next;
+	/* Take the packet from the first slot */
+	*pkt = q->pkt[q->first];
+	q->first = (q->first + 1) % q->count;
 	q->length--;
-	q->size -= pkt->size + sizeof(_packet_queue_item_t);
-	
-	free(p);
+	q->size -= pkt->size;
 	
-	pthread_cond_signal(&s->cond);
-	pthread_mutex_unlock(&s->mutex);
+	pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->mutex);
 	
 	return(0);
 }
 
-static int _frame_dbuffer_init(_frame_dbuffer_t *d)
+static int _frame_ring_init(_frame_ring_t *d, int count)
 {
-	d->ready = 0;
-	d->repeat = 0;
-	d->abort = 0;
+	int i;
+	
+	d->count = count;
+	d->next_repeat = 0;
+	atomic_init(&d->head, 0);
+	atomic_init(&d->tail, 0);
+	atomic_init(&d->held, 0);
+	atomic_init(&d->eof, 0);
+	atomic_init(&d->abort, 0);
+	atomic_init(&d->waiting, 0);
 	
-	d->frame[0] = av_frame_alloc();
-	d->frame[1] = av_frame_alloc();
+	d->frame = calloc(count, sizeof(AVFrame *));
+	d->repeat = calloc(count, sizeof(int));
+	d->blank = av_frame_alloc();
 	
-	if(!d->frame[0] || !d->frame[1])
+	if(!d->frame || !d->repeat || !d->blank)
 	{
-		av_frame_free(&d->frame[0]);
-		av_frame_free(&d->frame[1]);
+		free(d->frame);
+		free(d->repeat);
+		av_frame_free(&d->blank);
 		return(-1);
 	}
 	
+	for(i = 0; i < count; i++)
+	{
+		d->frame[i] = av_frame_alloc();
+		
+		if(!d->frame[i])
+		{
+			while(i--) av_frame_free(&d->frame[i]);
+			free(d->frame);
+			free(d->repeat);
+			av_frame_free(&d->blank);
+			return(-1);
+		}
+	}
+	
 	pthread_mutex_init(&d->mutex, NULL);
 	pthread_cond_init(&d->cond, NULL);
 	
 	return(0);
 }
 
-static void _frame_dbuffer_free(_frame_dbuffer_t *d)
+static void _frame_ring_free(_frame_ring_t *d)
 {
+	int i;
+	
 	pthread_cond_destroy(&d->cond);
 	pthread_mutex_destroy(&d->mutex);
 	
-	av_frame_free(&d->frame[0]);
-	av_frame_free(&d->frame[1]);
+	for(i = 0; i < d->count; i++)
+	{
+		av_frame_free(&d->frame[i]);
+	}
+	
+	free(d->frame);
+	free(d->repeat);
+	av_frame_free(&d->blank);
 }
 
-static void _frame_dbuffer_abort(_frame_dbuffer_t *d)
+static int _frame_ring_used(const _frame_ring_t *d, int head, int tail)
 {
-	pthread_mutex_lock(&d->mutex);
+	return((head - tail + d->count * 2) % (d->count * 2));
+}
+
+static int _frame_ring_fill(_frame_ring_t *d)
+{
+	int used;
 	
-	d->abort = 1;
+	/* Frames ready and not yet read */
+	used = _frame_ring_used(d,
+		atomic_load_explicit(&d->head, memory_order_acquire),
+		atomic_load_explicit(&d->tail, memory_order_acquire)
+	);
 	
-	pthread_cond_signal(&d->cond);
-	pthread_mutex_unlock(&d->mutex);
+	return(used - atomic_load_explicit(&d->held, memory_order_relaxed));
 }
 
-static AVFrame *_frame_dbuffer_back_buffer(_frame_dbuffer_t *d)
+static void _frame_ring_wake(_frame_ring_t *d)
 {
-	AVFrame *frame;
+	/* Only take the lock if the other side is asleep. This load
+	 * and the position store before it are sequentially consistent,
+	 * pairing with the same in _frame_ring_wait() */
+	if(atomic_load(&d->waiting))
+	{
+		pthread_mutex_lock(&d->mutex);
+		pthread_cond_broadcast(&d->cond);
+		pthread_mutex_unlock(&d->mutex);
+	}
+}
+
+static void _frame_ring_wait(_frame_ring_t *d, int producer)
+{
+	int held = atomic_load_explicit(&d->held, memory_order_relaxed);
+	int head, tail;
 	
 	pthread_mutex_lock(&d->mutex);
+	atomic_fetch_add(&d->waiting, 1);
 	
-	/* Wait for the ready flag to be unset */
-	while(d->ready != 0 && d->abort == 0)
+	while(!atomic_load(&d->abort))
 	{
+		head = atomic_load(&d->head);
+		tail = atomic_load(&d->tail);
+		
+		if(producer)
+		{
+			/* Wait for a free slot */
+			if(_frame_ring_used(d, head, tail) < d->count) break;
+		}
+		else
+		{
+			/* Wait for a frame after the held one */
+			if(_frame_ring_used(d, head, tail) > held || atomic_load(&d->eof)) break;
+		}
+		
 		pthread_cond_wait(&d->cond, &d->mutex);
 	}
 	
-	frame = d->frame[1];
-	
+	atomic_fetch_sub(&d->waiting, 1);
 	pthread_mutex_unlock(&d->mutex);
+}
+
+static void _frame_ring_eof(_frame_ring_t *d)
+{
+	/* Let the consumer read what's left, then end */
+	atomic_store(&d->eof, 1);
 	
-	return(frame);
+	pthread_mutex_lock(&d->mutex);
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
 }
 
-static void _frame_dbuffer_ready(_frame_dbuffer_t *d, int repeat)
+static void _frame_ring_abort(_frame_ring_t *d)
 {
+	atomic_store(&d->abort, 1);
+	
 	pthread_mutex_lock(&d->mutex);
+	pthread_cond_broadcast(&d->cond);
+	pthread_mutex_unlock(&d->mutex);
+}
+
+static AVFrame *_frame_ring_back_buffer(_frame_ring_t *d)
+{
+	int head = atomic_load_explicit(&d->head, memory_order_relaxed);
 	
-	/* Wait for the ready flag to be unset */
-	while(d->ready != 0 && d->abort == 0)
+	/* Wait for a free slot */
+	if(_frame_ring_used(d, head, atomic_load_explicit(&d->tail, memory_order_acquire)) == d->count)
 	{
-		pthread_cond_wait(&d->cond, &d->mutex);
+		_frame_ring_wait(d, 1);
 	}
 	
-	d->ready = 1;
-	d->repeat = repeat;
+	if(atomic_load(&d->abort))
+	{
+		return(NULL);
+	}
 	
-	pthread_cond_signal(&d->cond);
-	pthread_mutex_unlock(&d->mutex);
+	return(d->frame[head % d->count]);
 }
 
-static AVFrame *_frame_dbuffer_flip(_frame_dbuffer_t *d)
+static void _frame_ring_ready(_frame_ring_t *d, int repeat)
 {
-	AVFrame *frame;
+	int head;
 	
-	pthread_mutex_lock(&d->mutex);
+	/* Repeats go with the next frame rather than taking a slot */
+	if(repeat)
+	{
+		d->next_repeat++;
+		return;
+	}
 	
-	/* Wait for a flag to be set */
-	while(d->ready == 0 && d->abort == 0)
+	if(atomic_load(&d->abort))
 	{
-		pthread_cond_wait(&d->cond, &d->mutex);
+		return;
 	}
 	
-	/* Die if it was the abort flag */
-	if(d->abort != 0)
+	head = atomic_load_explicit(&d->head, memory_order_relaxed);
+	
+	d->repeat[head % d->count] = d->next_repeat;
+	d->next_repeat = 0;
+	
+	atomic_store(&d->head, (head + 1) % (d->count * 2));
+	_frame_ring_wake(d);
+}
+
+static AVFrame *_frame_ring_read(_frame_ring_t *d)
+{
+	int tail = atomic_load_explicit(&d->tail, memory_order_relaxed);
+	int held = atomic_load_explicit(&d->held, memory_order_relaxed);
+	int *repeat;
+	
+	/* Wait for a frame after the held one */
+	if(_frame_ring_used(d, atomic_load_explicit(&d->head, memory_order_acquire), tail) <= held)
+	{
+		_frame_ring_wait(d, 0);
+	}
+	
+	/* Die if aborted, or the frames have run out */
+	if(atomic_load(&d->abort) ||
+	   _frame_ring_used(d, atomic_load_explicit(&d->head, memory_order_acquire), tail) <= held)
 	{
-		pthread_mutex_unlock(&d->mutex);
 		return(NULL);
 	}
 	
-	/* Swap the frames if we're not repeating */
-	if(d->repeat == 0)
+	repeat = &d->repeat[(tail + held) % d->count];
+	
+	if(*repeat > 0)
 	{
-		frame       = d->frame[1];
-		d->frame[1] = d->frame[0];
-		d->frame[0] = frame;
+		/* Show the previous frame again */
+		(*repeat)--;
+		return(held ? d->frame[tail % d->count] : d->blank);
 	}
 	
-	frame = d->frame[0];
-	d->ready = 0;
+	if(held)
+	{
+		/* Release the held frame */
+		tail = (tail + 1) % (d->count * 2);
+		atomic_store(&d->tail, tail);
+		_frame_ring_wake(d);
+	}
 	
-	/* Signal we're finished and release the mutex */
-	pthread_cond_signal(&d->cond);
-	pthread_mutex_unlock(&d->mutex);
+	atomic_store_explicit(&d->held, 1, memory_order_relaxed);
 	
-	return(frame);
+	return(d->frame[tail % d->count]);
 }
 
 static void *_input_thread(void *arg)
@@ -514,8 +661,11 @@ static void *_video_decode_thread(void *arg)
 		if(r == 0)
 		{
 			/* We have received a frame! */
-			av_frame_ref(_frame_dbuffer_back_buffer(&s->in_video_buffer), frame);
-			_frame_dbuffer_ready(&s->in_video_buffer, 0);
+			AVFrame *dst = _frame_ring_back_buffer(&s->in_video_buffer);
+			if(dst == NULL) break;
+			
+			av_frame_ref(dst, frame);
+			_frame_ring_ready(&s->in_video_buffer, 0);
 		}
 		else if(r != AVERROR(EAGAIN))
 		{
@@ -524,7 +674,7 @@ static void *_video_decode_thread(void *arg)
 		}
 	}
 	
-	_frame_dbuffer_abort(&s->in_video_buffer);
+	_frame_ring_eof(&s->in_video_buffer);
 	
 	av_frame_free(&frame);
 	
@@ -533,10 +683,92 @@ static void *_video_decode_thread(void *arg)
 	return(NULL);
 }
 
+static enum AVPixelFormat _scaler_format(av_ffmpeg_t *s, AVFrame *frame)
+{
+	const AVPixFmtDescriptor *d = av_pix_fmt_desc_get(frame->format);
+	
+	/* YUV sources are scaled as planar YUV if the renderer can take
+	 * it, saving a conversion to RGB and back. Like the RGB output
+	 * this is always limited range */
+	if(s->av.yuv && d != NULL && d->nb_components >= 3 &&
+	   !(d->flags & (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL)))
+	{
+		return(AV_PIX_FMT_YUV420P);
+	}
+	
+	return(AV_PIX_FMT_RGB32);
+}
+
+static struct SwsContext *_scaler_context(av_ffmpeg_t *s, const AVFrame *frame, const AVFrame *oframe)
+{
+	int key[6] = {
+		frame->width, frame->height, frame->format,
+		oframe->width, oframe->height, oframe->format
+	};
+	
+	if(s->sws_ctx != NULL && memcmp(key, s->sws_key, sizeof(key)) == 0)
+	{
+		return(s->sws_ctx);
+	}
+	
+	/* sws_getCachedContext() can't set the thread count,
+	 * so the context is rebuilt here when anything changes */
+	sws_freeContext(s->sws_ctx);
+	
+	s->sws_ctx = sws_alloc_context();
+	if(!s->sws_ctx)
+	{
+		return(NULL);
+	}
+	
+	av_opt_set_int(s->sws_ctx, "srcw", frame->width, 0);
+	av_opt_set_int(s->sws_ctx, "srch", frame->height, 0);
+	av_opt_set_int(s->sws_ctx, "src_format", frame->format, 0);
+	av_opt_set_int(s->sws_ctx, "dstw", oframe->width, 0);
+	av_opt_set_int(s->sws_ctx, "dsth", oframe->height, 0);
+	av_opt_set_int(s->sws_ctx, "dst_format", oframe->format, 0);
+	av_opt_set_int(s->sws_ctx, "sws_flags", s->sws_flags, 0);
+	
+	/* Older versions of libswscale have no slice threading */
+	av_opt_set_int(s->sws_ctx, "threads", s->sws_threads, 0);
+	
+	if(sws_init_context(s->sws_ctx, NULL, NULL) < 0)
+	{
+		sws_freeContext(s->sws_ctx);
+		s->sws_ctx = NULL;
+		return(NULL);
+	}
+	
+	memcpy(s->sws_key, key, sizeof(key));
+	
+	return(s->sws_ctx);
+}
+
+static int _scaler_passthru(av_ffmpeg_t *s, const AVFrame *frame, rational_t r, enum AVPixelFormat fmt)
+{
+	/* The decoded frame can be used as it is if it's already
+	 * the right size and format. Any cropping is left to the
+	 * renderer. YUV must also be limited range */
+	if(frame->width != r.num || frame->height != r.den ||
+	   frame->format != fmt || frame->buf[0] == NULL ||
+	   frame->linesize[0] <= 0)
+	{
+		return(0);
+	}
+	
+	if(fmt == AV_PIX_FMT_YUV420P && frame->color_range == AVCOL_RANGE_JPEG)
+	{
+		return(0);
+	}
+	
+	return(1);
+}
+
 static void *_video_scaler_thread(void *arg)
 {
 	av_ffmpeg_t *s = (av_ffmpeg_t *) arg;
 	AVFrame *frame, *oframe;
+	enum AVPixelFormat fmt;
 	AVRational ratio;
 	rational_t r;
 	int64_t pts;
@@ -544,7 +776,7 @@ static void *_video_scaler_thread(void *arg)
 	//fprintf(stderr, "_video_scaler_thread(): Starting\n");
 	
 	/* Fetch video frames and pass them through the scaler */
-	while((frame = _frame_dbuffer_flip(&s->in_video_buffer)) != NULL)
+	while((frame = _frame_ring_read(&s->in_video_buffer)) != NULL)
 	{
 		pts = frame->best_effort_timestamp;
 		
@@ -563,13 +795,14 @@ static void *_video_scaler_thread(void *arg)
 			while(pts > 0)
 			{
 				/* This frame is in the future. Repeat the previous one */
-				_frame_dbuffer_ready(&s->out_video_buffer, 1);
+				_frame_ring_ready(&s->out_video_buffer, 1);
 				s->video_start_time++;
 				pts--;
 			}
 		}
 		
-		oframe = _frame_dbuffer_back_buffer(&s->out_video_buffer);
+		oframe = _frame_ring_back_buffer(&s->out_video_buffer);
+		if(!oframe) break;
 		
 		ratio = av_guess_sample_aspect_ratio(s->format_ctx, s->video_stream, frame);
 		
@@ -580,7 +813,7 @@ static void *_video_scaler_thread(void *arg)
 		}
 		
 		r = av_calculate_frame_size(
-			s->av,
+			&s->av,
 			(rational_t) { frame->width, frame->height },
 			rational_mul(
 				(rational_t) { ratio.num, ratio.den },
@@ -588,51 +821,49 @@ static void *_video_scaler_thread(void *arg)
 			)
 		);
 		
-		if(r.num != oframe->width ||
-		   r.den != oframe->height)
+		fmt = _scaler_format(s, frame);
+		
+		if(_scaler_passthru(s, frame, r, fmt))
+		{
+			/* Pass on a reference to the decoded frame, no copy */
+			av_frame_unref(oframe);
+			av_frame_ref(oframe, frame);
+		}
+		else
 		{
-			av_freep(&oframe->data[0]);
+			if(r.num != oframe->width ||
+			   r.den != oframe->height ||
+			   fmt != oframe->format ||
+			   !av_frame_is_writable(oframe))
+			{
+				av_frame_unref(oframe);
+				
+				oframe->format = fmt;
+				oframe->width = r.num;
+				oframe->height = r.den;
+				
+				if(av_frame_get_buffer(oframe, 0) < 0) break;
+			}
 			
-			oframe->format = AV_PIX_FMT_RGB32;
-			oframe->width = r.num;
-			oframe->height = r.den;
+			/* Initialise / re-initialise software scaler */
+			if(!_scaler_context(s, frame, oframe)) break;
 			
-			int i = av_image_alloc(
+#if LIBSWSCALE_VERSION_INT >= AV_VERSION_INT(6, 1, 100)
+			/* Split across the scaler's slice threads */
+			sws_scale_frame(s->sws_ctx, oframe, frame);
+#else
+			sws_scale(
+				s->sws_ctx,
+				(uint8_t const * const *) frame->data,
+				frame->linesize,
+				0,
+				frame->height,
 				oframe->data,
-				oframe->linesize,
-				oframe->width, oframe->height,
-				AV_PIX_FMT_RGB32, av_cpu_max_align()
+				oframe->linesize
 			);
-			memset(oframe->data[0], 0, i);
+#endif
 		}
 		
-		/* Initialise / re-initialise software scaler */
-		s->sws_ctx = sws_getCachedContext(
-			s->sws_ctx,
-			frame->width,
-			frame->height,
-			frame->format,
-			oframe->width,
-			oframe->height,
-			AV_PIX_FMT_RGB32,
-			SWS_BICUBIC,
-			NULL,
-			NULL,
-			NULL
-		);
-		
-		if(!s->sws_ctx) break;
-		
-		sws_scale(
-			s->sws_ctx,
-			(uint8_t const * const *) frame->data,
-			frame->linesize,
-			0,
-			s->video_codec_ctx->height,
-			oframe->data,
-			oframe->linesize
-		);
-		
 		/* Adjust the pixel ratio for the scaled image */
 		av_reduce(
 			&oframe->sample_aspect_ratio.num,
@@ -643,6 +874,8 @@ static void *_video_scaler_thread(void *arg)
 		);
 		
 		/* Copy some data to the scaled image */
+		oframe->colorspace = frame->colorspace;
+		
 #if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(58, 29, 100)
 		oframe->interlaced_frame = frame->flags & AV_FRAME_FLAG_INTERLACED ? 1 : 0;
 		oframe->top_field_first = frame->flags & AV_FRAME_FLAG_TOP_FIELD_FIRST ? 1 : 0;
@@ -654,11 +887,11 @@ static void *_video_scaler_thread(void *arg)
 		/* Done with the frame */
 		av_frame_unref(frame);
 		
-		_frame_dbuffer_ready(&s->out_video_buffer, 0);
+		_frame_ring_ready(&s->out_video_buffer, 0);
 		s->video_start_time++;
 	}
 	
-	_frame_dbuffer_abort(&s->out_video_buffer);
+	_frame_ring_eof(&s->out_video_buffer);
 	
 	//fprintf(stderr, "_video_scaler_thread(): Ending\n");
 	
@@ -677,7 +910,7 @@ static int _ffmpeg_read_video(void *ctx, av_frame_t *frame)
 		return(AV_OK);
 	}
 	
-	avframe = _frame_dbuffer_flip(&s->out_video_buffer);
+	avframe = _frame_ring_read(&s->out_video_buffer);
 	if(!avframe)
 	{
 		/* EOF or abort */
@@ -685,6 +918,12 @@ static int _ffmpeg_read_video(void *ctx, av_frame_t *frame)
 		return(AV_OK);
 	}
 	
+	if(avframe->data[0] == NULL)
+	{
+		/* Nothing to show before the first frame */
+		return(AV_OK);
+	}
+	
 	/* Return image ratio */
 	if(avframe->sample_aspect_ratio.num > 0 &&
 	   avframe->sample_aspect_ratio.den > 0)
@@ -701,9 +940,25 @@ static int _ffmpeg_read_video(void *ctx, av_frame_t *frame)
 		frame->interlaced = avframe->top_field_first ? 1 : 2;
 	}
 	
-	/* Set the pointer to the framebuffer */
 	frame->width = avframe->width;
 	frame->height = avframe->height;
+	
+	if(avframe->format == AV_PIX_FMT_YUV420P)
+	{
+		/* Set the pointers to the YUV planes */
+		frame->yuv[0] = avframe->data[0];
+		frame->yuv[1] = avframe->data[1];
+		frame->yuv[2] = avframe->data[2];
+		frame->yuv_pixel_stride[0] = 1;
+		frame->yuv_pixel_stride[1] = 1;
+		frame->yuv_line_stride[0] = avframe->linesize[0];
+		frame->yuv_line_stride[1] = avframe->linesize[1];
+		frame->yuv_matrix = avframe->colorspace == AVCOL_SPC_BT709 ? AV_YUV_BT709 : AV_YUV_BT601;
+		
+		return(AV_OK);
+	}
+	
+	/* Set the pointer to the framebuffer */
 	frame->framebuffer = (uint32_t *) avframe->data[0];
 	frame->pixel_stride = 1;
 	frame->line_stride = avframe->linesize[0] / sizeof(uint32_t);
@@ -752,8 +1007,11 @@ static void *_audio_decode_thread(void *arg)
 		if(r == 0)
 		{
 			/* We have received a frame! */
-			av_frame_ref(_frame_dbuffer_back_buffer(&s->in_audio_buffer), frame);
-			_frame_dbuffer_ready(&s->in_audio_buffer, 0);
+			AVFrame *dst = _frame_ring_back_buffer(&s->in_audio_buffer);
+			if(dst == NULL) break;
+			
+			av_frame_ref(dst, frame);
+			_frame_ring_ready(&s->in_audio_buffer, 0);
 		}
 		else if(r != AVERROR(EAGAIN))
 		{
@@ -762,7 +1020,7 @@ static void *_audio_decode_thread(void *arg)
 		}
 	}
 	
-	_frame_dbuffer_abort(&s->in_audio_buffer);
+	_frame_ring_eof(&s->in_audio_buffer);
 	
 	av_frame_free(&frame);
 	
@@ -782,7 +1040,7 @@ static void *_audio_scaler_thread(void *arg)
 	//fprintf(stderr, "_audio_scaler_thread(): Starting\n");
 	
 	/* Fetch audio frames and pass them through the resampler */
-	while((frame = _frame_dbuffer_flip(&s->in_audio_buffer)) != NULL)
+	while((frame = _frame_ring_read(&s->in_audio_buffer)) != NULL)
 	{
 		pts = frame->best_effort_timestamp;
 		drop = 0;
@@ -837,7 +1095,9 @@ static void *_audio_scaler_thread(void *arg)
 		
 		do
 		{
-			oframe = _frame_dbuffer_back_buffer(&s->out_audio_buffer);
+			oframe = _frame_ring_back_buffer(&s->out_audio_buffer);
+			if(!oframe) break;
+			
 			r = swr_convert(
 				s->swr_ctx,
 				oframe->data,
@@ -849,7 +1109,7 @@ static void *_audio_scaler_thread(void *arg)
 			
 			oframe->nb_samples = r;
 			
-			_frame_dbuffer_ready(&s->out_audio_buffer, 0);
+			_frame_ring_ready(&s->out_audio_buffer, 0);
 			
 			s->audio_start_time += count;
 			count = 0;
@@ -859,7 +1119,7 @@ static void *_audio_scaler_thread(void *arg)
 		av_frame_unref(frame);
 	}
 	
-	_frame_dbuffer_abort(&s->out_audio_buffer);
+	_frame_ring_eof(&s->out_audio_buffer);
 	
 	//fprintf(stderr, "_audio_scaler_thread(): Ending\n");
 	
@@ -876,7 +1136,7 @@ static int16_t *_ffmpeg_read_audio(void *ctx, size_t *samples)
 		return(NULL);
 	}
 	
-	frame = _frame_dbuffer_flip(&s->out_audio_buffer);
+	frame = _frame_ring_read(&s->out_audio_buffer);
 	if(!frame)
 	{
 		/* EOF or abort */
@@ -902,6 +1162,18 @@ static int _ffmpeg_eof(void *ctx)
 	return(1);
 }
 
+static int _ffmpeg_fill(void *ctx, int *video_frames, int *audio_frames, int *depth)
+{
+	av_ffmpeg_t *s = ctx;
+	
+	/* Frames scaled and ready for the renderer */
+	*video_frames = s->video_stream ? _frame_ring_fill(&s->out_video_buffer) : 0;
+	*audio_frames = s->audio_stream ? _frame_ring_fill(&s->out_audio_buffer) : 0;
+	*depth = s->frame_queue;
+	
+	return(AV_OK);
+}
+
 static int _ffmpeg_close(void *ctx)
 {
 	av_ffmpeg_t *s = ctx;
@@ -914,18 +1186,14 @@ static int _ffmpeg_close(void *ctx)
 	
 	if(s->video_stream != NULL)
 	{
-		_frame_dbuffer_abort(&s->in_video_buffer);
-		_frame_dbuffer_abort(&s->out_video_buffer);
+		_frame_ring_abort(&s->in_video_buffer);
+		_frame_ring_abort(&s->out_video_buffer);
 		
 		pthread_join(s->video_decode_thread, NULL);
 		pthread_join(s->video_scaler_thread, NULL);
 		
-		_packet_queue_free(s, &s->video_queue);
-		_frame_dbuffer_free(&s->in_video_buffer);
-		
-		av_freep(&s->out_video_buffer.frame[0]->data[0]);
-		av_freep(&s->out_video_buffer.frame[1]->data[0]);
-		_frame_dbuffer_free(&s->out_video_buffer);
+		_frame_ring_free(&s->in_video_buffer);
+		_frame_ring_free(&s->out_video_buffer);
 		
 		avcodec_free_context(&s->video_codec_ctx);
 		sws_freeContext(s->sws_ctx);
@@ -933,27 +1201,26 @@ static int _ffmpeg_close(void *ctx)
 	
 	if(s->audio_stream != NULL)
 	{
-		_frame_dbuffer_abort(&s->in_audio_buffer);
-		_frame_dbuffer_abort(&s->out_audio_buffer);
+		_frame_ring_abort(&s->in_audio_buffer);
+		_frame_ring_abort(&s->out_audio_buffer);
 		
 		pthread_join(s->audio_decode_thread, NULL);
 		pthread_join(s->audio_scaler_thread, NULL);
 		
-		_packet_queue_free(s, &s->audio_queue);
-		_frame_dbuffer_free(&s->in_audio_buffer);
+		_frame_ring_free(&s->in_audio_buffer);
 		
 		//av_freep(&s->out_audio_buffer.frame[0]->data[0]);
 		//av_freep(&s->out_audio_buffer.frame[1]->data[0]);
-		_frame_dbuffer_free(&s->out_audio_buffer);
+		_frame_ring_free(&s->out_audio_buffer);
 		
 		avcodec_free_context(&s->audio_codec_ctx);
 		swr_free(&s->swr_ctx);
 	}
 	
-	avformat_close_input(&s->format_ctx);
+	_packet_queue_free(s, &s->video_queue);
+	_packet_queue_free(s, &s->audio_queue);
 	
-	pthread_cond_destroy(&s->cond);
-	pthread_mutex_destroy(&s->mutex);
+	avformat_close_input(&s->format_ctx);
 	
 	free(s);
 	
@@ -980,7 +1247,9 @@ int av_ffmpeg_open(av_t *av, char *input_url, char *format, char *options)
 		return(HACKTV_OUT_OF_MEMORY);
 	}
 	
-	s->av = av;
+	/* Keep a copy of the settings, the source may be
+	 * moved to another av_t once it's open */
+	s->av = *av;
 	
 	/* Use 'pipe:' for stdin */
 	if(strcmp(input_url, "-") == 0)
@@ -998,6 +1267,18 @@ int av_ffmpeg_open(av_t *av, char *input_url, char *format, char *options)
 		av_dict_parse_string(&opts, options, "=", ":", 0);
 	}
 	
+	/* The caller can abandon an open or read that's taking too long */
+	s->format_ctx = avformat_alloc_context();
+	if(!s->format_ctx)
+	{
+		av_dict_free(&opts);
+		free(s);
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	s->format_ctx->interrupt_callback.callback = av->interrupt;
+	s->format_ctx->interrupt_callback.opaque = av->interrupt_opaque;
+	
 	/* Open the video */
 	if((r = avformat_open_input(&s->format_ctx, input_url, fmt, &opts)) < 0)
 	{
@@ -1076,25 +1357,36 @@ int av_ffmpeg_open(av_t *av, char *input_url, char *format, char *options)
 			return(HACKTV_ERROR);
 		}
 		
-		/* Initialise SWS context for software scaling */
-		s->sws_ctx = sws_getContext(
-			s->video_codec_ctx->width,
-			s->video_codec_ctx->height,
-			s->video_codec_ctx->pix_fmt,
-			av->width,
-			av->height,
-			AV_PIX_FMT_RGB32,
-			SWS_BICUBIC,
-			NULL,
-			NULL,
-			NULL
-		);
+		/* Parse the scaler algorithm, any of the libswscale
+		 * sws_flags values. The context itself is created
+		 * when the first frame arrives */
+		s->sws_ctx = sws_alloc_context();
 		
 		if(!s->sws_ctx)
 		{
 			return(HACKTV_OUT_OF_MEMORY);
 		}
 		
+		s->sws_flags = SWS_BICUBIC;
+		s->sws_threads = av->scaler_threads;
+		
+		if(av->scaler != NULL)
+		{
+			int64_t flags;
+			
+			if(av_opt_set(s->sws_ctx, "sws_flags", av->scaler, 0) < 0 ||
+			   av_opt_get_int(s->sws_ctx, "sws_flags", 0, &flags) < 0)
+			{
+				fprintf(stderr, "Unrecognised scaler '%s'\n", av->scaler);
+				return(HACKTV_ERROR);
+			}
+			
+			s->sws_flags = flags;
+		}
+		
+		sws_freeContext(s->sws_ctx);
+		s->sws_ctx = NULL;
+		
 		s->video_eof = 0;
 	}
 	else
@@ -1210,32 +1502,49 @@ int av_ffmpeg_open(av_t *av, char *input_url, char *format, char *options)
 	av->read_video = _ffmpeg_read_video;
 	av->read_audio = _ffmpeg_read_audio;
 	av->eof = _ffmpeg_eof;
+	av->fill = _ffmpeg_fill;
 	av->close = _ffmpeg_close;
 	
+	/* A file or stream isn't known to repeat */
+	av->period = (rational_t) { 0, 0 };
+	
 	/* Start the threads */
 	s->thread_abort = 0;
-	pthread_mutex_init(&s->mutex, NULL);
-	pthread_cond_init(&s->cond, NULL);
-	_packet_queue_init(s, &s->video_queue);
-	_packet_queue_init(s, &s->audio_queue);
+	atomic_init(&s->input_stall, 0);
+	
+	if(_packet_queue_init(s, &s->video_queue, _PACKET_QUEUE) != 0 ||
+	   _packet_queue_init(s, &s->audio_queue, _PACKET_QUEUE) != 0)
+	{
+		return(HACKTV_OUT_OF_MEMORY);
+	}
+	
+	/* Size the decoded frame queues */
+	s->frame_queue = av->frame_queue > 0 ? av->frame_queue : _FRAME_QUEUE;
+	if(s->frame_queue < 2) s->frame_queue = 2;
+	
+	fprintf(stderr, "Queueing up to %d decoded frames per stream.\n", s->frame_queue);
 	
 	if(s->video_stream != NULL)
 	{
-		_frame_dbuffer_init(&s->in_video_buffer);
-		_frame_dbuffer_init(&s->out_video_buffer);
+		if(_frame_ring_init(&s->in_video_buffer, s->frame_queue) != 0 ||
+		   _frame_ring_init(&s->out_video_buffer, s->frame_queue) != 0)
+		{
+			return(HACKTV_OUT_OF_MEMORY);
+		}
 		
 		/* Allocate memory for the output frame buffers */
-		for(i = 0; i < 2; i++)
+		for(i = 0; i < s->frame_queue; i++)
 		{
+			s->out_video_buffer.frame[i]->format = AV_PIX_FMT_RGB32;
 			s->out_video_buffer.frame[i]->width = av->width;
 			s->out_video_buffer.frame[i]->height = av->height;
 			
-			r = av_image_alloc(
-				s->out_video_buffer.frame[i]->data,
-				s->out_video_buffer.frame[i]->linesize,
-				av->width, av->height,
-				AV_PIX_FMT_RGB32, av_cpu_max_align()
-			);
+			r = av_frame_get_buffer(s->out_video_buffer.frame[i], 0);
+			if(r < 0)
+			{
+				fprintf(stderr, "Error allocating output video buffer %d\n", i);
+				return(HACKTV_OUT_OF_MEMORY);
+			}
 		}
 		
 		r = pthread_create(&s->video_decode_thread, NULL, &_video_decode_thread, (void *) s);
@@ -1255,8 +1564,11 @@ int av_ffmpeg_open(av_t *av, char *input_url, char *format, char *options)
 	
 	if(s->audio_stream != NULL)
 	{
-		_frame_dbuffer_init(&s->in_audio_buffer);
-		_frame_dbuffer_init(&s->out_audio_buffer);
+		if(_frame_ring_init(&s->in_audio_buffer, s->frame_queue) != 0 ||
+		   _frame_ring_init(&s->out_audio_buffer, s->frame_queue) != 0)
+		{
+			return(HACKTV_OUT_OF_MEMORY);
+		}
 		
 		/* Calculate the number of samples needed for output */
 		s->out_frame_size = av_rescale_q_rnd(
@@ -1274,7 +1586,7 @@ int av_ffmpeg_open(av_t *av, char *input_url, char *format, char *options)
 		/* Calculate the allowed error in input samples, +/- 20ms */
 		s->allowed_error = av_rescale_q(AV_TIME_BASE * 0.020, AV_TIME_BASE_Q, s->audio_time_base);
 		
-		for(i = 0; i < 2; i++)
+		for(i = 0; i < s->frame_queue; i++)
 		{
 			s->out_audio_buffer.frame[i]->format = AV_SAMPLE_FMT_S16;
 #if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(59, 24, 100)
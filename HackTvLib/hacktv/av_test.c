@@ -200,6 +200,9 @@ int av_test_open(av_t *av)
 	av->read_audio = _test_read_audio;
 	av->close = _test_close;
 	
+	/* The video is a still image, the audio repeats every 6.4 seconds */
+	av->period = (rational_t) { av->sample_rate.num ? 32 : 0, 5 };
+	
 	return(HACKTV_OK);
 }
 
@@ -18,8 +18,12 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stdatomic.h>
 #include "common.h"
 
+/* Marks the cached CPU features as valid */
+#define _CPU_DETECTED (1u << 31)
+
 int64_t gcd(int64_t a, int64_t b)
 {
 	int64_t c;
@@ -109,3 +113,32 @@ double rc_window(double t, double left, double width, double rise)
 	return(r);
 }
 
+unsigned int cpu_features(void)
+{
+	/* Set once detection has run. It may run on more than one thread
+	 * at first, but they all find the same answer */
+	static atomic_uint cache = 0;
+	unsigned int features;
+	
+	features = atomic_load_explicit(&cache, memory_order_relaxed);
+	if(features & _CPU_DETECTED)
+	{
+		return(features & ~_CPU_DETECTED);
+	}
+	
+	features = 0;
+	
+#if defined(CPU_X86)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse2")) features |= CPU_SSE2;
+	if(__builtin_cpu_supports("avx2")) features |= CPU_AVX2;
+#elif defined(CPU_ARM)
+	/* NEON is always present on AArch64 */
+	features |= CPU_NEON;
+#endif
+	
+	atomic_store_explicit(&cache, features | _CPU_DETECTED, memory_order_relaxed);
+	
+	return(features);
+}
+
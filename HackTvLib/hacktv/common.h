@@ -24,6 +24,19 @@
 #define RT1090 1.6939549523182869 /* Factor to convert 10-90% rise time to 0-100% */
 #define RT2080 2.4410157268268087 /* Factor to convert 20-80% rise time to 0-100% */
 
+/* CPU features, for selecting SIMD code paths at runtime */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_X86
+#endif
+
+#if defined(__GNUC__) && (defined(__aarch64__) || defined(__ARM_NEON))
+#define CPU_ARM
+#endif
+
+#define CPU_SSE2 (1 << 0)
+#define CPU_AVX2 (1 << 1)
+#define CPU_NEON (1 << 2)
+
 typedef struct {
 	int num;
 	int den;
@@ -50,6 +63,7 @@ int rational_cmp(rational_t a, rational_t b);
 rational_t rational_nearest(rational_t ref, rational_t a, rational_t b);
 cint16_t *sin_cint16(unsigned int length, unsigned int cycles, double level);
 double rc_window(double t, double left, double width, double rise);
+unsigned int cpu_features(void);
 
 #ifdef __cplusplus
 }
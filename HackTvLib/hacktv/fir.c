@@ -19,9 +19,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <fftw3.h>
 #include "fir.h"
 #include "common.h"
 
+#if defined(CPU_X86)
+#include <immintrin.h>
+#elif defined(CPU_ARM)
+#include <arm_neon.h>
+#endif
+
 
 
 /* Some of the filter design functions contained within here where taken
@@ -218,6 +225,139 @@ void fir_complex_band_pass(double *taps, size_t ntaps, double sample_rate, doubl
 
 /* int16_t */
 
+/* Dot product kernels for the int16 filters. The products are summed in
+ * int32 with wrap-around, the same as the scalar loop, so every kernel
+ * gives a bit-identical result regardless of the order it adds them in. */
+
+typedef int32_t (*_fir_dot_int16_t)(const int16_t *a, const int16_t *b, unsigned int n);
+
+static int32_t _dot_int16_scalar(const int16_t *a, const int16_t *b, unsigned int n)
+{
+	uint32_t r = 0;
+	
+	for(; n; n--)
+	{
+		r += (uint32_t) (*(a++) * *(b++));
+	}
+	
+	return((int32_t) r);
+}
+
+#ifdef CPU_X86
+
+__attribute__((target("sse2")))
+static int32_t _dot_int16_sse2(const int16_t *a, const int16_t *b, unsigned int n)
+{
+	__m128i r0 = _mm_setzero_si128();
+	__m128i r1 = _mm_setzero_si128();
+	
+	for(; n >= 16; n -= 16, a += 16, b += 16)
+	{
+		r0 = _mm_add_epi32(r0, _mm_madd_epi16(_mm_loadu_si128((const __m128i *) &a[0]), _mm_loadu_si128((const __m128i *) &b[0])));
+		r1 = _mm_add_epi32(r1, _mm_madd_epi16(_mm_loadu_si128((const __m128i *) &a[8]), _mm_loadu_si128((const __m128i *) &b[8])));
+	}
+	
+	if(n >= 8)
+	{
+		r0 = _mm_add_epi32(r0, _mm_madd_epi16(_mm_loadu_si128((const __m128i *) a), _mm_loadu_si128((const __m128i *) b)));
+		n -= 8, a += 8, b += 8;
+	}
+	
+	r0 = _mm_add_epi32(r0, r1);
+	r0 = _mm_add_epi32(r0, _mm_shuffle_epi32(r0, _MM_SHUFFLE(1, 0, 3, 2)));
+	r0 = _mm_add_epi32(r0, _mm_shuffle_epi32(r0, _MM_SHUFFLE(2, 3, 0, 1)));
+	
+	return((int32_t) ((uint32_t) _mm_cvtsi128_si32(r0) + (uint32_t) _dot_int16_scalar(a, b, n)));
+}
+
+__attribute__((target("avx2")))
+static int32_t _dot_int16_avx2(const int16_t *a, const int16_t *b, unsigned int n)
+{
+	__m256i r0 = _mm256_setzero_si256();
+	__m256i r1 = _mm256_setzero_si256();
+	__m128i r;
+	
+	for(; n >= 32; n -= 32, a += 32, b += 32)
+	{
+		r0 = _mm256_add_epi32(r0, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *) &a[0]), _mm256_loadu_si256((const __m256i *) &b[0])));
+		r1 = _mm256_add_epi32(r1, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *) &a[16]), _mm256_loadu_si256((const __m256i *) &b[16])));
+	}
+	
+	if(n >= 16)
+	{
+		r0 = _mm256_add_epi32(r0, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *) a), _mm256_loadu_si256((const __m256i *) b)));
+		n -= 16, a += 16, b += 16;
+	}
+	
+	r0 = _mm256_add_epi32(r0, r1);
+	r = _mm_add_epi32(_mm256_castsi256_si128(r0), _mm256_extracti128_si256(r0, 1));
+	
+	if(n >= 8)
+	{
+		r = _mm_add_epi32(r, _mm_madd_epi16(_mm_loadu_si128((const __m128i *) a), _mm_loadu_si128((const __m128i *) b)));
+		n -= 8, a += 8, b += 8;
+	}
+	
+	r = _mm_add_epi32(r, _mm_shuffle_epi32(r, _MM_SHUFFLE(1, 0, 3, 2)));
+	r = _mm_add_epi32(r, _mm_shuffle_epi32(r, _MM_SHUFFLE(2, 3, 0, 1)));
+	
+	return((int32_t) ((uint32_t) _mm_cvtsi128_si32(r) + (uint32_t) _dot_int16_scalar(a, b, n)));
+}
+
+#elif defined(CPU_ARM)
+
+static int32_t _dot_int16_neon(const int16_t *a, const int16_t *b, unsigned int n)
+{
+	int32x4_t r0 = vdupq_n_s32(0);
+	int32x4_t r1 = vdupq_n_s32(0);
+	int32x2_t r;
+	int16x8_t va, vb;
+	
+	for(; n >= 8; n -= 8, a += 8, b += 8)
+	{
+		va = vld1q_s16(a);
+		vb = vld1q_s16(b);
+		r0 = vmlal_s16(r0, vget_low_s16(va), vget_low_s16(vb));
+		r1 = vmlal_s16(r1, vget_high_s16(va), vget_high_s16(vb));
+	}
+	
+	r0 = vaddq_s32(r0, r1);
+	r = vadd_s32(vget_low_s32(r0), vget_high_s32(r0));
+	r = vpadd_s32(r, r);
+	
+	return((int32_t) ((uint32_t) vget_lane_s32(r, 0) + (uint32_t) _dot_int16_scalar(a, b, n)));
+}
+
+#endif
+
+static _fir_dot_int16_t _fir_dot_int16(unsigned int n)
+{
+	unsigned int features;
+	
+	if(n < 8)
+	{
+		/* Too short to fill a vector */
+		return(_dot_int16_scalar);
+	}
+	
+	/* Chosen on each init, nothing is shared between threads */
+	features = cpu_features();
+	
+#if defined(CPU_X86)
+	if(features & CPU_AVX2) return(_dot_int16_avx2);
+	if(features & CPU_SSE2) return(_dot_int16_sse2);
+#elif defined(CPU_ARM)
+	if(features & CPU_NEON) return(_dot_int16_neon);
+#else
+	(void) features;
+#endif
+	
+	return(_dot_int16_scalar);
+}
+
+static size_t _fft_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples, int step);
+static void _fft_free(struct _fir_int16_fft_t *f);
+
 
 
 int fir_int16_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int interpolation, int decimation, int delay)
@@ -235,6 +375,7 @@ int fir_int16_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int i
 	
 	s->itaps = calloc(s->ntaps, sizeof(int16_t));
 	s->qtaps = NULL;
+	s->ctaps = NULL;
 	
 	/* Copy taps into the order they will be applied */
 	j = s->ntaps - s->ataps;
@@ -249,6 +390,7 @@ int fir_int16_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int i
 	s->win = calloc(s->ataps * 2 + delay, sizeof(int16_t));
 	s->owin = 0;
 	s->d = 0;
+	s->dot = _fir_dot_int16(s->ataps);
 	
 	return(0);
 }
@@ -256,12 +398,13 @@ int fir_int16_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int i
 size_t fir_int16_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples, int step)
 {
 	int a;
-	int x, y;
+	int x;
 	const int16_t *win, *taps;
 	
 	if(s->type == 0) return(0);
 	else if(s->type == 2) return(fir_int16_complex_process(s, out, in, samples));
 	else if(s->type == 3) return(fir_int16_scomplex_process(s, out, in, samples));
+	else if(s->type == 4 || s->type == 5) return(_fft_process(s, out, in, samples, step));
 	
 	for(x = 0; samples; samples--)
 	{
@@ -276,10 +419,7 @@ size_t fir_int16_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t
 			taps = &s->itaps[s->d * s->ataps];
 			
 			/* Calculate the next output sample */
-			for(a = y = 0; y < s->ataps; y++)
-			{
-				a += *(win++) * *(taps++);
-			}
+			a = s->dot(win, taps, s->ataps);
 			
 			a >>= 15;
 			*out = a < INT16_MIN ? INT16_MIN : (a > INT16_MAX ? INT16_MAX : a);
@@ -318,6 +458,8 @@ void fir_int16_free(fir_int16_t *s)
 	free(s->win);
 	free(s->itaps);
 	free(s->qtaps);
+	free(s->ctaps);
+	if(s->fft) _fft_free(s->fft);
 	memset(s, 0, sizeof(fir_int16_t));
 }
 
@@ -380,6 +522,7 @@ int fir_int16_complex_init(fir_int16_t *s, const double *taps, unsigned int ntap
 	
 	s->itaps = calloc(s->ntaps, sizeof(int16_t));
 	s->qtaps = calloc(s->ntaps, sizeof(int16_t));
+	s->ctaps = NULL;
 	
 	/* Copy the taps in the order and format they are to be used */
 	j = s->ntaps - s->ataps;
@@ -391,10 +534,30 @@ int fir_int16_complex_init(fir_int16_t *s, const double *taps, unsigned int ntap
 		if(j < 0) j += s->ntaps + 1;
 	}
 	
+	/* Interleave the taps so each output is two dot products over the
+	 * I/Q window: (i, -q) for the I output and (q, i) for Q. Not possible
+	 * if a q tap can't be negated, the scalar loop is used then */
+	for(i = 0; i < s->ntaps && s->qtaps[i] != INT16_MIN; i++);
+	
+	if(i == s->ntaps)
+	{
+		s->ctaps = malloc(s->ntaps * 4 * sizeof(int16_t));
+		
+		for(i = 0; i < s->ntaps; i++)
+		{
+			j = i / s->ataps * s->ataps * 4 + i % s->ataps * 2;
+			s->ctaps[j + 0] = s->itaps[i];
+			s->ctaps[j + 1] = -s->qtaps[i];
+			s->ctaps[j + s->ataps * 2 + 0] = s->qtaps[i];
+			s->ctaps[j + s->ataps * 2 + 1] = s->itaps[i];
+		}
+	}
+	
 	s->lwin = s->ataps + delay;
 	s->win = calloc(s->ataps * 2 + delay, sizeof(int16_t) * 2);
 	s->owin = 0;
 	s->d = 0;
+	s->dot = _fir_dot_int16(s->ctaps ? s->ataps * 2 : s->ataps);
 	
 	return(0);
 }
@@ -420,14 +583,24 @@ size_t fir_int16_complex_process(fir_int16_t *s, int16_t *out, const int16_t *in
 		for(; s->d < s->interpolation; s->d += s->decimation)
 		{
 			win = &s->win[s->owin * 2];
-			itaps = &s->itaps[s->d * s->ataps];
-			qtaps = &s->qtaps[s->d * s->ataps];
 			
 			/* Calculate the next output sample */
-			for(ai = aq = y = 0; y < s->ataps; y++, win += 2, itaps++, qtaps++)
+			if(s->ctaps)
 			{
-				ai += win[0] * *itaps - win[1] * *qtaps;
-				aq += win[0] * *qtaps + win[1] * *itaps;
+				itaps = &s->ctaps[s->d * s->ataps * 4];
+				ai = s->dot(win, itaps, s->ataps * 2);
+				aq = s->dot(win, itaps + s->ataps * 2, s->ataps * 2);
+			}
+			else
+			{
+				itaps = &s->itaps[s->d * s->ataps];
+				qtaps = &s->qtaps[s->d * s->ataps];
+				
+				for(ai = aq = y = 0; y < s->ataps; y++, win += 2, itaps++, qtaps++)
+				{
+					ai += win[0] * *itaps - win[1] * *qtaps;
+					aq += win[0] * *qtaps + win[1] * *itaps;
+				}
 			}
 			
 			ai >>= 15;
@@ -460,6 +633,7 @@ int fir_int16_scomplex_init(fir_int16_t *s, const double *taps, unsigned int nta
 	
 	s->itaps = calloc(s->ntaps, sizeof(int16_t));
 	s->qtaps = calloc(s->ntaps, sizeof(int16_t));
+	s->ctaps = NULL;
 	
 	/* Copy the taps in the order and format they are to be used */
 	j = s->ntaps - s->ataps;
@@ -475,6 +649,7 @@ int fir_int16_scomplex_init(fir_int16_t *s, const double *taps, unsigned int nta
 	s->win = calloc(s->ataps * 2 + delay, sizeof(int16_t));
 	s->owin = 0;
 	s->d = 0;
+	s->dot = _fir_dot_int16(s->ataps);
 	
 	return(0);
 }
@@ -482,7 +657,7 @@ int fir_int16_scomplex_init(fir_int16_t *s, const double *taps, unsigned int nta
 size_t fir_int16_scomplex_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples)
 {
 	int32_t ai, aq;
-	int x, y;
+	int x;
 	const int16_t *win, *itaps, *qtaps;
 	
 	for(x = 0; samples; samples--)
@@ -499,11 +674,8 @@ size_t fir_int16_scomplex_process(fir_int16_t *s, int16_t *out, const int16_t *i
 			qtaps = &s->qtaps[s->d * s->ataps];
 			
 			/* Calculate the next output sample */
-			for(ai = aq = y = 0; y < s->ataps; y++)
-			{
-				ai += *win     * *(itaps++);
-				aq += *(win++) * *(qtaps++);
-			}
+			ai = s->dot(win, itaps, s->ataps);
+			aq = s->dot(win, qtaps, s->ataps);
 			
 			ai >>= 15;
 			aq >>= 15;
@@ -520,10 +692,312 @@ size_t fir_int16_scomplex_process(fir_int16_t *s, int16_t *out, const int16_t *i
 	return(x);
 }
 
+/* FFT overlap-save convolution, an alternative to the direct form for long
+ * filters. Input is taken in chunks of up to l samples and each chunk is
+ * filtered and output immediately, so the filter has the same delay and
+ * one output per input like the direct form. Each transform covers the last
+ * ntaps - 1 + delay samples of history followed by the new chunk.
+ *
+ * The result is calculated in float and may differ from the direct form
+ * by 1 LSB. Only the non-resampling filter types are supported. */
+
+struct _fir_int16_fft_t {
+	
+	int n;			/* FFT length */
+	int l;			/* Maximum new samples per transform */
+	int m;			/* Number of taps */
+	int h;			/* History length, m - 1 + delay */
+	
+	float *buf;		/* History followed by the new chunk, n + delay */
+	float *y;		/* Inverse transform output, n */
+	fftwf_complex *fx;	/* Input spectrum */
+	fftwf_complex *fy;	/* Output spectrum */
+	fftwf_complex *fi;	/* I filter spectrum */
+	fftwf_complex *fq;	/* Q filter spectrum, or NULL */
+	
+	fftwf_plan fwd;
+	fftwf_plan inv;
+};
+
+static int _fft_length(unsigned int ntaps)
+{
+	int n;
+	
+	/* Around four times the filter length works well for overlap-save */
+	for(n = 64; n < ntaps * 4; n <<= 1);
+	
+	return(n);
+}
+
+int fir_int16_fft_preferred(unsigned int ntaps, int outputs)
+{
+	double direct, fft;
+	int n;
+	
+	/* Rough cost per output sample of each form. The direct form does
+	 * ntaps multiply-adds per output, 8 at a time with SIMD. Each FFT
+	 * covers n - ntaps + 1 new samples and costs about n log2 n / 2,
+	 * plus one inverse transform per output */
+	direct = (double) ntaps * outputs / (cpu_features() ? 8 : 1);
+	
+	n = _fft_length(ntaps);
+	fft = (1.0 + outputs) * n * log2(n) / 2 / (n - ntaps + 1);
+	
+	return(fft < direct);
+}
+
+static void _fft_spectrum(struct _fir_int16_fft_t *f, fftwf_complex *dst, const double *taps, int step)
+{
+	int i;
+	
+	/* Quantise the taps as the direct form does, scaling
+	 * for the unnormalised inverse transform */
+	for(i = 0; i < f->n; i++)
+	{
+		f->buf[i] = i < f->m ? lround(taps[i * step] * 32767.0) / 32768.0 / f->n : 0;
+	}
+	
+	fftwf_execute_dft_r2c(f->fwd, f->buf, dst);
+}
+
+static int _fft_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int scomplex, int delay)
+{
+	struct _fir_int16_fft_t *f;
+	int bins;
+	
+	memset(s, 0, sizeof(fir_int16_t));
+	
+	s->type = scomplex ? 5 : 4;
+	s->interpolation = 1;
+	s->decimation = 1;
+	s->ntaps = ntaps;
+	s->ataps = ntaps;
+	s->lwin = ntaps + delay;
+	
+	f = calloc(1, sizeof(struct _fir_int16_fft_t));
+	if(!f)
+	{
+		s->type = 0;
+		return(-1);
+	}
+	
+	s->fft = f;
+	
+	f->n = _fft_length(ntaps);
+	f->m = ntaps;
+	f->l = f->n - (f->m - 1);
+	f->h = f->m - 1 + delay;
+	bins = f->n / 2 + 1;
+	
+	f->buf = fftwf_malloc(sizeof(float) * (f->n + delay));
+	f->y = fftwf_malloc(sizeof(float) * f->n);
+	f->fx = fftwf_malloc(sizeof(fftwf_complex) * bins);
+	f->fy = fftwf_malloc(sizeof(fftwf_complex) * bins);
+	f->fi = fftwf_malloc(sizeof(fftwf_complex) * bins);
+	f->fq = scomplex ? fftwf_malloc(sizeof(fftwf_complex) * bins) : NULL;
+	
+	if(!f->buf || !f->y || !f->fx || !f->fy || !f->fi || (scomplex && !f->fq))
+	{
+		fir_int16_free(s);
+		return(-1);
+	}
+	
+	f->fwd = fftwf_plan_dft_r2c_1d(f->n, f->buf, f->fx, FFTW_ESTIMATE);
+	f->inv = fftwf_plan_dft_c2r_1d(f->n, f->fy, f->y, FFTW_ESTIMATE);
+	
+	if(!f->fwd || !f->inv)
+	{
+		fir_int16_free(s);
+		return(-1);
+	}
+	
+	_fft_spectrum(f, f->fi, &taps[0], scomplex ? 2 : 1);
+	if(scomplex) _fft_spectrum(f, f->fq, &taps[1], 2);
+	
+	/* Clear the history */
+	memset(f->buf, 0, sizeof(float) * (f->n + delay));
+	
+	return(0);
+}
+
+int fir_int16_fft_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int delay)
+{
+	return(_fft_init(s, taps, ntaps, 0, delay));
+}
+
+int fir_int16_scomplex_fft_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int delay)
+{
+	return(_fft_init(s, taps, ntaps, 1, delay));
+}
+
+static void _fft_apply(struct _fir_int16_fft_t *f, const fftwf_complex *h, int16_t *out, int c, int step)
+{
+	float v;
+	int i;
+	
+	for(i = 0; i < f->n / 2 + 1; i++)
+	{
+		f->fy[i][0] = f->fx[i][0] * h[i][0] - f->fx[i][1] * h[i][1];
+		f->fy[i][1] = f->fx[i][0] * h[i][1] + f->fx[i][1] * h[i][0];
+	}
+	
+	fftwf_execute_dft_c2r(f->inv, f->fy, f->y);
+	
+	/* The first m - 1 outputs have wrapped around and are discarded */
+	for(i = 0; i < c; i++, out += step)
+	{
+		v = floorf(f->y[f->m - 1 + i]);
+		*out = v < INT16_MIN ? INT16_MIN : (v > INT16_MAX ? INT16_MAX : v);
+	}
+}
+
+static size_t _fft_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples, int step)
+{
+	struct _fir_int16_fft_t *f = s->fft;
+	size_t x;
+	int c, i;
+	
+	for(x = 0; x < samples; x += c)
+	{
+		c = samples - x < f->l ? samples - x : f->l;
+		
+		/* Append the chunk to the history */
+		for(i = 0; i < c; i++, in += step)
+		{
+			f->buf[f->h + i] = *in;
+		}
+		
+		/* Transform the history and chunk. Anything past them in
+		 * buf only affects the discarded outputs */
+		fftwf_execute_dft_r2c(f->fwd, f->buf, f->fx);
+		
+		if(s->type == 5)
+		{
+			_fft_apply(f, f->fi, &out[0], c, 2);
+			_fft_apply(f, f->fq, &out[1], c, 2);
+			out += c * 2;
+		}
+		else
+		{
+			_fft_apply(f, f->fi, out, c, step);
+			out += c * step;
+		}
+		
+		memmove(f->buf, f->buf + c, sizeof(float) * f->h);
+	}
+	
+	return(x);
+}
+
+static void _fft_free(struct _fir_int16_fft_t *f)
+{
+	if(f->fwd) fftwf_destroy_plan(f->fwd);
+	if(f->inv) fftwf_destroy_plan(f->inv);
+	fftwf_free(f->buf);
+	fftwf_free(f->y);
+	fftwf_free(f->fx);
+	fftwf_free(f->fy);
+	fftwf_free(f->fi);
+	fftwf_free(f->fq);
+	free(f);
+}
+
 
 
 /* int32_t */
 
+/* Dot product kernels for the int32 filters, summed in int64. SSE2 has no
+ * signed 32-bit multiply so only AVX2 and NEON are vectorised */
+
+typedef int64_t (*_fir_dot_int32_t)(const int32_t *a, const int32_t *b, unsigned int n);
+
+static int64_t _dot_int32_scalar(const int32_t *a, const int32_t *b, unsigned int n)
+{
+	int64_t r = 0;
+	
+	for(; n; n--)
+	{
+		r += (int64_t) *(a++) * (int64_t) *(b++);
+	}
+	
+	return(r);
+}
+
+#ifdef CPU_X86
+
+__attribute__((target("avx2")))
+static int64_t _dot_int32_avx2(const int32_t *a, const int32_t *b, unsigned int n)
+{
+	__m256i r0 = _mm256_setzero_si256();
+	__m256i r1 = _mm256_setzero_si256();
+	__m256i va, vb;
+	__m128i r;
+	
+	for(; n >= 8; n -= 8, a += 8, b += 8)
+	{
+		va = _mm256_loadu_si256((const __m256i *) a);
+		vb = _mm256_loadu_si256((const __m256i *) b);
+		
+		/* Even lanes, then odd lanes shifted down */
+		r0 = _mm256_add_epi64(r0, _mm256_mul_epi32(va, vb));
+		r1 = _mm256_add_epi64(r1, _mm256_mul_epi32(_mm256_srli_epi64(va, 32), _mm256_srli_epi64(vb, 32)));
+	}
+	
+	r0 = _mm256_add_epi64(r0, r1);
+	r = _mm_add_epi64(_mm256_castsi256_si128(r0), _mm256_extracti128_si256(r0, 1));
+	r = _mm_add_epi64(r, _mm_unpackhi_epi64(r, r));
+	
+	return(_mm_cvtsi128_si64(r) + _dot_int32_scalar(a, b, n));
+}
+
+#elif defined(CPU_ARM)
+
+static int64_t _dot_int32_neon(const int32_t *a, const int32_t *b, unsigned int n)
+{
+	int64x2_t r0 = vdupq_n_s64(0);
+	int64x2_t r1 = vdupq_n_s64(0);
+	int32x4_t va, vb;
+	
+	for(; n >= 4; n -= 4, a += 4, b += 4)
+	{
+		va = vld1q_s32(a);
+		vb = vld1q_s32(b);
+		r0 = vmlal_s32(r0, vget_low_s32(va), vget_low_s32(vb));
+		r1 = vmlal_s32(r1, vget_high_s32(va), vget_high_s32(vb));
+	}
+	
+	r0 = vaddq_s64(r0, r1);
+	
+	return(vgetq_lane_s64(r0, 0) + vgetq_lane_s64(r0, 1) + _dot_int32_scalar(a, b, n));
+}
+
+#endif
+
+static _fir_dot_int32_t _fir_dot_int32(unsigned int n)
+{
+	unsigned int features;
+	
+	if(n < 8)
+	{
+		/* Too short to fill a vector */
+		return(_dot_int32_scalar);
+	}
+	
+	/* Chosen on each init, nothing is shared between threads */
+	features = cpu_features();
+	
+#if defined(CPU_X86)
+	if(features & CPU_AVX2) return(_dot_int32_avx2);
+#elif defined(CPU_ARM)
+	if(features & CPU_NEON) return(_dot_int32_neon);
+#else
+	(void) features;
+#endif
+	
+	return(_dot_int32_scalar);
+}
+
+
 
 
 int fir_int32_init(fir_int32_t *s, const double *taps, unsigned int ntaps, int interpolation, int decimation, int delay)
@@ -554,6 +1028,7 @@ int fir_int32_init(fir_int32_t *s, const double *taps, unsigned int ntaps, int i
 	s->win = calloc(s->ataps * 2 + delay, sizeof(int32_t));
 	s->owin = 0;
 	s->d = 0;
+	s->dot = _fir_dot_int32(s->ataps);
 	
 	return(0);
 }
@@ -561,7 +1036,7 @@ int fir_int32_init(fir_int32_t *s, const double *taps, unsigned int ntaps, int i
 size_t fir_int32_process(fir_int32_t *s, int32_t *out, const int32_t *in, size_t samples)
 {
 	int64_t a;
-	int x, y;
+	int x;
 	const int32_t *win, *taps;
 	
 	if(s->type == 0) return(0);
@@ -581,19 +1056,16 @@ size_t fir_int32_process(fir_int32_t *s, int32_t *out, const int32_t *in, size_t
 			taps = &s->itaps[s->d * s->ataps];
 			
 			/* Calculate the next output sample */
-			for(a = y = 0; y < s->ataps; y++)
-			{
-				a += (int64_t) *(win++) * (int64_t) *(taps++);
-			}
+			a = s->dot(win, taps, s->ataps);
 			
 			a >>= 15;
 			*out = a < INT32_MIN ? INT32_MIN : (a > INT32_MAX ? INT32_MAX : a);
-			out += 2;
+			out++;
 			x++;
 		}
 		s->d -= s->interpolation;
 		
-		in += 2;
+		in++;
 	}
 	
 	return(x);
@@ -649,6 +1121,8 @@ void iir_int16_free(iir_int16_t *s)
 
 /* Soft Limiter */
 
+/* Samples filtered at a time by limiter_process */
+#define _LIMITER_BLOCK 256
 
 
 void limiter_free(limiter_t *s)
@@ -723,55 +1197,69 @@ int limiter_init(limiter_t *s, int16_t level, int width, const double *vtaps, co
 
 void limiter_process(limiter_t *s, int16_t *out, const int16_t *vin, const int16_t *fin, int samples, int step)
 {
-	int i, j;
+	int32_t v[_LIMITER_BLOCK];
+	int32_t f[_LIMITER_BLOCK];
+	int i, j, n;
 	int32_t a, b;
 	
-	for(i = 0; i < samples; i++)
+	for(; samples; samples -= n)
 	{
-		s->var[s->p] = *vin;
-		s->fix[s->p] = (fin ? *fin : 0);
-		s->att[s->p] = 0;
+		n = samples < _LIMITER_BLOCK ? samples : _LIMITER_BLOCK;
 		
-		/* Apply input filters */
-		if(s->vfir.type) fir_int32_process(&s->vfir, &s->var[s->p], &s->var[s->p], 1);
-		if(s->ffir.type) fir_int32_process(&s->ffir, &s->fix[s->p], &s->fix[s->p], 1);
-		
-		/* Hard limit the fixed input */
-		if(s->fix[s->p] < -s->level) s->fix[s->p] = -s->level;
-		else if(s->fix[s->p] > s->level) s->fix[s->p] = s->level;
+		/* Read in the block before any output is written,
+		 * out may be the same buffer as vin or fin */
+		for(i = 0; i < n; i++)
+		{
+			v[i] = vin[i * step];
+			f[i] = fin ? fin[i * step] : 0;
+		}
 		
-		/* The variable signal is the difference between vin and fin */
-		s->var[s->p] -= s->fix[s->p];
+		vin += n * step;
+		if(fin) fin += n * step;
 		
-		if(++s->p == s->width) s->p = 0;
-		if(++s->h == s->width) s->h = 0;
+		/* Apply input filters */
+		if(s->vfir.type) fir_int32_process(&s->vfir, v, v, n);
+		if(s->ffir.type) fir_int32_process(&s->ffir, f, f, n);
 		
-		/* Soft limit the variable input */
-		a = abs(s->var[s->h] + s->fix[s->h]);
-		if(a > s->level)
+		for(i = 0; i < n; i++)
 		{
-			a = INT16_MAX - (s->level + abs(s->var[s->h]) - a) * INT16_MAX / abs(s->var[s->h]);
+			s->var[s->p] = v[i];
+			s->fix[s->p] = f[i];
+			s->att[s->p] = 0;
+			
+			/* Hard limit the fixed input */
+			if(s->fix[s->p] < -s->level) s->fix[s->p] = -s->level;
+			else if(s->fix[s->p] > s->level) s->fix[s->p] = s->level;
+			
+			/* The variable signal is the difference between vin and fin */
+			s->var[s->p] -= s->fix[s->p];
+			
+			if(++s->p == s->width) s->p = 0;
+			if(++s->h == s->width) s->h = 0;
 			
-			for(j = 0; j < s->width; j++)
+			/* Soft limit the variable input */
+			a = abs(s->var[s->h] + s->fix[s->h]);
+			if(a > s->level)
 			{
-				b = (a * s->shape[j]) >> 15;
-				if(b > s->att[s->p]) s->att[s->p] = b;
-				if(++s->p == s->width) s->p = 0;
+				a = INT16_MAX - (s->level + abs(s->var[s->h]) - a) * INT16_MAX / abs(s->var[s->h]);
+				
+				for(j = 0; j < s->width; j++)
+				{
+					b = (a * s->shape[j]) >> 15;
+					if(b > s->att[s->p]) s->att[s->p] = b;
+					if(++s->p == s->width) s->p = 0;
+				}
 			}
+			
+			a  = s->fix[s->p];
+			a += ((int64_t) s->var[s->p] * (INT16_MAX - s->att[s->p])) >> 15;
+			
+			/* Hard limit to catch rounding errors */
+			if(a < -s->level) a = -s->level;
+			else if(a > s->level) a = s->level;
+			
+			*out = a;
+			out += step;
 		}
-		
-		a  = s->fix[s->p];
-		a += ((int64_t) s->var[s->p] * (INT16_MAX - s->att[s->p])) >> 15;
-		
-		/* Hard limit to catch rounding errors */
-		if(a < -s->level) a = -s->level;
-		else if(a > s->level) a = s->level;
-		
-		*out = a;
-		
-		vin += step;
-		out += step;
-		if(fin) fin += step;
 	}
 }
-
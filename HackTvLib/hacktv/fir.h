@@ -30,11 +30,20 @@ typedef struct {
 	int16_t *itaps;
 	int16_t *qtaps;
 	
+	/* Complex taps interleaved for the SIMD kernels (type 2 only) */
+	int16_t *ctaps;
+	
 	unsigned int owin;
 	unsigned int lwin;
 	int16_t *win;
 	int d;
 	
+	/* Dot product kernel selected at init */
+	int32_t (*dot)(const int16_t *a, const int16_t *b, unsigned int n);
+	
+	/* FFT convolution state (types 4 and 5) */
+	struct _fir_int16_fft_t *fft;
+	
 } fir_int16_t;
 
 typedef struct {
@@ -54,6 +63,9 @@ typedef struct {
 	int32_t *win;
 	int d;
 	
+	/* Dot product kernel selected at init */
+	int64_t (*dot)(const int32_t *a, const int32_t *b, unsigned int n);
+	
 } fir_int32_t;
 
 extern void fir_normalise(double *taps, size_t ntaps, double f);
@@ -75,6 +87,10 @@ extern size_t fir_int16_complex_process(fir_int16_t *s, int16_t *out, const int1
 extern int fir_int16_scomplex_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int interpolation, int decimation, int delay);
 extern size_t fir_int16_scomplex_process(fir_int16_t *s, int16_t *out, const int16_t *in, size_t samples);
 
+extern int fir_int16_fft_preferred(unsigned int ntaps, int outputs);
+extern int fir_int16_fft_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int delay);
+extern int fir_int16_scomplex_fft_init(fir_int16_t *s, const double *taps, unsigned int ntaps, int delay);
+
 extern int fir_int32_init(fir_int32_t *s, const double *taps, unsigned int ntaps, int interpolation, int decimation, int delay);
 extern size_t fir_int32_process(fir_int32_t *s, int32_t *out, const int32_t *in, size_t samples);
 extern void fir_int32_free(fir_int32_t *s);
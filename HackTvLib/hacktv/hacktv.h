@@ -48,6 +48,8 @@ typedef struct {
     rational_t max_aspect;
     int repeat;
     int shuffle;
+    int render_once;
+    int loop_max_mb;
     int verbose;
     char *teletext;
     char *wss;
@@ -69,9 +71,17 @@ typedef struct {
     int scramble_audio;
     uint64_t frequency;
     int amp;
+    int latency;
+    int buffer_count;
+    int buffer_length;
     int gain;
     char *antenna;
     int file_type;
+    int file_direct;
+    int rx_fast;
+    int frame_queue;
+    char *scaler;
+    int scaler_threads;
     int chid;
     int mac_audio_stereo;
     int mac_audio_quality;
@@ -90,6 +100,8 @@ typedef struct {
     int json;
     char *ffmt;
     char *fopts;
+    int threads;
+    int yiq_mode;
 
     /* Video encoder state */
     vid_t vid;
@@ -1809,9 +1809,7 @@ int mac_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 	/* Render the luminance */
 	if(y >= 0)
 	{
-		uint32_t rgb = 0x000000;
-		uint32_t *px = &rgb;
-		int stride = 0;
+		int i;
 		
 		/* Centre the video vertically */
 		vy = y - s->vframe_y;
@@ -1819,25 +1817,21 @@ int mac_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 		/* Check for out of bounds */
 		if(vy < 0 || vy >= s->vframe.height) vy = -1;
 		
-		if(vy >= 0 && s->vframe.framebuffer != NULL)
-		{
-			px = &s->vframe.framebuffer[vy * s->vframe.line_stride];
-			stride = s->vframe.pixel_stride;
-		}
-		
 		for(x = s->active_left; x < s->active_left + s->vframe_x; x++)
 		{
-			l->output[x * 2] = s->yiq_level_lookup[0x000000].y;
+			l->output[x * 2] = s->yiq.black.y;
 		}
 		
-		for(; x < s->active_left + s->vframe_x + s->vframe.width; x++, px += stride)
+		vid_frame_levels(s, s->yiq_line, NULL, NULL, 0, vy, 1, s->vframe.width, -1);
+		
+		for(i = 0; i < s->vframe.width; i++, x++)
 		{
-			l->output[x * 2] = s->yiq_level_lookup[*px & 0xFFFFFF].y;
+			l->output[x * 2] = s->yiq_line[i];
 		}
 		
 		for(; x < s->active_left + s->active_width; x++)
 		{
-			l->output[x * 2] = s->yiq_level_lookup[0x000000].y;
+			l->output[x * 2] = s->yiq.black.y;
 		}
 	}
 	
@@ -1846,19 +1840,22 @@ int mac_next_line(vid_t *s, void *arg, int nlines, vid_line_t **lines)
 	
 	if(vy >= 0)
 	{
-		uint32_t rgb = 0x000000;
-		uint32_t *px = &rgb;
-		int stride = 0;
+		int16_t *pi = s->yiq_line + s->active_width;
+		int16_t *pq = pi + s->active_width;
+		int i, n;
+		
+		x = s->mac.chrominance_left + s->vframe_x / 2;
+		n = s->mac.chrominance_left + (s->vframe_x + s->vframe.width) / 2 - x;
 		
-		if(s->vframe.framebuffer != NULL)
+		if(n > 0)
 		{
-			px = &s->vframe.framebuffer[vy * s->vframe.line_stride];
-			stride = s->vframe.pixel_stride * 2;
+			/* Every other pixel */
+			vid_frame_levels(s, s->yiq_line, pi, pq, 0, vy, 2, n, -1);
 		}
 		
-		for(x = s->mac.chrominance_left + s->vframe_x / 2; x < s->mac.chrominance_left + (s->vframe_x + s->vframe.width) / 2; x++, px += stride)
+		for(i = 0; i < n; i++, x++)
 		{
-			l->output[x * 2] += (l->line & 1 ? s->yiq_level_lookup[*px & 0xFFFFFF].i : s->yiq_level_lookup[*px & 0xFFFFFF].q);
+			l->output[x * 2] += (l->line & 1 ? pi[i] : pq[i]);
 		}
 	}
 	
@@ -39,6 +39,17 @@ int rf_read(rf_t *s, int16_t *iq_data, size_t samples)
     return(RF_ERROR);
 }
 
+int rf_fill(rf_t *s, size_t *samples, size_t *capacity)
+{
+	/* Samples waiting in the sink's own buffers */
+	if(s->fill)
+	{
+		return(s->fill(s->ctx, samples, capacity));
+	}
+	
+	return(RF_ERROR);
+}
+
 int rf_close(rf_t *s)
 {
 	if(s->close)
@@ -48,12 +48,14 @@ extern "C" {
 typedef int (*rf_write_t)(void *ctx, int16_t *iq_data, size_t samples);
 typedef int (*rf_read_t)(void *ctx, int16_t *iq_data, size_t samples);
 typedef int (*rf_close_t)(void *ctx);
+typedef int (*rf_fill_t)(void *ctx, size_t *samples, size_t *capacity);
 
 typedef struct rf_t {
     void *ctx;    
     rf_write_t write;
     rf_read_t read;
     rf_close_t close;
+    rf_fill_t fill;
 } rf_t;
 
 
@@ -65,8 +67,13 @@ typedef enum RxTxMode {
 extern int rf_write(rf_t *s, int16_t *iq_data, size_t samples);
 extern int rf_read(rf_t *s, int16_t *iq_data, size_t samples);
 extern int rf_close(rf_t *s);
+extern int rf_fill(rf_t *s, size_t *samples, size_t *capacity);
 
+#include "rf_convert.h"
 #include "rf_file.h"
+#include "rf_mmap.h"
+#include "rf_null.h"
+#include "rf_loopback.h"
 
 #ifdef HAVE_HACKRF
 #include "rf_hackrf.h"
@@ -0,0 +1,746 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include "rf.h"
+#include "common.h"
+
+#if defined(CPU_X86)
+#include <immintrin.h>
+#elif defined(CPU_ARM)
+#include <arm_neon.h>
+#endif
+
+/* Sample format converters for the RF sinks. Each kernel converts n
+ * values, reading every value (step 1, complex output) or only the I
+ * part of each sample (step 2, real output). The vector versions give
+ * exactly the same results as the scalar ones. Floats are calculated
+ * in double precision like the scalar code, and scaling divides exactly */
+
+typedef void (*_convert_t)(void *dst, const int16_t *src, size_t n, int step);
+
+/* 1 / INT16_MAX, nudged away from zero just enough that exact
+ * multiples of INT16_MAX don't truncate to one below */
+#define _INV_INT16_MAX (1.0 / 32767.0 * (1.0 + 1e-12))
+
+
+
+static void _uint8_scalar(void *dst, const int16_t *src, size_t n, int step)
+{
+	uint8_t *u8 = dst;
+	size_t i;
+
+	for(i = 0; i < n; i++, src += step)
+	{
+		u8[i] = (src[0] - INT16_MIN) >> 8;
+	}
+}
+
+static void _int8_scalar(void *dst, const int16_t *src, size_t n, int step)
+{
+	int8_t *i8 = dst;
+	size_t i;
+
+	for(i = 0; i < n; i++, src += step)
+	{
+		i8[i] = src[0] >> 8;
+	}
+}
+
+static void _uint16_scalar(void *dst, const int16_t *src, size_t n, int step)
+{
+	uint16_t *u16 = dst;
+	size_t i;
+
+	for(i = 0; i < n; i++, src += step)
+	{
+		u16[i] = (src[0] - INT16_MIN);
+	}
+}
+
+static void _int16_scalar(void *dst, const int16_t *src, size_t n, int step)
+{
+	int16_t *i16 = dst;
+	size_t i;
+
+	if(step == 1)
+	{
+		memcpy(dst, src, n * sizeof(int16_t));
+		return;
+	}
+
+	for(i = 0; i < n; i++, src += step)
+	{
+		i16[i] = src[0];
+	}
+}
+
+static void _int32_scalar(void *dst, const int16_t *src, size_t n, int step)
+{
+	int32_t *i32 = dst;
+	size_t i;
+
+	for(i = 0; i < n; i++, src += step)
+	{
+		i32[i] = (src[0] << 16) + src[0];
+	}
+}
+
+static void _float_scalar(void *dst, const int16_t *src, size_t n, int step)
+{
+	float *f32 = dst;
+	size_t i;
+
+	for(i = 0; i < n; i++, src += step)
+	{
+		f32[i] = (float) src[0] * (1.0 / 32767.0);
+	}
+}
+
+static void _planar_scalar(uint8_t *i, uint8_t *q, const int16_t *src, size_t n)
+{
+	size_t x;
+
+	for(x = 0; x < n; x++, src += 2)
+	{
+		i[x] = 128 + (src[0] / 256);
+		q[x] = 128 + (src[1] / 256);
+	}
+}
+
+static void _scaled_scalar(int16_t *dst, const int16_t *src, size_t n, int scale)
+{
+	size_t i;
+
+	for(i = 0; i < n; i++)
+	{
+		dst[i] = src[i] * scale / INT16_MAX;
+	}
+}
+
+#ifdef CPU_X86
+
+/* Returns the next 8 values, all of them or just the I parts */
+__attribute__((target("sse2"), always_inline))
+static inline __m128i _load_sse2(const int16_t *src, int step)
+{
+	__m128i a, b;
+
+	if(step == 1)
+	{
+		return(_mm_loadu_si128((const __m128i *) src));
+	}
+
+	a = _mm_loadu_si128((const __m128i *) &src[0]);
+	b = _mm_loadu_si128((const __m128i *) &src[8]);
+	a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+	b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+
+	return(_mm_packs_epi32(a, b));
+}
+
+__attribute__((target("sse2")))
+static void _uint8_sse2(void *dst, const int16_t *src, size_t n, int step)
+{
+	uint8_t *u8 = dst;
+	__m128i a, b;
+
+	for(; n >= 16; n -= 16, src += 16 * step, u8 += 16)
+	{
+		a = _mm_srai_epi16(_load_sse2(&src[0], step), 8);
+		b = _mm_srai_epi16(_load_sse2(&src[8 * step], step), 8);
+		a = _mm_xor_si128(_mm_packs_epi16(a, b), _mm_set1_epi8(-128));
+		_mm_storeu_si128((__m128i *) u8, a);
+	}
+
+	_uint8_scalar(u8, src, n, step);
+}
+
+__attribute__((target("sse2")))
+static void _int8_sse2(void *dst, const int16_t *src, size_t n, int step)
+{
+	int8_t *i8 = dst;
+	__m128i a, b;
+
+	for(; n >= 16; n -= 16, src += 16 * step, i8 += 16)
+	{
+		a = _mm_srai_epi16(_load_sse2(&src[0], step), 8);
+		b = _mm_srai_epi16(_load_sse2(&src[8 * step], step), 8);
+		_mm_storeu_si128((__m128i *) i8, _mm_packs_epi16(a, b));
+	}
+
+	_int8_scalar(i8, src, n, step);
+}
+
+__attribute__((target("sse2")))
+static void _uint16_sse2(void *dst, const int16_t *src, size_t n, int step)
+{
+	uint16_t *u16 = dst;
+
+	for(; n >= 8; n -= 8, src += 8 * step, u16 += 8)
+	{
+		_mm_storeu_si128((__m128i *) u16, _mm_xor_si128(_load_sse2(src, step), _mm_set1_epi16(INT16_MIN)));
+	}
+
+	_uint16_scalar(u16, src, n, step);
+}
+
+__attribute__((target("sse2")))
+static void _int16_sse2(void *dst, const int16_t *src, size_t n, int step)
+{
+	int16_t *i16 = dst;
+
+	for(; step == 2 && n >= 8; n -= 8, src += 16, i16 += 8)
+	{
+		_mm_storeu_si128((__m128i *) i16, _load_sse2(src, step));
+	}
+
+	_int16_scalar(i16, src, n, step);
+}
+
+__attribute__((target("sse2")))
+static void _int32_sse2(void *dst, const int16_t *src, size_t n, int step)
+{
+	int32_t *i32 = dst;
+	__m128i v, a, b;
+
+	for(; n >= 8; n -= 8, src += 8 * step, i32 += 8)
+	{
+		v = _load_sse2(src, step);
+		a = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		b = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_si128((__m128i *) &i32[0], _mm_add_epi32(_mm_slli_epi32(a, 16), a));
+		_mm_storeu_si128((__m128i *) &i32[4], _mm_add_epi32(_mm_slli_epi32(b, 16), b));
+	}
+
+	_int32_scalar(i32, src, n, step);
+}
+
+__attribute__((target("sse2")))
+static void _float_sse2(void *dst, const int16_t *src, size_t n, int step)
+{
+	float *f32 = dst;
+	const __m128d k = _mm_set1_pd(1.0 / 32767.0);
+	__m128i v, a, b;
+
+	for(; n >= 8; n -= 8, src += 8 * step, f32 += 8)
+	{
+		v = _load_sse2(src, step);
+		a = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		b = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+
+		_mm_storeu_ps(&f32[0], _mm_movelh_ps(
+			_mm_cvtpd_ps(_mm_mul_pd(_mm_cvtepi32_pd(a), k)),
+			_mm_cvtpd_ps(_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(a, 8)), k))
+		));
+
+		_mm_storeu_ps(&f32[4], _mm_movelh_ps(
+			_mm_cvtpd_ps(_mm_mul_pd(_mm_cvtepi32_pd(b), k)),
+			_mm_cvtpd_ps(_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(b, 8)), k))
+		));
+	}
+
+	_float_scalar(f32, src, n, step);
+}
+
+__attribute__((target("sse2")))
+static void _planar_sse2(uint8_t *i, uint8_t *q, const int16_t *src, size_t n)
+{
+	__m128i a, b, vi[2], vq[2];
+	int x;
+
+	for(; n >= 16; n -= 16, src += 32, i += 16, q += 16)
+	{
+		for(x = 0; x < 2; x++)
+		{
+			/* Split 8 samples into I and Q */
+			a = _mm_loadu_si128((const __m128i *) &src[x * 16 + 0]);
+			b = _mm_loadu_si128((const __m128i *) &src[x * 16 + 8]);
+			vi[x] = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+			vq[x] = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+
+			/* Divide by 256, rounding towards zero */
+			vi[x] = _mm_srai_epi16(_mm_add_epi16(vi[x], _mm_and_si128(_mm_srai_epi16(vi[x], 15), _mm_set1_epi16(255))), 8);
+			vq[x] = _mm_srai_epi16(_mm_add_epi16(vq[x], _mm_and_si128(_mm_srai_epi16(vq[x], 15), _mm_set1_epi16(255))), 8);
+		}
+
+		a = _mm_xor_si128(_mm_packs_epi16(vi[0], vi[1]), _mm_set1_epi8(-128));
+		b = _mm_xor_si128(_mm_packs_epi16(vq[0], vq[1]), _mm_set1_epi8(-128));
+		_mm_storeu_si128((__m128i *) i, a);
+		_mm_storeu_si128((__m128i *) q, b);
+	}
+
+	_planar_scalar(i, q, src, n);
+}
+
+__attribute__((target("sse2")))
+static void _scaled_sse2(int16_t *dst, const int16_t *src, size_t n, int scale)
+{
+	const __m128d k = _mm_set1_pd(_INV_INT16_MAX);
+	const __m128i s = _mm_set1_epi32(scale);
+	__m128i v, p[2], r[2];
+	int x;
+
+	for(; n >= 8; n -= 8, src += 8, dst += 8)
+	{
+		v = _mm_loadu_si128((const __m128i *) src);
+
+		/* Each x * scale, as 32-bit. scale fits in the low 16 bits */
+		p[0] = _mm_madd_epi16(_mm_unpacklo_epi16(v, _mm_setzero_si128()), s);
+		p[1] = _mm_madd_epi16(_mm_unpackhi_epi16(v, _mm_setzero_si128()), s);
+
+		for(x = 0; x < 2; x++)
+		{
+			r[x] = _mm_unpacklo_epi64(
+				_mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtepi32_pd(p[x]), k)),
+				_mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(p[x], 8)), k))
+			);
+		}
+
+		_mm_storeu_si128((__m128i *) dst, _mm_packs_epi32(r[0], r[1]));
+	}
+
+	_scaled_scalar(dst, src, n, scale);
+}
+
+/* Returns the next 16 values, all of them or just the I parts */
+__attribute__((target("avx2"), always_inline))
+static inline __m256i _load_avx2(const int16_t *src, int step)
+{
+	__m256i a, b;
+
+	if(step == 1)
+	{
+		return(_mm256_loadu_si256((const __m256i *) src));
+	}
+
+	a = _mm256_loadu_si256((const __m256i *) &src[0]);
+	b = _mm256_loadu_si256((const __m256i *) &src[16]);
+	a = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+	b = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+
+	/* packs works within each 128-bit lane, put the quarters back in order */
+	return(_mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0)));
+}
+
+__attribute__((target("avx2")))
+static void _uint8_avx2(void *dst, const int16_t *src, size_t n, int step)
+{
+	uint8_t *u8 = dst;
+	__m256i a, b;
+
+	for(; n >= 32; n -= 32, src += 32 * step, u8 += 32)
+	{
+		a = _mm256_srai_epi16(_load_avx2(&src[0], step), 8);
+		b = _mm256_srai_epi16(_load_avx2(&src[16 * step], step), 8);
+		a = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i *) u8, _mm256_xor_si256(a, _mm256_set1_epi8(-128)));
+	}
+
+	_uint8_sse2(u8, src, n, step);
+}
+
+__attribute__((target("avx2")))
+static void _int8_avx2(void *dst, const int16_t *src, size_t n, int step)
+{
+	int8_t *i8 = dst;
+	__m256i a, b;
+
+	for(; n >= 32; n -= 32, src += 32 * step, i8 += 32)
+	{
+		a = _mm256_srai_epi16(_load_avx2(&src[0], step), 8);
+		b = _mm256_srai_epi16(_load_avx2(&src[16 * step], step), 8);
+		a = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256((__m256i *) i8, a);
+	}
+
+	_int8_sse2(i8, src, n, step);
+}
+
+__attribute__((target("avx2")))
+static void _uint16_avx2(void *dst, const int16_t *src, size_t n, int step)
+{
+	uint16_t *u16 = dst;
+
+	for(; n >= 16; n -= 16, src += 16 * step, u16 += 16)
+	{
+		_mm256_storeu_si256((__m256i *) u16, _mm256_xor_si256(_load_avx2(src, step), _mm256_set1_epi16(INT16_MIN)));
+	}
+
+	_uint16_sse2(u16, src, n, step);
+}
+
+__attribute__((target("avx2")))
+static void _int16_avx2(void *dst, const int16_t *src, size_t n, int step)
+{
+	int16_t *i16 = dst;
+
+	for(; step == 2 && n >= 16; n -= 16, src += 32, i16 += 16)
+	{
+		_mm256_storeu_si256((__m256i *) i16, _load_avx2(src, step));
+	}
+
+	_int16_sse2(i16, src, n, step);
+}
+
+__attribute__((target("avx2")))
+static void _int32_avx2(void *dst, const int16_t *src, size_t n, int step)
+{
+	int32_t *i32 = dst;
+	__m256i v, a;
+	int x;
+
+	for(; n >= 16; n -= 16, src += 16 * step, i32 += 16)
+	{
+		v = _load_avx2(src, step);
+
+		for(x = 0; x < 2; x++)
+		{
+			a = _mm256_cvtepi16_epi32(x ? _mm256_extracti128_si256(v, 1) : _mm256_castsi256_si128(v));
+			_mm256_storeu_si256((__m256i *) &i32[x * 8], _mm256_add_epi32(_mm256_slli_epi32(a, 16), a));
+		}
+	}
+
+	_int32_sse2(i32, src, n, step);
+}
+
+__attribute__((target("avx2")))
+static void _float_avx2(void *dst, const int16_t *src, size_t n, int step)
+{
+	float *f32 = dst;
+	const __m256d k = _mm256_set1_pd(1.0 / 32767.0);
+	__m256i v, a;
+	int x;
+
+	for(; n >= 16; n -= 16, src += 16 * step, f32 += 16)
+	{
+		v = _load_avx2(src, step);
+
+		for(x = 0; x < 2; x++)
+		{
+			a = _mm256_cvtepi16_epi32(x ? _mm256_extracti128_si256(v, 1) : _mm256_castsi256_si128(v));
+			_mm_storeu_ps(&f32[x * 8 + 0], _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(a)), k)));
+			_mm_storeu_ps(&f32[x * 8 + 4], _mm256_cvtpd_ps(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(a, 1)), k)));
+		}
+	}
+
+	_float_sse2(f32, src, n, step);
+}
+
+__attribute__((target("avx2")))
+static void _scaled_avx2(int16_t *dst, const int16_t *src, size_t n, int scale)
+{
+	const __m256d k = _mm256_set1_pd(_INV_INT16_MAX);
+	const __m256i s = _mm256_set1_epi32(scale);
+	__m256i p;
+	__m128i r[4];
+	int x;
+
+	for(; n >= 16; n -= 16, src += 16, dst += 16)
+	{
+		for(x = 0; x < 2; x++)
+		{
+			p = _mm256_mullo_epi32(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &src[x * 8])), s);
+			r[x * 2 + 0] = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(p)), k));
+			r[x * 2 + 1] = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(p, 1)), k));
+		}
+
+		_mm_storeu_si128((__m128i *) &dst[0], _mm_packs_epi32(r[0], r[1]));
+		_mm_storeu_si128((__m128i *) &dst[8], _mm_packs_epi32(r[2], r[3]));
+	}
+
+	_scaled_sse2(dst, src, n, scale);
+}
+
+#elif defined(CPU_ARM)
+
+/* Returns the next 8 values, all of them or just the I parts */
+static inline int16x8_t _load_neon(const int16_t *src, int step)
+{
+	return(step == 1 ? vld1q_s16(src) : vld2q_s16(src).val[0]);
+}
+
+static void _uint8_neon(void *dst, const int16_t *src, size_t n, int step)
+{
+	uint8_t *u8 = dst;
+	int8x16_t v;
+
+	for(; n >= 16; n -= 16, src += 16 * step, u8 += 16)
+	{
+		v = vcombine_s8(vshrn_n_s16(_load_neon(&src[0], step), 8), vshrn_n_s16(_load_neon(&src[8 * step], step), 8));
+		vst1q_u8(u8, veorq_u8(vreinterpretq_u8_s8(v), vdupq_n_u8(0x80)));
+	}
+
+	_uint8_scalar(u8, src, n, step);
+}
+
+static void _int8_neon(void *dst, const int16_t *src, size_t n, int step)
+{
+	int8_t *i8 = dst;
+
+	for(; n >= 16; n -= 16, src += 16 * step, i8 += 16)
+	{
+		vst1q_s8(i8, vcombine_s8(vshrn_n_s16(_load_neon(&src[0], step), 8), vshrn_n_s16(_load_neon(&src[8 * step], step), 8)));
+	}
+
+	_int8_scalar(i8, src, n, step);
+}
+
+static void _uint16_neon(void *dst, const int16_t *src, size_t n, int step)
+{
+	uint16_t *u16 = dst;
+
+	for(; n >= 8; n -= 8, src += 8 * step, u16 += 8)
+	{
+		vst1q_u16(u16, veorq_u16(vreinterpretq_u16_s16(_load_neon(src, step)), vdupq_n_u16(0x8000)));
+	}
+
+	_uint16_scalar(u16, src, n, step);
+}
+
+static void _int16_neon(void *dst, const int16_t *src, size_t n, int step)
+{
+	int16_t *i16 = dst;
+
+	for(; step == 2 && n >= 8; n -= 8, src += 16, i16 += 8)
+	{
+		vst1q_s16(i16, _load_neon(src, step));
+	}
+
+	_int16_scalar(i16, src, n, step);
+}
+
+static void _int32_neon(void *dst, const int16_t *src, size_t n, int step)
+{
+	int32_t *i32 = dst;
+	int16x8_t v;
+	int32x4_t a, b;
+
+	for(; n >= 8; n -= 8, src += 8 * step, i32 += 8)
+	{
+		v = _load_neon(src, step);
+		a = vmovl_s16(vget_low_s16(v));
+		b = vmovl_s16(vget_high_s16(v));
+		vst1q_s32(&i32[0], vaddq_s32(vshlq_n_s32(a, 16), a));
+		vst1q_s32(&i32[4], vaddq_s32(vshlq_n_s32(b, 16), b));
+	}
+
+	_int32_scalar(i32, src, n, step);
+}
+
+static void _planar_neon(uint8_t *i, uint8_t *q, const int16_t *src, size_t n)
+{
+	int16x8x2_t v;
+	int16x8_t vi, vq;
+
+	for(; n >= 8; n -= 8, src += 16, i += 8, q += 8)
+	{
+		v = vld2q_s16(src);
+
+		/* Divide by 256, rounding towards zero */
+		vi = vshrq_n_s16(vaddq_s16(v.val[0], vandq_s16(vshrq_n_s16(v.val[0], 15), vdupq_n_s16(255))), 8);
+		vq = vshrq_n_s16(vaddq_s16(v.val[1], vandq_s16(vshrq_n_s16(v.val[1], 15), vdupq_n_s16(255))), 8);
+
+		vst1_u8(i, vreinterpret_u8_s8(veor_s8(vmovn_s16(vi), vdup_n_s8(-128))));
+		vst1_u8(q, vreinterpret_u8_s8(veor_s8(vmovn_s16(vq), vdup_n_s8(-128))));
+	}
+
+	_planar_scalar(i, q, src, n);
+}
+
+#endif
+
+static _convert_t _select(int type)
+{
+	unsigned int features = cpu_features();
+
+#if defined(CPU_X86)
+	if(features & CPU_AVX2)
+	{
+		switch(type)
+		{
+		case RF_UINT8:  return(_uint8_avx2);
+		case RF_INT8:   return(_int8_avx2);
+		case RF_UINT16: return(_uint16_avx2);
+		case RF_INT16:  return(_int16_avx2);
+		case RF_INT32:  return(_int32_avx2);
+		case RF_FLOAT:  return(_float_avx2);
+		}
+	}
+	else if(features & CPU_SSE2)
+	{
+		switch(type)
+		{
+		case RF_UINT8:  return(_uint8_sse2);
+		case RF_INT8:   return(_int8_sse2);
+		case RF_UINT16: return(_uint16_sse2);
+		case RF_INT16:  return(_int16_sse2);
+		case RF_INT32:  return(_int32_sse2);
+		case RF_FLOAT:  return(_float_sse2);
+		}
+	}
+#elif defined(CPU_ARM)
+	if(features & CPU_NEON)
+	{
+		switch(type)
+		{
+		case RF_UINT8:  return(_uint8_neon);
+		case RF_INT8:   return(_int8_neon);
+		case RF_UINT16: return(_uint16_neon);
+		case RF_INT16:  return(_int16_neon);
+		case RF_INT32:  return(_int32_neon);
+		}
+	}
+#else
+	(void) features;
+#endif
+
+	switch(type)
+	{
+	case RF_UINT8:  return(_uint8_scalar);
+	case RF_INT8:   return(_int8_scalar);
+	case RF_UINT16: return(_uint16_scalar);
+	case RF_INT16:  return(_int16_scalar);
+	case RF_INT32:  return(_int32_scalar);
+	case RF_FLOAT:  return(_float_scalar);
+	}
+
+	return(NULL);
+}
+
+void rf_convert(void *dst, const int16_t *iq_data, size_t samples, int type, int complex)
+{
+	/* Sinks on different threads can get here at the same time */
+	static _Atomic(_convert_t) convert[RF_FLOAT + 1];
+	_convert_t c;
+
+	if(type < 0 || type > RF_FLOAT)
+	{
+		return;
+	}
+
+	c = atomic_load_explicit(&convert[type], memory_order_relaxed);
+	if(!c)
+	{
+		c = _select(type);
+		atomic_store_explicit(&convert[type], c, memory_order_relaxed);
+	}
+
+	c(dst, iq_data, complex ? samples * 2 : samples, complex ? 1 : 2);
+}
+
+void rf_convert_uint8_planar(uint8_t *i, uint8_t *q, const int16_t *iq_data, size_t samples)
+{
+#if defined(CPU_X86)
+	if(cpu_features() & CPU_SSE2)
+	{
+		_planar_sse2(i, q, iq_data, samples);
+		return;
+	}
+#elif defined(CPU_ARM)
+	if(cpu_features() & CPU_NEON)
+	{
+		_planar_neon(i, q, iq_data, samples);
+		return;
+	}
+#endif
+
+	_planar_scalar(i, q, iq_data, samples);
+}
+
+void rf_convert_int16_scaled(int16_t *dst, const int16_t *iq_data, size_t samples, int scale)
+{
+	/* Both I and Q are scaled */
+	samples *= 2;
+
+#if defined(CPU_X86)
+	if(cpu_features() & CPU_AVX2)
+	{
+		_scaled_avx2(dst, iq_data, samples, scale);
+		return;
+	}
+	else if(cpu_features() & CPU_SSE2)
+	{
+		_scaled_sse2(dst, iq_data, samples, scale);
+		return;
+	}
+#endif
+
+	_scaled_scalar(dst, iq_data, samples, scale);
+}
+
+void rf_convert_to_int16(int16_t *iq_data, const void *src, size_t samples, int type, int complex)
+{
+	size_t i, n = complex ? samples * 2 : samples;
+	int step = complex ? 1 : 2;
+	int16_t *d = iq_data;
+	int64_t v;
+	float f;
+	
+	/* The reverse of rf_convert(). Real samples get a Q of zero */
+	if(!complex)
+	{
+		memset(iq_data, 0, samples * 2 * sizeof(int16_t));
+	}
+	
+	switch(type)
+	{
+	case RF_UINT8:
+		for(i = 0; i < n; i++, d += step) *d = (((const uint8_t *) src)[i] - 128) * 256;
+		break;
+	
+	case RF_INT8:
+		for(i = 0; i < n; i++, d += step) *d = ((const int8_t *) src)[i] * 256;
+		break;
+	
+	case RF_UINT16:
+		for(i = 0; i < n; i++, d += step) *d = ((const uint16_t *) src)[i] - 32768;
+		break;
+	
+	case RF_INT16:
+		if(complex)
+		{
+			memcpy(iq_data, src, n * sizeof(int16_t));
+			break;
+		}
+		
+		for(i = 0; i < n; i++, d += step) *d = ((const int16_t *) src)[i];
+		break;
+	
+	case RF_INT32:
+		for(i = 0; i < n; i++, d += step)
+		{
+			v = ((int64_t) ((const int32_t *) src)[i] + 32768) >> 16;
+			*d = v > INT16_MAX ? INT16_MAX : v;
+		}
+		break;
+	
+	case RF_FLOAT:
+		for(i = 0; i < n; i++, d += step)
+		{
+			f = ((const float *) src)[i] * 32767.0f;
+			
+			/* NaN fails both tests and ends up as zero */
+			*d = f >= INT16_MAX ? INT16_MAX : f <= INT16_MIN ? INT16_MIN : f == f ? (int16_t) lrintf(f) : 0;
+		}
+		break;
+	}
+}
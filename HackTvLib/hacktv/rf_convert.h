@@ -0,0 +1,34 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _RF_CONVERT_H
+#define _RF_CONVERT_H
+
+/* Converts samples of int16 IQ to one of the RF_* output types.
+ * Real types take only the I part of each sample */
+extern void rf_convert(void *dst, const int16_t *iq_data, size_t samples, int type, int complex);
+
+/* Splits IQ into two planes of unsigned 8-bit, as 128 + x / 256 */
+extern void rf_convert_uint8_planar(uint8_t *i, uint8_t *q, const int16_t *iq_data, size_t samples);
+
+/* Scales IQ to a smaller full scale, as x * scale / INT16_MAX */
+extern void rf_convert_int16_scaled(int16_t *dst, const int16_t *iq_data, size_t samples, int scale);
+
+/* Converts samples of one of the RF_* types back to int16 IQ */
+extern void rf_convert_to_int16(int16_t *iq_data, const void *src, size_t samples, int type, int complex);
+
+#endif
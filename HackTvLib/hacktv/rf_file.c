@@ -15,281 +15,293 @@
 /* You should have received a copy of the GNU General Public License     */
 /* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
 
+/* For O_DIRECT and fallocate() */
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#endif
 #include "rf.h"
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* Output is converted into one of a few large buffers, which a
+ * background thread writes out. Rendering only waits on the disk
+ * when every buffer is full. The size is a multiple of every sample
+ * size and of the O_DIRECT alignment */
+#define _BUFFERS     4
+#define _BUFFER_SIZE (4 << 20)
+#define _ALIGN       4096
+
+/* Regular files are preallocated this far ahead where supported */
+#define _PREALLOCATE (256 << 20)
+
 /* File sink */
 typedef struct {
-	FILE *f;
-	void *data;
+	int fd;
 	size_t data_size;
-	size_t samples;
 	int complex;
 	int type;
+	int direct;
+	
+	/* The buffers, and the bytes queued in each */
+	uint8_t *data;
+	size_t length[_BUFFERS];
+	
+	/* The buffer being filled, and how far */
+	int in;
+	size_t fill;
+	
+	/* The next buffer to be written, and the number queued */
+	int out;
+	int queued;
+	
+	/* Writer thread */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int closing;
+	int error;
+	
+	/* Bytes written, and preallocated */
+	uint64_t offset;
+	uint64_t allocated;
+	
 } rf_file_t;
 
-static int _rf_file_write_uint8_real(void *private, int16_t *iq_data, size_t samples)
+static void _rf_file_preallocate(rf_file_t *rf, size_t length)
 {
-	rf_file_t *rf = private;
-	uint8_t *u8 = rf->data;
-	int i;
-	
-	while(samples)
+#ifdef __linux__
+	/* Keep the next stretch of the file allocated ahead of the writer.
+	 * The size isn't changed, and anything unused is released on close */
+	if(rf->allocated < rf->offset + length)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		if(fallocate(rf->fd, FALLOC_FL_KEEP_SIZE, rf->offset, _PREALLOCATE) == 0)
 		{
-			u8[i] = (iq_data[0] - INT16_MIN) >> 8;
+			rf->allocated = rf->offset + _PREALLOCATE;
+		}
+		else
+		{
+			/* Not supported here, don't try again */
+			rf->allocated = UINT64_MAX;
 		}
-		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
 	}
-	
-	return(RF_OK);
+#endif
 }
 
-static int _rf_file_write_int8_real(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write_all(rf_file_t *rf, const uint8_t *data, size_t length)
 {
-	rf_file_t *rf = private;
-	int8_t *i8 = rf->data;
-	int i;
+	ssize_t r;
 	
-	while(samples)
+#ifdef O_DIRECT
+	if(rf->direct && length % _ALIGN != 0)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			i8[i] = iq_data[0] >> 8;
-		}
-		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
+		/* The final, partial block can't be written directly */
+		fcntl(rf->fd, F_SETFL, fcntl(rf->fd, F_GETFL) & ~O_DIRECT);
+		rf->direct = 0;
 	}
+#endif
 	
-	return(RF_OK);
-}
-
-static int _rf_file_write_uint16_real(void *private, int16_t *iq_data, size_t samples)
-{
-	rf_file_t *rf = private;
-	uint16_t *u16 = rf->data;
-	int i;
+	_rf_file_preallocate(rf, length);
 	
-	while(samples)
+	while(length > 0)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		r = write(rf->fd, data, length);
+		
+		if(r < 0)
 		{
-			u16[i] = (iq_data[0] - INT16_MIN);
+			if(errno == EINTR) continue;
+			perror("write");
+			return(RF_ERROR);
 		}
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
+		data += r;
+		length -= r;
+		rf->offset += r;
 	}
 	
 	return(RF_OK);
 }
 
-static int _rf_file_write_int16_real(void *private, int16_t *iq_data, size_t samples)
+static void *_rf_file_thread(void *arg)
 {
-	rf_file_t *rf = private;
-	int16_t *i16 = rf->data;
-	int i;
+	rf_file_t *rf = arg;
+	int i, r, e;
 	
-	while(samples)
+	pthread_mutex_lock(&rf->mutex);
+	
+	while(1)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		while(rf->queued == 0 && !rf->closing)
 		{
-			i16[i] = iq_data[0];
+			pthread_cond_wait(&rf->cond, &rf->mutex);
 		}
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
-	}
-	
-	return(RF_OK);
-}
-
-static int _rf_file_write_int32_real(void *private, int16_t *iq_data, size_t samples)
-{
-	rf_file_t *rf = private;
-	int32_t *i32 = rf->data;
-	int i;
-	
-	while(samples)
-	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		if(rf->queued == 0)
 		{
-			i32[i] = (iq_data[0] << 16) + iq_data[0];
+			/* Closing, and everything has been written */
+			break;
 		}
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		i = rf->out;
+		e = rf->error;
 		
-		samples -= i;
+		/* Write without holding the lock. After an error the
+		 * remaining buffers are discarded */
+		pthread_mutex_unlock(&rf->mutex);
+		r = e ? RF_ERROR : _rf_file_write_all(rf, rf->data + (size_t) i * _BUFFER_SIZE, rf->length[i]);
+		pthread_mutex_lock(&rf->mutex);
+		
+		if(r != RF_OK) rf->error = 1;
+		
+		rf->out = (rf->out + 1) % _BUFFERS;
+		rf->queued--;
+		pthread_cond_broadcast(&rf->cond);
 	}
 	
-	return(RF_OK);
+	pthread_mutex_unlock(&rf->mutex);
+	
+	return(NULL);
 }
 
-static int _rf_file_write_float_real(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_queue(rf_file_t *rf)
 {
-	rf_file_t *rf = private;
-	float *f32 = rf->data;
-	int i;
+	int r;
 	
-	while(samples)
+	/* Pass the current buffer to the writer, and wait
+	 * until the next one has been written out */
+	pthread_mutex_lock(&rf->mutex);
+	
+	rf->length[rf->in] = rf->fill;
+	rf->queued++;
+	pthread_cond_broadcast(&rf->cond);
+	
+	while(rf->queued == _BUFFERS && !rf->error)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			f32[i] = (float) iq_data[0] * (1.0 / 32767.0);
-		}
-		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
+		pthread_cond_wait(&rf->cond, &rf->mutex);
 	}
 	
-	return(RF_OK);
+	r = rf->error ? RF_ERROR : RF_OK;
+	
+	pthread_mutex_unlock(&rf->mutex);
+	
+	rf->in = (rf->in + 1) % _BUFFERS;
+	rf->fill = 0;
+	
+	return(r);
 }
 
-static int _rf_file_write_uint8_complex(void *private, int16_t *iq_data, size_t samples)
+static void *_rf_file_next(rf_file_t *rf, size_t samples, size_t *n)
 {
-	rf_file_t *rf = private;
-	uint8_t *u8 = rf->data;
-	int i;
+	/* Space for up to the next n samples in the current buffer */
+	*n = (_BUFFER_SIZE - rf->fill) / rf->data_size;
+	if(*n > samples) *n = samples;
 	
-	while(samples)
-	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			u8[i * 2 + 0] = (iq_data[0] - INT16_MIN) >> 8;
-			u8[i * 2 + 1] = (iq_data[1] - INT16_MIN) >> 8;
-		}
-		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
-	}
-	
-	return(RF_OK);
+	return(rf->data + (size_t) rf->in * _BUFFER_SIZE + rf->fill);
 }
 
-static int _rf_file_write_int8_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_commit(rf_file_t *rf, size_t n)
 {
-	rf_file_t *rf = private;
-	int8_t *i8 = rf->data;
-	int i;
+	rf->fill += n * rf->data_size;
 	
-	while(samples)
+	if(rf->fill == _BUFFER_SIZE)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			i8[i * 2 + 0] = iq_data[0] >> 8;
-			i8[i * 2 + 1] = iq_data[1] >> 8;
-		}
-		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
+		return(_rf_file_queue(rf));
 	}
 	
 	return(RF_OK);
 }
 
-static int _rf_file_write_uint16_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_write(void *private, int16_t *iq_data, size_t samples)
 {
 	rf_file_t *rf = private;
-	uint16_t *u16 = rf->data;
-	int i;
+	void *data;
+	size_t n;
 	
 	while(samples)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			u16[i * 2 + 0] = (iq_data[0] - INT16_MIN);
-			u16[i * 2 + 1] = (iq_data[1] - INT16_MIN);
-		}
+		data = _rf_file_next(rf, samples, &n);
+		rf_convert(data, iq_data, n, rf->type, rf->complex);
 		
-		fwrite(rf->data, rf->data_size, i, rf->f);
+		if(_rf_file_commit(rf, n) != RF_OK) return(RF_ERROR);
 		
-		samples -= i;
+		iq_data += n * 2;
+		samples -= n;
 	}
 	
 	return(RF_OK);
 }
 
-static int _rf_file_write_int16_complex(void *private, int16_t *iq_data, size_t samples)
+static void _rf_file_free(rf_file_t *rf)
 {
-	rf_file_t *rf = private;
+	if(rf->fd >= 0 && rf->fd != STDOUT_FILENO) close(rf->fd);
 	
-	fwrite(iq_data, sizeof(int16_t) * 2, samples, rf->f);
+#ifdef _WIN32
+	_aligned_free(rf->data);
+#else
+	free(rf->data);
+#endif
 	
-	return(RF_OK);
+	free(rf);
 }
 
-static int _rf_file_write_int32_complex(void *private, int16_t *iq_data, size_t samples)
+static int _rf_file_close(void *private)
 {
 	rf_file_t *rf = private;
-	int32_t *i32 = rf->data;
-	int i;
+	int r = RF_OK;
 	
-	while(samples)
+	/* Queue any partial buffer, then let the writer finish */
+	pthread_mutex_lock(&rf->mutex);
+	
+	if(rf->fill > 0)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
-		{
-			i32[i * 2 + 0] = (iq_data[0] << 16) + iq_data[0];
-			i32[i * 2 + 1] = (iq_data[1] << 16) + iq_data[1];
-		}
-		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
+		rf->length[rf->in] = rf->fill;
+		rf->queued++;
 	}
 	
-	return(RF_OK);
-}
-
-static int _rf_file_write_float_complex(void *private, int16_t *iq_data, size_t samples)
-{
-	rf_file_t *rf = private;
-	float *f32 = rf->data;
-	int i;
+	rf->closing = 1;
+	pthread_cond_broadcast(&rf->cond);
+	pthread_mutex_unlock(&rf->mutex);
 	
-	while(samples)
+	pthread_join(rf->thread, NULL);
+	pthread_cond_destroy(&rf->cond);
+	pthread_mutex_destroy(&rf->mutex);
+	
+	if(rf->error) r = RF_ERROR;
+	
+#ifdef __linux__
+	/* Release any space preallocated past the end of the file */
+	if(rf->allocated > rf->offset && rf->allocated != UINT64_MAX)
 	{
-		for(i = 0; i < rf->samples && i < samples; i++, iq_data += 2)
+		if(ftruncate(rf->fd, rf->offset) != 0)
 		{
-			f32[i * 2 + 0] = (float) iq_data[0] * (1.0 / 32767.0);
-			f32[i * 2 + 1] = (float) iq_data[1] * (1.0 / 32767.0);
+			perror("ftruncate");
+			r = RF_ERROR;
 		}
-		
-		fwrite(rf->data, rf->data_size, i, rf->f);
-		
-		samples -= i;
 	}
+#endif
 	
-	return(RF_OK);
-}
-
-static int _rf_file_close(void *private)
-{
-	rf_file_t *rf = private;
+	_rf_file_free(rf);
 	
-	if(rf->f && rf->f != stdout) fclose(rf->f);
-	if(rf->data) free(rf->data);
-	free(rf);
-	
-	return(RF_OK);
+	return(r);
 }
 
-int rf_file_open(rf_t *s, char *filename, int type, int complex)
+int rf_file_open(rf_t *s, char *filename, int type, int complex, int direct)
 {
 	rf_file_t *rf = calloc(1, sizeof(rf_file_t));
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_BINARY;
+	struct stat st;
 	
 	if(!rf)
 	{
@@ -297,31 +309,67 @@ int rf_file_open(rf_t *s, char *filename, int type, int complex)
 		return(RF_ERROR);
 	}
 	
+	rf->fd = -1;
 	rf->complex = complex != 0;
 	rf->type = type;
 	
 	if(filename == NULL)
 	{
 		fprintf(stderr, "No output filename provided.\n");
-		_rf_file_close(rf);
+		_rf_file_free(rf);
 		return(RF_ERROR);
 	}
 	else if(strcmp(filename, "-") == 0)
 	{
-		rf->f = stdout;
+		rf->fd = STDOUT_FILENO;
+#ifdef _WIN32
+		_setmode(rf->fd, _O_BINARY);
+#endif
 	}
 	else
 	{
-		rf->f = fopen(filename, "wb");	
+#ifdef O_DIRECT
+		if(direct)
+		{
+			/* Not every filesystem allows O_DIRECT */
+			rf->fd = open(filename, flags | O_DIRECT, 0666);
+			rf->direct = rf->fd >= 0;
+			
+			if(rf->fd < 0)
+			{
+				fprintf(stderr, "Warning: Direct I/O isn't available for '%s'.\n", filename);
+			}
+		}
+#else
+		if(direct)
+		{
+			fprintf(stderr, "Warning: Direct I/O isn't available on this platform.\n");
+		}
+#endif
+		
+		if(rf->fd < 0)
+		{
+			rf->fd = open(filename, flags, 0666);
+		}
 		
-		if(!rf->f)
+		if(rf->fd < 0)
 		{
-			perror("fopen");
-			_rf_file_close(rf);
+			perror("open");
+			_rf_file_free(rf);
 			return(RF_ERROR);
 		}
 	}
 	
+	/* Only regular files are preallocated */
+	if(fstat(rf->fd, &st) != 0 || !S_ISREG(st.st_mode))
+	{
+		rf->allocated = UINT64_MAX;
+	}
+	
+#if defined(__linux__)
+	posix_fadvise(rf->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	
 	/* Find the size of the output data type */
 	switch(type)
 	{
@@ -333,42 +381,48 @@ int rf_file_open(rf_t *s, char *filename, int type, int complex)
 	case RF_FLOAT:  rf->data_size = sizeof(float);    break;
 	default:
 		fprintf(stderr, "%s: Unrecognised data type %d\n", __func__, type);
-		_rf_file_close(rf);
+		_rf_file_free(rf);
 		return(RF_ERROR);
 	}
 	
 	/* Double the size for complex types */
 	if(rf->complex) rf->data_size *= 2;
 	
-	/* Number of samples in the temporary buffer */
-	rf->samples = 4096;
+	/* Allocate the buffers, aligned for O_DIRECT */
+#ifdef _WIN32
+	rf->data = _aligned_malloc((size_t) _BUFFERS * _BUFFER_SIZE, _ALIGN);
+#else
+	if(posix_memalign((void **) &rf->data, _ALIGN, (size_t) _BUFFERS * _BUFFER_SIZE) != 0)
+	{
+		rf->data = NULL;
+	}
+#endif
 	
-	/* Allocate the memory, unless the output is int16 complex */
-	if(rf->type != RF_INT16 || !rf->complex)
+	if(!rf->data)
 	{
-		rf->data = malloc(rf->data_size * rf->samples);
-		if(!rf->data)
-		{
-			perror("malloc");
-			_rf_file_close(rf);
-			return(RF_ERROR);
-		}
+		perror("malloc");
+		_rf_file_free(rf);
+		return(RF_ERROR);
 	}
 	
-	/* Register the callback functions */
-	s->ctx = rf;
-	s->close = _rf_file_close;
+	/* Start the writer */
+	pthread_mutex_init(&rf->mutex, NULL);
+	pthread_cond_init(&rf->cond, NULL);
 	
-	switch(type)
+	if(pthread_create(&rf->thread, NULL, &_rf_file_thread, rf) != 0)
 	{
-	case RF_UINT8:  s->write = rf->complex ? _rf_file_write_uint8_complex  : _rf_file_write_uint8_real;  break;
-	case RF_INT8:   s->write = rf->complex ? _rf_file_write_int8_complex   : _rf_file_write_int8_real;   break;
-	case RF_UINT16: s->write = rf->complex ? _rf_file_write_uint16_complex : _rf_file_write_uint16_real; break;
-	case RF_INT16:  s->write = rf->complex ? _rf_file_write_int16_complex  : _rf_file_write_int16_real;  break;
-	case RF_INT32:  s->write = rf->complex ? _rf_file_write_int32_complex  : _rf_file_write_int32_real;  break;
-	case RF_FLOAT:  s->write = rf->complex ? _rf_file_write_float_complex  : _rf_file_write_float_real;  break;
+		perror("pthread_create");
+		pthread_cond_destroy(&rf->cond);
+		pthread_mutex_destroy(&rf->mutex);
+		_rf_file_free(rf);
+		return(RF_ERROR);
 	}
 	
+	/* Register the callback functions */
+	s->ctx = rf;
+	s->write = _rf_file_write;
+	s->close = _rf_file_close;
+	
 	return(RF_OK);
 }
 
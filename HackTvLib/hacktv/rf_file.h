@@ -18,7 +18,7 @@
 #ifndef _FILE_H
 #define _FILE_H
 
-extern int rf_file_open(rf_t *s, char *filename, int type, int complex);
+extern int rf_file_open(rf_t *s, char *filename, int type, int complex, int direct);
 
 #endif
 
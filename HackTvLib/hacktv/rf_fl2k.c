@@ -18,83 +18,132 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
 #include <osmo-fl2k.h>
-#include <pthread.h>
 #include "rf.h"
 
-#define BUFFERS 4
+/* Default buffering, in milliseconds. The ring never has fewer than
+ * MIN_BUFFERS blocks */
+#define DEFAULT_LATENCY 100
+#define MIN_BUFFERS 4
+
+/* How long the writer sleeps while the ring is full */
+#define _BUFFER_WAIT_US 1000
+
+/* The blocks between the writer and the libosmo-fl2k callback form a
+ * lock-free single producer, single consumer ring, as in rf_hackrf.c.
+ * The callback holds on to the block it last handed out until it can
+ * hand out the next, as the library reads it after the callback
+ * returns. Both indexes count modulo 2 * count */
 
 typedef struct {
 	
 	fl2k_dev_t *d;
-	int abort;
+	atomic_int abort;
+	
+	/* The R and G planes of each block */
+	uint8_t *buffer_r;
+	uint8_t *buffer_g;
+	int count;
 	
-	uint8_t buffer_r[BUFFERS][FL2K_BUF_LEN];
-	uint8_t buffer_g[BUFFERS][FL2K_BUF_LEN];
-	pthread_mutex_t mutex[BUFFERS];
-	int len;
-	int in;
-	int out;
+	/* Blocks written, and released by the callback */
+	atomic_int head;
+	atomic_int tail;
+	
+	/* Samples written to the writer's current block */
+	size_t len;
+	
+	/* Set once the callback holds the block at tail */
+	int holding;
 	
 } fl2k_t;
 
+static int _used(fl2k_t *rf, int head, int tail)
+{
+	/* The number of blocks written but not yet released */
+	return((head - tail + rf->count * 2) % (rf->count * 2));
+}
+
 static void _callback(fl2k_data_info_t *data_info)
 {
 	fl2k_t *rf = data_info->ctx;
-	int i;
+	int head, tail;
+	size_t i;
 	
 	if(data_info->device_error)
 	{
-		rf->abort = 1;
+		atomic_store(&rf->abort, 1);
 		return;
 	}
 	
-	/* Try to get a lock on the next output buffer */
-	i = (rf->out + 1) % BUFFERS;
+	tail = atomic_load_explicit(&rf->tail, memory_order_relaxed);
+	head = atomic_load_explicit(&rf->head, memory_order_acquire);
 	
-	if(pthread_mutex_trylock(&rf->mutex[i]) != 0)
+	if(_used(rf, head, tail) - rf->holding == 0)
 	{
-		/* No luck, the writer must have it */
+		/* Nothing new from the writer, keep the current block */
 		fprintf(stderr, "U");
 		return;
 	}
 	
-	/* Got a lock on the next buffer, clear and release the previous */
-	pthread_mutex_unlock(&rf->mutex[rf->out]);
+	/* Release the previous block and move on to the next */
+	if(rf->holding)
+	{
+		tail = (tail + 1) % (rf->count * 2);
+		atomic_store_explicit(&rf->tail, tail, memory_order_release);
+	}
 	
-	rf->out = i;
+	rf->holding = 1;
+	i = (size_t) (tail % rf->count) * FL2K_BUF_LEN;
 	
 	data_info->sampletype_signed = 0;
-	data_info->r_buf = (char *) rf->buffer_r[rf->out];
-	data_info->g_buf = (char *) rf->buffer_g[rf->out];
+	data_info->r_buf = (char *) &rf->buffer_r[i];
+	data_info->g_buf = (char *) &rf->buffer_g[i];
 	data_info->b_buf = NULL;
 }
 
 static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 {
 	fl2k_t *rf = private;
-	int i;
-	
-	if(rf->abort)
-	{
-		return(RF_ERROR);
-	}
+	int head = atomic_load_explicit(&rf->head, memory_order_relaxed);
+	size_t i, l;
 	
 	while(samples > 0)
 	{
-		for(; rf->len < FL2K_BUF_LEN && samples > 0; rf->len++, samples--)
+		/* Wait for a free block to start on */
+		while(rf->len == 0 &&
+		      _used(rf, head, atomic_load_explicit(&rf->tail, memory_order_acquire)) == rf->count)
+		{
+			if(atomic_load(&rf->abort))
+			{
+				return(RF_ERROR);
+			}
+			
+			usleep(_BUFFER_WAIT_US);
+		}
+		
+		if(atomic_load(&rf->abort))
 		{
-			rf->buffer_r[rf->in][rf->len] = 128 + (*(iq_data++) / 256);
-			rf->buffer_g[rf->in][rf->len] = 128 + (*(iq_data++) / 256);
+			return(RF_ERROR);
 		}
 		
+		/* Fill as much of the current block as possible */
+		l = FL2K_BUF_LEN - rf->len;
+		if(l > samples) l = samples;
+		
+		i = (size_t) (head % rf->count) * FL2K_BUF_LEN + rf->len;
+		rf_convert_uint8_planar(&rf->buffer_r[i], &rf->buffer_g[i], iq_data, l);
+		
+		iq_data += l * 2;
+		samples -= l;
+		rf->len += l;
+		
 		if(rf->len == FL2K_BUF_LEN)
 		{
-			/* This buffer is full. Move on to the next. */
-			i = (rf->in + 1) % BUFFERS;
-			pthread_mutex_lock(&rf->mutex[i]);
-			pthread_mutex_unlock(&rf->mutex[rf->in]);
-			rf->in = i;
+			/* This block is full, pass it to the callback */
+			head = (head + 1) % (rf->count * 2);
+			atomic_store_explicit(&rf->head, head, memory_order_release);
 			rf->len = 0;
 		}
 	}
@@ -102,27 +151,42 @@ static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 	return(RF_OK);
 }
 
-static int _rf_close(void *private)
+static int _rf_fill(void *private, size_t *samples, size_t *capacity)
 {
 	fl2k_t *rf = private;
-	int r;
+	int used;
 	
-	rf->abort = 1;
+	/* Approximate, the callback may be part way through a block */
+	used = _used(rf,
+		atomic_load_explicit(&rf->head, memory_order_relaxed),
+		atomic_load_explicit(&rf->tail, memory_order_relaxed));
 	
-	fl2k_stop_tx(rf->d);
-	fl2k_close(rf->d);
+	if(samples) *samples = (size_t) used * FL2K_BUF_LEN;
+	if(capacity) *capacity = (size_t) rf->count * FL2K_BUF_LEN;
 	
-	for(r = 0; r < BUFFERS; r++)
+	return(RF_OK);
+}
+
+static int _rf_close(void *private)
+{
+	fl2k_t *rf = private;
+	
+	atomic_store(&rf->abort, 1);
+	
+	if(rf->d)
 	{
-		pthread_mutex_destroy(&rf->mutex[r]);
+		fl2k_stop_tx(rf->d);
+		fl2k_close(rf->d);
 	}
 	
+	free(rf->buffer_r);
+	free(rf->buffer_g);
 	free(rf);
 	
 	return(RF_OK);
 }
 
-int rf_fl2k_open(rf_t *s, const char *device, unsigned int sample_rate)
+int rf_fl2k_open(rf_t *s, const char *device, unsigned int sample_rate, unsigned int latency_ms, unsigned int buffer_count)
 {
 	fl2k_t *rf;
 	int r;
@@ -133,7 +197,28 @@ int rf_fl2k_open(rf_t *s, const char *device, unsigned int sample_rate)
 		return(RF_OUT_OF_MEMORY);
 	}
 	
-	rf->abort = 0;
+	atomic_init(&rf->abort, 0);
+	atomic_init(&rf->head, 0);
+	atomic_init(&rf->tail, 0);
+	
+	/* Size the ring, either by count or enough blocks
+	 * to cover the latency target */
+	if(latency_ms == 0) latency_ms = DEFAULT_LATENCY;
+	
+	rf->count = buffer_count > 0 ? buffer_count : ((uint64_t) sample_rate * latency_ms / 1000 + FL2K_BUF_LEN - 1) / FL2K_BUF_LEN;
+	if(rf->count < MIN_BUFFERS) rf->count = MIN_BUFFERS;
+	
+	rf->buffer_r = calloc(rf->count, FL2K_BUF_LEN);
+	rf->buffer_g = calloc(rf->count, FL2K_BUF_LEN);
+	if(!rf->buffer_r || !rf->buffer_g)
+	{
+		_rf_close(rf);
+		return(RF_OUT_OF_MEMORY);
+	}
+	
+	fprintf(stderr, "fl2k: Buffering %d x %u samples, %.0f ms\n",
+		rf->count, (unsigned int) FL2K_BUF_LEN,
+		(double) rf->count * FL2K_BUF_LEN * 1000.0 / sample_rate);
 	
 	r = device ? atoi(device) : 0;
 	
@@ -145,21 +230,6 @@ int rf_fl2k_open(rf_t *s, const char *device, unsigned int sample_rate)
 		return(RF_ERROR);
 	}
 	
-	for(r = 0; r < BUFFERS; r++)
-	{
-		pthread_mutex_init(&rf->mutex[r], NULL);
-	}
-	
-	/* Lock the initial buffer for the provider */
-	rf->in = 0;
-	pthread_mutex_lock(&rf->mutex[rf->in]);
-	
-	/* Lock the last empty buffer for the consumer */
-	rf->out = BUFFERS - 1;
-	pthread_mutex_lock(&rf->mutex[rf->out]);
-	
-	rf->len = 0;
-	
 	r = fl2k_start_tx(rf->d, _callback, rf, 0);
 	if(r < 0)
 	{
@@ -189,6 +259,7 @@ int rf_fl2k_open(rf_t *s, const char *device, unsigned int sample_rate)
 	s->ctx = rf;
 	s->write = _rf_write;
 	s->close = _rf_close;
+	s->fill = _rf_fill;
 	
 	return(RF_OK);
 }
@@ -18,7 +18,7 @@
 #ifndef _FL2K_H
 #define _FL2K_H
 
-extern int rf_fl2k_open(rf_t *s, const char *device, unsigned int sample_rate);
+extern int rf_fl2k_open(rf_t *s, const char *device, unsigned int sample_rate, unsigned int latency_ms, unsigned int buffer_count);
 
 #endif
 
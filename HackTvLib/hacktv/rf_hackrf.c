@@ -3,11 +3,16 @@
 #include <stdint.h>  // For fixed-width integer types
 #include <stdlib.h>  // For malloc and free
 #include <libhackrf/hackrf.h>
-#include <pthread.h>
+#include <stdatomic.h>
 #include <unistd.h>
 #include "rf.h"
-/* Value from host/libhackrf/src/hackrf.c */
+#include "rf_convert.h"
+/* Values from host/libhackrf/src/hackrf.c */
 #define TRANSFER_BUFFER_SIZE 262144
+#define TRANSFER_COUNT 4
+
+/* Default buffering, in milliseconds */
+#define DEFAULT_LATENCY 400
 
 #define _GHZ(x) ((uint64_t)(x) * 1000000000)
 #define _MHZ(x) ((x) * 1000000)
@@ -24,40 +29,39 @@
 #define HACKRF_AMP_MAX_DB               14.0
 #define DEFAULT_FFT_SIZE                1024
 
-typedef enum {
-    BUFFER_EMPTY,
-    BUFFER_PREFILL,
-    BUFFER_FILL,
-    BUFFER_READY,
-} buffer_status_t;
+/* The blocks between the writer and the USB callback form a lock-free
+ * single producer, single consumer ring. Only the producer moves head
+ * and only the consumer moves tail, so the USB callback never takes a
+ * lock or waits. Both count modulo 2 * count, which tells a full ring
+ * from an empty one */
 
-typedef struct {
+/* How long the writer sleeps while the ring is full. Waking it
+ * directly would need a lock or a syscall in the USB callback. A
+ * block lasts over 6 ms at 20 MS/s with the rest of the ring still
+ * queued, so a 1 ms poll costs no margin */
+#define _BUFFER_WAIT_US 1000
 
-    /* Buffers are locked while reading/writing */
-    pthread_mutex_t mutex;
-    pthread_cond_t cond;
-    buffer_status_t status;
+typedef struct {
 
-    /* Pointer to the start of the buffer */
+    /* Pointer to the start of the blocks */
     int8_t *data;
 
-    /* Offset to start of data */
-    size_t start;
-
-    /* Length of data ready */
+    /* Length of each block, and the number of them */
     size_t length;
+    int count;
 
-} buffer_t;
+    /* Blocks written and read */
+    atomic_int head;
+    atomic_int tail;
 
-typedef struct {
+    /* Set once the ring has filled for the first time */
+    atomic_int ready;
 
-    buffer_t *buffers;
+    /* Bytes written to the producer's current block */
+    size_t in;
 
-    int length;
-    int count;
-    int prefill;
-    int in;
-    int out;
+    /* Bytes read from the consumer's current block */
+    size_t out;
 
 } buffers_t;
 
@@ -74,137 +78,115 @@ typedef struct {
 
 static int _buffer_init(buffers_t *buffers, size_t count, size_t length)
 {
-    int i;
-
-    buffers->count = count;
-    buffers->length = length;
-    buffers->buffers = calloc(count, sizeof(buffer_t));
-
-    for(i = 0; i < count; i++)
+    buffers->data = malloc(count * length);
+    if(!buffers->data)
     {
-        pthread_mutex_init(&buffers->buffers[i].mutex, NULL);
-        pthread_cond_init(&buffers->buffers[i].cond, NULL);
-        buffers->buffers[i].data = malloc(length);
-        buffers->buffers[i].start = buffers->length;
-        buffers->buffers[i].length = buffers->length;
-        buffers->buffers[i].status = BUFFER_EMPTY;
+        return(-1);
     }
 
-    buffers->prefill = 1;
+    buffers->count = count;
+    buffers->length = length;
     buffers->in = 0;
     buffers->out = 0;
 
+    atomic_init(&buffers->head, 0);
+    atomic_init(&buffers->tail, 0);
+    atomic_init(&buffers->ready, 0);
+
     return(0);
 }
 
 static int _buffer_free(buffers_t *buffers)
 {
-    int i;
-
-    for(i = 0; i < buffers->count; i++)
-    {
-        free(buffers->buffers[i].data);
-        pthread_cond_destroy(&buffers->buffers[i].cond);
-        pthread_mutex_destroy(&buffers->buffers[i].mutex);
-    }
-
-    free(buffers->buffers);
+    free(buffers->data);
     memset(buffers, 0, sizeof(buffers_t));
 
     return(0);
 }
 
+static int _buffer_used(buffers_t *buffers, int head, int tail)
+{
+    /* The number of blocks written but not yet read */
+    return((head - tail + buffers->count * 2) % (buffers->count * 2));
+}
+
 static int _buffer_read(buffers_t *buffers, int8_t *dst, size_t length)
 {
-    buffer_t *buf = &buffers->buffers[buffers->out];
+    int tail = atomic_load_explicit(&buffers->tail, memory_order_relaxed);
+    int head;
 
-    if(buf->start == buffers->length)
+    /* Nothing is read until the ring has filled */
+    if(!atomic_load_explicit(&buffers->ready, memory_order_acquire))
     {
-        buffer_status_t r;
-
-        /* Check if we can read this block */
-        pthread_mutex_lock(&buf->mutex);
-        r = buf->status;
-        pthread_mutex_unlock(&buf->mutex);
-
-        if(r != BUFFER_READY)
-        {
-            /* This buffer is not ready - display warning if not in prefill stage */
-            if(r != BUFFER_PREFILL)
-            {
-                fprintf(stderr, "U");
-            }
+        return(0);
+    }
 
-            return(0);
-        }
+    head = atomic_load_explicit(&buffers->head, memory_order_acquire);
 
-        buf->start = 0;
+    if(head == tail)
+    {
+        /* The ring is empty */
+        fprintf(stderr, "U");
+        return(0);
     }
 
-    if(length > buffers->length - buf->start)
+    if(length > buffers->length - buffers->out)
     {
-        length = buffers->length - buf->start;
+        length = buffers->length - buffers->out;
     }
 
-    memcpy(dst, buf->data + buf->start, length);
-    buf->start += length;
+    memcpy(dst, buffers->data + (tail % buffers->count) * buffers->length + buffers->out, length);
+    buffers->out += length;
 
-    if(buf->start == buffers->length)
+    if(buffers->out == buffers->length)
     {
-        /* Flag the current block as avaliable for writing */
-        pthread_mutex_lock(&buf->mutex);
-        buf->status = BUFFER_EMPTY;
-        pthread_mutex_unlock(&buf->mutex);
-        pthread_cond_broadcast(&buf->cond);
-
-        buffers->out = (buffers->out + 1) % buffers->count;
+        /* Hand the block back to the producer */
+        buffers->out = 0;
+        atomic_store_explicit(&buffers->tail, (tail + 1) % (buffers->count * 2), memory_order_release);
     }
 
     return(length);
 }
 
-static size_t _buffer_write_ptr(buffers_t *buffers, int8_t **src)
+static size_t _buffer_write_ptr(buffers_t *buffers, int8_t **src, int wait)
 {
-    buffer_t *buf = &buffers->buffers[buffers->in];
+    int head = atomic_load_explicit(&buffers->head, memory_order_relaxed);
 
-    if(buf->length == buffers->length)
+    /* Starting a new block, wait for one to be free
+     * if allowed, otherwise return 0 */
+    while(buffers->in == 0 &&
+          _buffer_used(buffers, head, atomic_load_explicit(&buffers->tail, memory_order_acquire)) == buffers->count)
     {
-        pthread_mutex_lock(&buf->mutex);
-
-        if(buf->status == BUFFER_PREFILL)
+        if(!wait)
         {
-            buffers->prefill = 0;
-            buf->status = BUFFER_READY;
-        }
-
-        while(buf->status != BUFFER_EMPTY)
-        {
-            pthread_cond_wait(&buf->cond, &buf->mutex);
+            return(0);
         }
 
-        pthread_mutex_unlock(&buf->mutex);
-
-        buf->length = 0;
+        usleep(_BUFFER_WAIT_US);
     }
 
-    *src = buf->data + buf->length;
+    *src = buffers->data + (head % buffers->count) * buffers->length + buffers->in;
 
-    return(buffers->length - buf->length);
+    return(buffers->length - buffers->in);
 }
 
 static int _buffer_write(buffers_t *buffers, size_t length)
 {
-    buffer_t *buf = &buffers->buffers[buffers->in];
+    int head = atomic_load_explicit(&buffers->head, memory_order_relaxed);
 
-    buf->length += length;
+    buffers->in += length;
 
-    if(buf->length == buffers->length)
+    if(buffers->in == buffers->length)
     {
-        pthread_mutex_lock(&buf->mutex);
-        buf->status = (buffers->prefill ? BUFFER_PREFILL : BUFFER_READY);
-        pthread_mutex_unlock(&buf->mutex);
+        /* Pass the finished block to the consumer */
+        buffers->in = 0;
+        head = (head + 1) % (buffers->count * 2);
+        atomic_store_explicit(&buffers->head, head, memory_order_release);
 
-        buffers->in = (buffers->in + 1) % buffers->count;
+        if(_buffer_used(buffers, head, atomic_load_explicit(&buffers->tail, memory_order_acquire)) == buffers->count)
+        {
+            atomic_store_explicit(&buffers->ready, 1, memory_order_release);
+        }
     }
 
     return(length);
@@ -254,7 +236,7 @@ static int _rx_callback(hackrf_transfer *transfer)
 
     while(l > 0)
     {
-        r = _buffer_write_ptr(&rf->buffers, &dst);
+        r = _buffer_write_ptr(&rf->buffers, &dst, 0);
         if(r == 0)
         {
             fprintf(stderr, "O");
@@ -273,23 +255,23 @@ static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 {
     hackrf_t *rf = private;
     int8_t *iq8 = NULL;
-    int i, r;
+    size_t r;
 
     samples *= 2;
 
+    /* Narrow straight into the ring, a block at a time. The USB
+     * callback then only has to copy whole blocks out */
     while(samples > 0)
     {
-        r = _buffer_write_ptr(&rf->buffers, &iq8);
+        r = _buffer_write_ptr(&rf->buffers, &iq8, 1);
+        if(r > samples) r = samples;
 
-        for(i = 0; i < r && i < samples; i++)
-        {
-            iq8[i] = iq_data[i] >> 8;
-        }
+        rf_convert(iq8, iq_data, r / 2, RF_INT8, 1);
 
-        _buffer_write(&rf->buffers, i);
+        _buffer_write(&rf->buffers, r);
 
-        iq_data += i;
-        samples -= i;
+        iq_data += r;
+        samples -= r;
     }
 
     return(RF_OK);
@@ -319,6 +301,23 @@ static int _rf_read(void *private, int16_t *iq_data, size_t samples)
     return (total_read / 2);  // Return the number of I/Q samples read
 }
 
+static int _rf_fill(void *private, size_t *samples, size_t *capacity)
+{
+    hackrf_t *rf = private;
+    buffers_t *buffers = &rf->buffers;
+    size_t used;
+
+    /* Approximate, the other side may be part way through a block */
+    used = _buffer_used(buffers,
+        atomic_load_explicit(&buffers->head, memory_order_relaxed),
+        atomic_load_explicit(&buffers->tail, memory_order_relaxed));
+
+    if(samples) *samples = used * buffers->length / 2;
+    if(capacity) *capacity = buffers->count * buffers->length / 2;
+
+    return(RF_OK);
+}
+
 static int _rf_close(void *private)
 {
     hackrf_t *rf = private;
@@ -368,11 +367,15 @@ int rf_hackrf_open(
     const char *serial,
     uint32_t sample_rate,
     uint64_t frequency_hz,
-    unsigned char amp_enable)
+    unsigned char amp_enable,
+    unsigned int latency_ms,
+    unsigned int buffer_count,
+    size_t buffer_length)
 {
     hackrf_t *rf;
     int r;
     uint8_t rev;    
+    uint64_t bytes;
 
     rf = calloc(1, sizeof(hackrf_t));
     if(!rf)
@@ -451,10 +454,36 @@ int rf_hackrf_open(
         return(RF_ERROR);
     }
 
-    /* Allocate memory for the output buffers, enough for at least 400ms - minimum 4 */
-    r = sample_rate * 2 * 4 / 10 / TRANSFER_BUFFER_SIZE;
-    if(r < 4) r = 4;
-    _buffer_init(&rf->buffers, r, TRANSFER_BUFFER_SIZE);   
+    /* Size the ring, either as count x length or enough
+     * blocks to cover the latency target. Blocks are a whole
+     * number of IQ pairs, the ring at least two transfers */
+    if(latency_ms == 0) latency_ms = DEFAULT_LATENCY;
+    if(buffer_length == 0) buffer_length = TRANSFER_BUFFER_SIZE;
+    buffer_length &= ~(size_t) 1;
+    if(buffer_length < 512) buffer_length = 512;
+
+    bytes = (uint64_t) sample_rate * 2 * latency_ms / 1000;
+    r = buffer_count > 0 ? buffer_count : (bytes + buffer_length - 1) / buffer_length;
+
+    while(r < 2 || (uint64_t) r * buffer_length < TRANSFER_BUFFER_SIZE * 2)
+    {
+        r++;
+    }
+
+    if(_buffer_init(&rf->buffers, r, buffer_length) != 0)
+    {
+        fprintf(stderr, "Failed to allocate the output buffers\n");
+        free(rf);
+        return(RF_OUT_OF_MEMORY);
+    }
+
+    /* Playback starts once the whole ring has filled. libhackrf
+     * holds a few more transfers of its own on top of this */
+    bytes = (uint64_t) r * buffer_length;
+    fprintf(stderr, "hackrf: Buffering %d x %u bytes, %.0f ms (%.0f ms including USB transfers)\n",
+        r, (unsigned int) buffer_length,
+        bytes * 1000.0 / 2 / sample_rate,
+        (bytes + TRANSFER_COUNT * TRANSFER_BUFFER_SIZE) * 1000.0 / 2 / sample_rate);
 
     if(rf->mode == RX_MODE)
     {
@@ -517,5 +546,6 @@ int rf_hackrf_open(
     s->write = _rf_write;
     s->read = _rf_read;
     s->close = _rf_close;
+    s->fill = _rf_fill;
     return(RF_OK);
 }
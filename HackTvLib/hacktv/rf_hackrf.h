@@ -24,7 +24,10 @@ extern int rf_hackrf_open(
     const char *serial,
     uint32_t sample_rate,
     uint64_t frequency_hz,
-    unsigned char amp_enable);
+    unsigned char amp_enable,
+    unsigned int latency_ms,
+    unsigned int buffer_count,
+    size_t buffer_length);
 
 #endif
 
@@ -0,0 +1,227 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 hacktv contributors                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rf.h"
+
+/* Samples are copied into a ring of blocks, which a thread hands to
+ * the consumer's callback. The writer only waits when every block is
+ * still waiting for the consumer */
+#define _BLOCKS  8
+#define _SAMPLES 65536
+
+/* Loopback sink */
+typedef struct {
+	rf_loopback_callback_t callback;
+	void *user;
+	
+	/* The blocks, and the samples in each */
+	int16_t *data;
+	size_t length[_BLOCKS];
+	
+	/* The block being filled, and how far */
+	int in;
+	size_t fill;
+	
+	/* The next block for the consumer, and the number queued */
+	int out;
+	int queued;
+	
+	/* Consumer thread */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int closing;
+	
+} loopback_t;
+
+static void *_rf_loopback_thread(void *arg)
+{
+	loopback_t *rf = arg;
+	int i;
+	
+	pthread_mutex_lock(&rf->mutex);
+	
+	while(1)
+	{
+		while(rf->queued == 0 && !rf->closing)
+		{
+			pthread_cond_wait(&rf->cond, &rf->mutex);
+		}
+		
+		if(rf->queued == 0)
+		{
+			/* Closing, and everything has been passed on */
+			break;
+		}
+		
+		i = rf->out;
+		
+		/* Call out without holding the lock */
+		pthread_mutex_unlock(&rf->mutex);
+		
+		if(rf->callback)
+		{
+			rf->callback(rf->user, rf->data + (size_t) i * _SAMPLES * 2, rf->length[i]);
+		}
+		
+		pthread_mutex_lock(&rf->mutex);
+		
+		rf->out = (rf->out + 1) % _BLOCKS;
+		rf->queued--;
+		pthread_cond_broadcast(&rf->cond);
+	}
+	
+	pthread_mutex_unlock(&rf->mutex);
+	
+	return(NULL);
+}
+
+static void _rf_loopback_queue(loopback_t *rf)
+{
+	/* Pass the current block to the consumer, and wait
+	 * until the next one is free */
+	pthread_mutex_lock(&rf->mutex);
+	
+	rf->length[rf->in] = rf->fill;
+	rf->queued++;
+	pthread_cond_broadcast(&rf->cond);
+	
+	while(rf->queued == _BLOCKS)
+	{
+		pthread_cond_wait(&rf->cond, &rf->mutex);
+	}
+	
+	pthread_mutex_unlock(&rf->mutex);
+	
+	rf->in = (rf->in + 1) % _BLOCKS;
+	rf->fill = 0;
+}
+
+static int _rf_loopback_write(void *private, int16_t *iq_data, size_t samples)
+{
+	loopback_t *rf = private;
+	size_t n;
+	
+	while(samples)
+	{
+		n = _SAMPLES - rf->fill;
+		if(n > samples) n = samples;
+		
+		memcpy(rf->data + ((size_t) rf->in * _SAMPLES + rf->fill) * 2, iq_data, n * 2 * sizeof(int16_t));
+		
+		rf->fill += n;
+		iq_data += n * 2;
+		samples -= n;
+		
+		if(rf->fill == _SAMPLES)
+		{
+			_rf_loopback_queue(rf);
+		}
+	}
+	
+	return(RF_OK);
+}
+
+static int _rf_loopback_fill(void *private, size_t *samples, size_t *capacity)
+{
+	loopback_t *rf = private;
+	
+	pthread_mutex_lock(&rf->mutex);
+	if(samples) *samples = (size_t) rf->queued * _SAMPLES + rf->fill;
+	pthread_mutex_unlock(&rf->mutex);
+	
+	if(capacity) *capacity = (size_t) _BLOCKS * _SAMPLES;
+	
+	return(RF_OK);
+}
+
+static int _rf_loopback_close(void *private)
+{
+	loopback_t *rf = private;
+	
+	/* Queue any partial block, then let the consumer finish */
+	pthread_mutex_lock(&rf->mutex);
+	
+	if(rf->fill > 0)
+	{
+		rf->length[rf->in] = rf->fill;
+		rf->queued++;
+	}
+	
+	rf->closing = 1;
+	pthread_cond_broadcast(&rf->cond);
+	pthread_mutex_unlock(&rf->mutex);
+	
+	pthread_join(rf->thread, NULL);
+	pthread_cond_destroy(&rf->cond);
+	pthread_mutex_destroy(&rf->mutex);
+	
+	free(rf->data);
+	free(rf);
+	
+	return(RF_OK);
+}
+
+int rf_loopback_open(rf_t *s, rf_loopback_callback_t callback, void *user)
+{
+	loopback_t *rf = calloc(1, sizeof(loopback_t));
+	
+	if(!rf)
+	{
+		perror("calloc");
+		return(RF_ERROR);
+	}
+	
+	rf->callback = callback;
+	rf->user = user;
+	
+	rf->data = malloc(sizeof(int16_t) * 2 * _SAMPLES * _BLOCKS);
+	if(!rf->data)
+	{
+		perror("malloc");
+		free(rf);
+		return(RF_ERROR);
+	}
+	
+	/* Start the consumer */
+	pthread_mutex_init(&rf->mutex, NULL);
+	pthread_cond_init(&rf->cond, NULL);
+	
+	if(pthread_create(&rf->thread, NULL, &_rf_loopback_thread, rf) != 0)
+	{
+		perror("pthread_create");
+		pthread_cond_destroy(&rf->cond);
+		pthread_mutex_destroy(&rf->mutex);
+		free(rf->data);
+		free(rf);
+		return(RF_ERROR);
+	}
+	
+	/* Register the callback functions */
+	s->ctx = rf;
+	s->write = _rf_loopback_write;
+	s->close = _rf_loopback_close;
+	s->fill = _rf_loopback_fill;
+	
+	return(RF_OK);
+}
+
@@ -0,0 +1,27 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 hacktv contributors                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _LOOPBACK_H
+#define _LOOPBACK_H
+
+/* Called from the loopback thread with each block of IQ */
+typedef void (*rf_loopback_callback_t)(void *user, const int16_t *iq_data, size_t samples);
+
+extern int rf_loopback_open(rf_t *s, rf_loopback_callback_t callback, void *user);
+
+#endif
+
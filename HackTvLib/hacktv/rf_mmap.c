@@ -0,0 +1,707 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 hacktv contributors                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* For fallocate() */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
+#include "rf.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* The file is grown and mapped this much at a time. It's a multiple
+ * of every sample size, the page size and the Windows allocation
+ * granularity, so samples never straddle two mappings */
+#define _CHUNK (64 << 20)
+
+/* Memory-mapped file sink or source */
+typedef struct {
+	int fd;
+	size_t data_size;
+	int complex;
+	int type;
+	
+	/* The current mapping, its offset in the file, and the bytes used */
+	uint8_t *map;
+	size_t map_length;
+	uint64_t offset;
+	size_t fill;
+	
+#ifdef _WIN32
+	HANDLE mapping;
+#endif
+	
+	/* Source only. The usable length of the file, and the pacing */
+	uint64_t length;
+	int realtime;
+	unsigned int sample_rate;
+	struct timespec start;
+	uint64_t position;
+	
+} rf_mmap_t;
+
+static const char *_sigmf_datatype(int type, int complex)
+{
+	static char s[16];
+	const char *t;
+	
+	switch(type)
+	{
+	case RF_UINT8:  t = "u8";  break;
+	case RF_INT8:   t = "i8";  break;
+	case RF_UINT16: t = "u16"; break;
+	case RF_INT16:  t = "i16"; break;
+	case RF_INT32:  t = "i32"; break;
+	case RF_FLOAT:  t = "f32"; break;
+	default: return(NULL);
+	}
+	
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	snprintf(s, sizeof(s), "%c%s%s", complex ? 'c' : 'r', t, t[1] == '8' ? "" : "_be");
+#else
+	snprintf(s, sizeof(s), "%c%s%s", complex ? 'c' : 'r', t, t[1] == '8' ? "" : "_le");
+#endif
+	
+	return(s);
+}
+
+static char *_sigmf_meta_name(const char *filename)
+{
+	size_t l = strlen(filename);
+	char *meta;
+	
+	meta = malloc(l + 16);
+	if(!meta)
+	{
+		perror("malloc");
+		return(NULL);
+	}
+	
+	/* foo.sigmf-data gets foo.sigmf-meta, anything else gets the suffix added */
+	strcpy(meta, filename);
+	
+	if(l >= 11 && strcmp(&meta[l - 11], ".sigmf-data") == 0)
+	{
+		l -= 11;
+	}
+	
+	strcpy(&meta[l], ".sigmf-meta");
+	
+	return(meta);
+}
+
+static int _sigmf_write(const char *filename, int type, int complex, unsigned int sample_rate, uint64_t frequency, const char *mode)
+{
+	char *meta, date[32];
+	time_t now = time(NULL);
+	FILE *f;
+	
+	meta = _sigmf_meta_name(filename);
+	if(!meta)
+	{
+		return(RF_ERROR);
+	}
+	
+	f = fopen(meta, "w");
+	if(!f)
+	{
+		perror(meta);
+		free(meta);
+		return(RF_ERROR);
+	}
+	
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+	
+	fprintf(f,
+		"{\n"
+		"    \"global\": {\n"
+		"        \"core:datatype\": \"%s\",\n"
+		"        \"core:sample_rate\": %u,\n"
+		"        \"core:version\": \"1.0.0\",\n"
+		"        \"core:recorder\": \"hacktv\",\n"
+		"        \"core:extensions\": [\n"
+		"            { \"name\": \"hacktv\", \"version\": \"1.0.0\", \"optional\": true }\n"
+		"        ],\n"
+		"        \"hacktv:mode\": \"%s\"\n"
+		"    },\n"
+		"    \"captures\": [\n"
+		"        {\n"
+		"            \"core:sample_start\": 0,\n",
+		_sigmf_datatype(type, complex),
+		sample_rate,
+		mode ? mode : ""
+	);
+	
+	if(frequency)
+	{
+		fprintf(f, "            \"core:frequency\": %llu,\n", (unsigned long long) frequency);
+	}
+	
+	fprintf(f,
+		"            \"core:datetime\": \"%s\"\n"
+		"        }\n"
+		"    ],\n"
+		"    \"annotations\": []\n"
+		"}\n",
+		date
+	);
+	
+	if(fclose(f) != 0)
+	{
+		perror(meta);
+		free(meta);
+		return(RF_ERROR);
+	}
+	
+	free(meta);
+	
+	return(RF_OK);
+}
+
+static int _sigmf_read(const char *filename, int *type, int *complex, unsigned int *sample_rate)
+{
+	char *meta, *buf, *p, *e;
+	size_t l;
+	FILE *f;
+	int t, c;
+	
+	meta = _sigmf_meta_name(filename);
+	if(!meta)
+	{
+		return(RF_ERROR);
+	}
+	
+	/* No sidecar, keep the defaults */
+	f = fopen(meta, "rb");
+	free(meta);
+	
+	if(!f)
+	{
+		return(RF_OK);
+	}
+	
+	/* The metadata is small, just read it all. A full JSON parser
+	 * isn't needed for the two fields we use */
+	buf = malloc(65536);
+	if(!buf)
+	{
+		perror("malloc");
+		fclose(f);
+		return(RF_ERROR);
+	}
+	
+	l = fread(buf, 1, 65535, f);
+	buf[l] = '\0';
+	fclose(f);
+	
+	p = strstr(buf, "\"core:datatype\"");
+	if(p && (p = strchr(p + 15, ':')) && (p = strchr(p, '"')) && (e = strchr(++p, '"')))
+	{
+		*e = '\0';
+		
+		for(t = RF_UINT8; t <= RF_FLOAT; t++)
+		{
+			for(c = 0; c < 2; c++)
+			{
+				if(strcmp(p, _sigmf_datatype(t, c)) == 0) break;
+			}
+			
+			if(c < 2) break;
+		}
+		
+		if(t > RF_FLOAT)
+		{
+			fprintf(stderr, "Unsupported SigMF datatype '%s'\n", p);
+			free(buf);
+			return(RF_ERROR);
+		}
+		
+		*type = t;
+		*complex = c;
+		*e = '"';
+	}
+	
+	p = strstr(buf, "\"core:sample_rate\"");
+	if(p && (p = strchr(p + 18, ':')))
+	{
+		*sample_rate = (unsigned int) strtod(p + 1, NULL);
+	}
+	
+	free(buf);
+	
+	return(RF_OK);
+}
+
+static int _rf_mmap_map(rf_mmap_t *rf, uint64_t offset)
+{
+	uint64_t end = offset + _CHUNK;
+	
+#ifdef _WIN32
+	/* Creating a mapping larger than the file grows it */
+	rf->mapping = CreateFileMapping((HANDLE) _get_osfhandle(rf->fd), NULL, PAGE_READWRITE, (DWORD) (end >> 32), (DWORD) end, NULL);
+	if(rf->mapping == NULL)
+	{
+		fprintf(stderr, "CreateFileMapping failed (%lu)\n", (unsigned long) GetLastError());
+		return(RF_ERROR);
+	}
+	
+	rf->map = MapViewOfFile(rf->mapping, FILE_MAP_WRITE, (DWORD) (offset >> 32), (DWORD) offset, _CHUNK);
+	if(rf->map == NULL)
+	{
+		fprintf(stderr, "MapViewOfFile failed (%lu)\n", (unsigned long) GetLastError());
+		CloseHandle(rf->mapping);
+		return(RF_ERROR);
+	}
+#else
+	/* Reserve the disk space up front where possible, so running out
+	 * shows up here rather than as a SIGBUS when writing the mapping */
+#ifdef __linux__
+	if(fallocate(rf->fd, 0, offset, _CHUNK) != 0)
+	{
+		if(errno != EOPNOTSUPP && errno != ENOSYS)
+		{
+			perror("fallocate");
+			return(RF_ERROR);
+		}
+		
+		if(ftruncate(rf->fd, end) != 0)
+		{
+			perror("ftruncate");
+			return(RF_ERROR);
+		}
+	}
+#else
+	if(ftruncate(rf->fd, end) != 0)
+	{
+		perror("ftruncate");
+		return(RF_ERROR);
+	}
+#endif
+	
+	rf->map = mmap(NULL, _CHUNK, PROT_READ | PROT_WRITE, MAP_SHARED, rf->fd, offset);
+	if(rf->map == MAP_FAILED)
+	{
+		perror("mmap");
+		rf->map = NULL;
+		return(RF_ERROR);
+	}
+	
+#ifdef MADV_SEQUENTIAL
+	madvise(rf->map, _CHUNK, MADV_SEQUENTIAL);
+#endif
+#endif
+	
+	/* Only move on once the new chunk is mapped, so a failure
+	 * leaves offset + fill at the end of the written data */
+	rf->offset = offset;
+	rf->map_length = _CHUNK;
+	rf->fill = 0;
+	
+	return(RF_OK);
+}
+
+static void _rf_mmap_unmap(rf_mmap_t *rf)
+{
+	if(rf->map == NULL)
+	{
+		return;
+	}
+	
+#ifdef _WIN32
+	UnmapViewOfFile(rf->map);
+	CloseHandle(rf->mapping);
+#else
+	/* Pages are written back by the kernel, no need to wait here */
+	munmap(rf->map, rf->map_length);
+#endif
+	
+	rf->map = NULL;
+}
+
+static int _rf_mmap_write(void *private, int16_t *iq_data, size_t samples)
+{
+	rf_mmap_t *rf = private;
+	size_t n;
+	
+	while(samples)
+	{
+		if(rf->fill == _CHUNK)
+		{
+			/* This chunk is full, move on to the next */
+			_rf_mmap_unmap(rf);
+			
+			if(_rf_mmap_map(rf, rf->offset + _CHUNK) != RF_OK)
+			{
+				return(RF_ERROR);
+			}
+		}
+		
+		n = (_CHUNK - rf->fill) / rf->data_size;
+		if(n > samples) n = samples;
+		
+		rf_convert(rf->map + rf->fill, iq_data, n, rf->type, rf->complex);
+		
+		rf->fill += n * rf->data_size;
+		iq_data += n * 2;
+		samples -= n;
+	}
+	
+	return(RF_OK);
+}
+
+static int _rf_mmap_close(void *private)
+{
+	rf_mmap_t *rf = private;
+	uint64_t length = rf->offset + rf->fill;
+	int r = RF_OK;
+	
+	_rf_mmap_unmap(rf);
+	
+	/* Trim the unused end of the last chunk */
+#ifdef _WIN32
+	if(_chsize_s(rf->fd, length) != 0)
+#else
+	if(ftruncate(rf->fd, length) != 0)
+#endif
+	{
+		perror("ftruncate");
+		r = RF_ERROR;
+	}
+	
+	if(close(rf->fd) != 0)
+	{
+		perror("close");
+		r = RF_ERROR;
+	}
+	
+	free(rf);
+	
+	return(r);
+}
+
+int rf_mmap_open(rf_t *s, const char *filename, int type, int complex, unsigned int sample_rate, uint64_t frequency, const char *mode)
+{
+	rf_mmap_t *rf;
+	
+	if(filename == NULL || strcmp(filename, "-") == 0)
+	{
+		fprintf(stderr, "The mmap output needs a filename.\n");
+		return(RF_ERROR);
+	}
+	
+	if(_sigmf_datatype(type, complex) == NULL)
+	{
+		fprintf(stderr, "%s: Unrecognised data type %d\n", __func__, type);
+		return(RF_ERROR);
+	}
+	
+	rf = calloc(1, sizeof(rf_mmap_t));
+	if(!rf)
+	{
+		perror("calloc");
+		return(RF_ERROR);
+	}
+	
+	rf->complex = complex != 0;
+	rf->type = type;
+	
+	/* Find the size of the output data type */
+	switch(type)
+	{
+	case RF_UINT8:  rf->data_size = sizeof(uint8_t);  break;
+	case RF_INT8:   rf->data_size = sizeof(int8_t);   break;
+	case RF_UINT16: rf->data_size = sizeof(uint16_t); break;
+	case RF_INT16:  rf->data_size = sizeof(int16_t);  break;
+	case RF_INT32:  rf->data_size = sizeof(int32_t);  break;
+	case RF_FLOAT:  rf->data_size = sizeof(float);    break;
+	}
+	
+	/* Double the size for complex types */
+	if(rf->complex) rf->data_size *= 2;
+	
+	/* The mapping needs read access, even if we only write to it */
+	rf->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0666);
+	if(rf->fd < 0)
+	{
+		perror("open");
+		free(rf);
+		return(RF_ERROR);
+	}
+	
+	if(_rf_mmap_map(rf, 0) != RF_OK)
+	{
+		close(rf->fd);
+		free(rf);
+		return(RF_ERROR);
+	}
+	
+	if(_sigmf_write(filename, type, complex, sample_rate, frequency, mode) != RF_OK)
+	{
+		_rf_mmap_close(rf);
+		return(RF_ERROR);
+	}
+	
+	/* Register the callback functions */
+	s->ctx = rf;
+	s->write = _rf_mmap_write;
+	s->close = _rf_mmap_close;
+	
+	return(RF_OK);
+}
+
+static int _rf_mmap_map_source(rf_mmap_t *rf)
+{
+	uint64_t left = rf->length - rf->offset;
+	
+	rf->map_length = left < _CHUNK ? left : _CHUNK;
+	
+#ifdef _WIN32
+	rf->mapping = CreateFileMapping((HANDLE) _get_osfhandle(rf->fd), NULL, PAGE_READONLY, 0, 0, NULL);
+	if(rf->mapping == NULL)
+	{
+		fprintf(stderr, "CreateFileMapping failed (%lu)\n", (unsigned long) GetLastError());
+		return(RF_ERROR);
+	}
+	
+	rf->map = MapViewOfFile(rf->mapping, FILE_MAP_READ, (DWORD) (rf->offset >> 32), (DWORD) rf->offset, rf->map_length);
+	if(rf->map == NULL)
+	{
+		fprintf(stderr, "MapViewOfFile failed (%lu)\n", (unsigned long) GetLastError());
+		CloseHandle(rf->mapping);
+		return(RF_ERROR);
+	}
+#else
+	rf->map = mmap(NULL, rf->map_length, PROT_READ, MAP_SHARED, rf->fd, rf->offset);
+	if(rf->map == MAP_FAILED)
+	{
+		perror("mmap");
+		rf->map = NULL;
+		return(RF_ERROR);
+	}
+	
+#ifdef MADV_SEQUENTIAL
+	madvise(rf->map, rf->map_length, MADV_SEQUENTIAL);
+#endif
+#endif
+	
+	rf->fill = 0;
+	
+	return(RF_OK);
+}
+
+static void _rf_mmap_pace(rf_mmap_t *rf)
+{
+	struct timespec t;
+	uint64_t ns;
+	
+	/* Wait until the last sample read would have arrived from a
+	 * radio. Deadlines are measured from the first read, so the
+	 * time spent by the caller doesn't add up as drift */
+	ns = rf->position % rf->sample_rate * 1000000000ULL / rf->sample_rate;
+	t.tv_sec = rf->start.tv_sec + rf->position / rf->sample_rate;
+	t.tv_nsec = rf->start.tv_nsec + ns;
+	
+	if(t.tv_nsec >= 1000000000L)
+	{
+		t.tv_sec++;
+		t.tv_nsec -= 1000000000L;
+	}
+	
+#ifdef TIMER_ABSTIME
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) == EINTR);
+#else
+	{
+		struct timespec now;
+		int64_t d;
+		
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		d = (int64_t) (t.tv_sec - now.tv_sec) * 1000000000LL + (t.tv_nsec - now.tv_nsec);
+		
+		if(d > 0)
+		{
+			now.tv_sec = d / 1000000000LL;
+			now.tv_nsec = d % 1000000000LL;
+			nanosleep(&now, NULL);
+		}
+	}
+#endif
+}
+
+static int _rf_mmap_read(void *private, int16_t *iq_data, size_t samples)
+{
+	rf_mmap_t *rf = private;
+	size_t n, total = 0;
+	
+	if(rf->position == 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &rf->start);
+	}
+	
+	while(samples)
+	{
+		if(rf->fill == rf->map_length)
+		{
+			/* The end of the recording */
+			if(rf->offset + rf->map_length == rf->length) break;
+			
+			_rf_mmap_unmap(rf);
+			rf->offset += _CHUNK;
+			
+			if(_rf_mmap_map_source(rf) != RF_OK)
+			{
+				return(RF_ERROR);
+			}
+		}
+		
+		n = (rf->map_length - rf->fill) / rf->data_size;
+		if(n > samples) n = samples;
+		
+		rf_convert_to_int16(iq_data, rf->map + rf->fill, n, rf->type, rf->complex);
+		
+		rf->fill += n * rf->data_size;
+		iq_data += n * 2;
+		samples -= n;
+		total += n;
+	}
+	
+	rf->position += total;
+	
+	if(rf->realtime && total > 0)
+	{
+		_rf_mmap_pace(rf);
+	}
+	
+	return(total);
+}
+
+static int _rf_mmap_close_source(void *private)
+{
+	rf_mmap_t *rf = private;
+	
+	_rf_mmap_unmap(rf);
+	close(rf->fd);
+	free(rf);
+	
+	return(RF_OK);
+}
+
+int rf_mmap_open_source(rf_t *s, const char *filename, int type, int complex, unsigned int sample_rate, int realtime)
+{
+	rf_mmap_t *rf;
+	struct stat st;
+	
+	if(filename == NULL || strcmp(filename, "-") == 0)
+	{
+		fprintf(stderr, "The file source needs a filename.\n");
+		return(RF_ERROR);
+	}
+	
+	/* A SigMF sidecar overrides the type and sample rate */
+	if(_sigmf_read(filename, &type, &complex, &sample_rate) != RF_OK)
+	{
+		return(RF_ERROR);
+	}
+	
+	if(_sigmf_datatype(type, complex) == NULL)
+	{
+		fprintf(stderr, "%s: Unrecognised data type %d\n", __func__, type);
+		return(RF_ERROR);
+	}
+	
+	if(realtime && sample_rate == 0)
+	{
+		fprintf(stderr, "A sample rate is needed to replay '%s' in real time.\n", filename);
+		return(RF_ERROR);
+	}
+	
+	rf = calloc(1, sizeof(rf_mmap_t));
+	if(!rf)
+	{
+		perror("calloc");
+		return(RF_ERROR);
+	}
+	
+	rf->complex = complex != 0;
+	rf->type = type;
+	rf->realtime = realtime;
+	rf->sample_rate = sample_rate;
+	
+	/* Find the size of the input data type */
+	switch(type)
+	{
+	case RF_UINT8:  rf->data_size = sizeof(uint8_t);  break;
+	case RF_INT8:   rf->data_size = sizeof(int8_t);   break;
+	case RF_UINT16: rf->data_size = sizeof(uint16_t); break;
+	case RF_INT16:  rf->data_size = sizeof(int16_t);  break;
+	case RF_INT32:  rf->data_size = sizeof(int32_t);  break;
+	case RF_FLOAT:  rf->data_size = sizeof(float);    break;
+	}
+	
+	/* Double the size for complex types */
+	if(rf->complex) rf->data_size *= 2;
+	
+	rf->fd = open(filename, O_RDONLY | O_BINARY);
+	if(rf->fd < 0 || fstat(rf->fd, &st) != 0)
+	{
+		perror(filename);
+		if(rf->fd >= 0) close(rf->fd);
+		free(rf);
+		return(RF_ERROR);
+	}
+	
+	/* A partial sample at the end is ignored */
+	rf->length = (uint64_t) st.st_size - (uint64_t) st.st_size % rf->data_size;
+	
+	if(rf->length == 0)
+	{
+		fprintf(stderr, "'%s' holds no samples.\n", filename);
+		close(rf->fd);
+		free(rf);
+		return(RF_ERROR);
+	}
+	
+	if(_rf_mmap_map_source(rf) != RF_OK)
+	{
+		close(rf->fd);
+		free(rf);
+		return(RF_ERROR);
+	}
+	
+	/* Register the callback functions */
+	s->ctx = rf;
+	s->read = _rf_mmap_read;
+	s->close = _rf_mmap_close_source;
+	
+	return(RF_OK);
+}
+
@@ -0,0 +1,25 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 hacktv contributors                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _MMAP_H
+#define _MMAP_H
+
+extern int rf_mmap_open(rf_t *s, const char *filename, int type, int complex, unsigned int sample_rate, uint64_t frequency, const char *mode);
+extern int rf_mmap_open_source(rf_t *s, const char *filename, int type, int complex, unsigned int sample_rate, int realtime);
+
+#endif
+
@@ -0,0 +1,95 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2026 hacktv contributors                                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include "rf.h"
+
+/* Null sink. Samples are only counted, to measure how fast the
+ * rest of hacktv can produce them */
+typedef struct {
+	unsigned int sample_rate;
+	uint64_t samples;
+	struct timespec start;
+	
+} null_t;
+
+static int _rf_null_write(void *private, int16_t *iq_data, size_t samples)
+{
+	null_t *rf = private;
+	
+	(void) iq_data;
+	
+	/* Time from the first samples, not from when the sink was opened */
+	if(rf->samples == 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &rf->start);
+	}
+	
+	rf->samples += samples;
+	
+	return(RF_OK);
+}
+
+static int _rf_null_close(void *private)
+{
+	null_t *rf = private;
+	struct timespec end;
+	double elapsed, rate;
+	
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	
+	elapsed = (end.tv_sec - rf->start.tv_sec) + (end.tv_nsec - rf->start.tv_nsec) * 1e-9;
+	rate = elapsed > 0 ? rf->samples / elapsed : 0;
+	
+	if(rf->samples > 0)
+	{
+		fprintf(stderr, "Null output: %llu samples in %.3f s, %.3f MS/s, %.2fx real time\n",
+			(unsigned long long) rf->samples,
+			elapsed,
+			rate / 1e6,
+			rf->sample_rate > 0 ? rate / rf->sample_rate : 0
+		);
+	}
+	
+	free(rf);
+	
+	return(RF_OK);
+}
+
+int rf_null_open(rf_t *s, unsigned int sample_rate)
+{
+	null_t *rf = calloc(1, sizeof(null_t));
+	
+	if(!rf)
+	{
+		perror("calloc");
+		return(RF_ERROR);
+	}
+	
+	rf->sample_rate = sample_rate;
+	
+	/* Register the callback functions */
+	s->ctx = rf;
+	s->write = _rf_null_write;
+	s->close = _rf_null_close;
+	
+	return(RF_OK);
+}
+
@@ -24,43 +24,93 @@
 #include <SoapySDR/Version.h>
 #include "rf.h"
 
+/* Samples per write when the driver doesn't give an MTU */
 #define BUF_LEN 4096
 
+/* Stream formats we can convert to directly */
+enum {
+	_CS16,
+	_CS8,
+	_CS12,
+	_CF32,
+};
+
+static const struct {
+	const char *name;
+	size_t size;
+} _formats[] = {
+	{ SOAPY_SDR_CS16, 4 },
+	{ SOAPY_SDR_CS8,  2 },
+	{ SOAPY_SDR_CS12, 3 },
+	{ SOAPY_SDR_CF32, 8 },
+};
+
 typedef struct {
 	
 	/* SoapySDR device and stream */
 	SoapySDRDevice *d;
 	SoapySDRStream *s;
 	
+	/* Stream format, and the samples per write */
+	int format;
+	size_t mtu;
+	
 	int scale;
-	int16_t txbuf[BUF_LEN * 2];
+	void *txbuf;
 	
 } soapysdr_t;
 
+static void _pack_cs12(uint8_t *dst, const int16_t *iq_data, size_t samples, int scale)
+{
+	int16_t v[512];
+	uint16_t a, b;
+	size_t i, l;
+	
+	/* Scale to 12 bits, then pack each pair into three bytes */
+	while(samples > 0)
+	{
+		l = samples > 256 ? 256 : samples;
+		rf_convert_int16_scaled(v, iq_data, l, scale);
+		
+		for(i = 0; i < l; i++, dst += 3)
+		{
+			a = v[i * 2 + 0];
+			b = v[i * 2 + 1];
+			
+			dst[0] = a;
+			dst[1] = ((a >> 8) & 0x0F) | (b << 4);
+			dst[2] = b >> 4;
+		}
+		
+		iq_data += l * 2;
+		samples -= l;
+	}
+}
+
 static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 {
 	soapysdr_t *rf = private;
 	const void *buffs[1];
 	int flags = 0;
-	int l;
+	size_t l;
 	int r;
 	
 	while(samples > 0)
 	{
-		if(rf->scale)
-		{
-			buffs[0] = rf->txbuf;
-			l = (samples > BUF_LEN ? BUF_LEN : samples);
-			
-			for(r = 0; r < 2 * l; r++)
-			{
-				rf->txbuf[r] = iq_data[r] * rf->scale / INT16_MAX;
-			}
-		}
-		else
+		/* Never ask the driver for more than its MTU */
+		l = (samples > rf->mtu ? rf->mtu : samples);
+		buffs[0] = rf->txbuf;
+		
+		switch(rf->format)
 		{
-			buffs[0] = iq_data;
-			l = samples;
+		case _CS16:
+			if(rf->scale) rf_convert_int16_scaled(rf->txbuf, iq_data, l, rf->scale);
+			else buffs[0] = iq_data;
+			break;
+		
+		case _CS8:  rf_convert(rf->txbuf, iq_data, l, RF_INT8, 1); break;
+		case _CS12: _pack_cs12(rf->txbuf, iq_data, l, rf->scale); break;
+		case _CF32: rf_convert(rf->txbuf, iq_data, l, RF_FLOAT, 1); break;
 		}
 		
 		samples -= l;
@@ -76,7 +126,7 @@ static int _rf_write(void *private, int16_t *iq_data, size_t samples)
 			}
 			
 			l -= r;
-			buffs[0] = (int16_t *) buffs[0] + r * 2;
+			buffs[0] = (const uint8_t *) buffs[0] + r * _formats[rf->format].size;
 		}
 	}
 	
@@ -92,16 +142,81 @@ static int _rf_close(void *private)
 	
 	SoapySDRDevice_unmake(rf->d);
 	
+	free(rf->txbuf);
+	free(rf);
+	
 	return(RF_OK);
 }
 
+static int _select_format(soapysdr_t *rf)
+{
+	char *sn, **formats;
+	double fullscale;
+	size_t i, n;
+	int f, listed;
+	
+	/* Use the device's native format if we can produce it, as
+	 * the driver then has nothing to convert. Anything else
+	 * goes out as CS16 */
+	sn = SoapySDRDevice_getNativeStreamFormat(rf->d, SOAPY_SDR_TX, 0, &fullscale);
+	formats = SoapySDRDevice_getStreamFormats(rf->d, SOAPY_SDR_TX, 0, &n);
+	
+	for(f = _CF32; f > _CS16; f--)
+	{
+		if(sn == NULL || strcmp(sn, _formats[f].name) != 0) continue;
+		
+		/* Some drivers don't list their formats */
+		for(listed = n == 0, i = 0; i < n; i++)
+		{
+			if(strcmp(formats[i], sn) == 0) listed = 1;
+		}
+		
+		if(listed) break;
+	}
+	
+#if defined(SOAPY_SDR_API_VERSION) && (SOAPY_SDR_API_VERSION >= 0x00080000)
+	SoapySDRStrings_clear(&formats, n);
+#else
+	for(i = 0; i < n; i++) free(formats[i]);
+	free(formats);
+#endif
+	
+	rf->format = f;
+	
+	/* See if we need to scale the output */
+	if(sn && (f == _CS12 || strcmp(sn, SOAPY_SDR_CS16) == 0))
+	{
+		rf->scale = fullscale;
+		
+		/* Always use an odd value (eg. 2048 gets adjusted to 2047) */
+		if((rf->scale & 1) == 0)
+		{
+			rf->scale--;
+		}
+		
+		/* No scaling necessary if the full scale is accepted */
+		if(f == _CS16 && (rf->scale < 0 || rf->scale >= INT16_MAX))
+		{
+			rf->scale = 0;
+		}
+		
+		/* CS12 is always scaled, assume the usual range if it's odd */
+		if(f == _CS12 && (rf->scale <= 0 || rf->scale > 2047))
+		{
+			rf->scale = 2047;
+		}
+	}
+	
+	free(sn);
+	
+	return(f);
+}
+
 int rf_soapysdr_open(rf_t *s, const char *device, unsigned int sample_rate, unsigned int frequency_hz, unsigned int gain, const char *antenna)
 {
 	soapysdr_t *rf;
 	SoapySDRKwargs *results;
 	size_t length;
-	char *sn;
-	double fullscale;
 	
 	rf = calloc(1, sizeof(soapysdr_t));
 	if(!rf)
@@ -171,30 +286,14 @@ int rf_soapysdr_open(rf_t *s, const char *device, unsigned int sample_rate, unsi
 		return(RF_ERROR);
 	}
 	
-	/* Query the native stream format, see if we need to scale the output */
-	sn = SoapySDRDevice_getNativeStreamFormat(rf->d, SOAPY_SDR_TX, 0, &fullscale);
-	if(sn && strcmp(sn, "CS16") == 0)
-	{
-		rf->scale = fullscale;
-		
-		/* Always use an odd value (eg. 2048 gets adjusted to 2047) */
-		if((rf->scale & 1) == 0)
-		{
-			rf->scale--;
-		}
-		
-		/* No scaling necessary if the full scale is accepted */
-		if(rf->scale < 0 || rf->scale >= INT16_MAX)
-		{
-			rf->scale = 0;
-		}
-	}
+	/* Pick the stream format */
+	_select_format(rf);
 	
 #if defined(SOAPY_SDR_API_VERSION) && (SOAPY_SDR_API_VERSION >= 0x00080000)
-	rf->s = SoapySDRDevice_setupStream(rf->d, SOAPY_SDR_TX, "CS16", NULL, 0, NULL);
+	rf->s = SoapySDRDevice_setupStream(rf->d, SOAPY_SDR_TX, _formats[rf->format].name, NULL, 0, NULL);
 	if(rf->s == NULL)
 #else
-	if(SoapySDRDevice_setupStream(rf->d, &rf->s, SOAPY_SDR_TX, SOAPY_SDR_CS16, NULL, 0, NULL) != 0)
+	if(SoapySDRDevice_setupStream(rf->d, &rf->s, SOAPY_SDR_TX, _formats[rf->format].name, NULL, 0, NULL) != 0)
 #endif
 	{
 		fprintf(stderr, "SoapySDRDevice_setupStream() failed: %s\n", SoapySDRDevice_lastError());
@@ -202,6 +301,23 @@ int rf_soapysdr_open(rf_t *s, const char *device, unsigned int sample_rate, unsi
 		return(RF_ERROR);
 	}
 	
+	/* Size writes to the driver's MTU */
+	rf->mtu = SoapySDRDevice_getStreamMTU(rf->d, rf->s);
+	if(rf->mtu == 0) rf->mtu = BUF_LEN;
+	
+	rf->txbuf = malloc(rf->mtu * _formats[rf->format].size);
+	if(!rf->txbuf)
+	{
+		SoapySDRDevice_closeStream(rf->d, rf->s);
+		SoapySDRDevice_unmake(rf->d);
+		free(rf);
+		return(RF_OUT_OF_MEMORY);
+	}
+	
+	fprintf(stderr, "soapysdr: Writing %s, %u samples at a time%s\n",
+		_formats[rf->format].name, (unsigned int) rf->mtu,
+		rf->scale ? ", scaled" : "");
+	
 	SoapySDRDevice_activateStream(rf->d, rf->s, 0, 0, 0);
 	
 	/* Register the callback functions */
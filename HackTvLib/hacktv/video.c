@@ -19,11 +19,17 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
 #include "video.h"
 #include "nicam728.h"
 #include "dance.h"
 #include "hacktv.h"
 #include "av.h"
+#include "common.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
 
 /* 
  * Video generation
@@ -2151,6 +2157,31 @@ typedef struct {
 	fir_int16_t fir;
 } _vid_filter_process_t;
 
+/* Audio carrier inputs, the channels of vid_line_t audio_in and audio */
+#define _AUDIO_MONO     0
+#define _AUDIO_LEFT     1
+#define _AUDIO_RIGHT    2
+#define _AUDIO_AM       3
+#define _AUDIO_CHANNELS 4
+
+/* Audio resampler. The 32 kHz carrier inputs are interpolated by
+ * _AUDIO_INTERP with a polyphase FIR, then linearly interpolated
+ * up to the sample rate */
+#define _AUDIO_INTERP 8
+#define _AUDIO_TAPS   (32 * _AUDIO_INTERP)
+#define _AUDIO_LAG    16
+
+typedef struct {
+	fir_int16_t fir[_AUDIO_CHANNELS];
+	
+	/* Interpolated samples waiting to be used, channels interleaved */
+	int16_t *fifo;
+	int fifo_len;
+	
+	/* Position between fifo[0] and fifo[1], in 1/sample_rate units */
+	int acc;
+} _vid_audio_resampler_t;
+
 /* Test taps for a CCIR-405 625 line video pre-emphasis filter at 28 MHz (5.0 MHz video) */
 const static double fm_625_28_taps[] = {
 	-0.000044,-0.000123,-0.000013, 0.000314, 0.000430,-0.000132,-0.000988,
@@ -2322,13 +2353,6 @@ static void _secam_g(double *g, double f)
 	g[1] = 0.115 * (lq - rq) / d;
 }
 
-static double _dlimit(double v, double min, double max)
-{
-	if(v < min) return(min);
-	if(v > max) return(max);
-	return(v);
-}
-
 static int16_t *_burstwin(unsigned int sample_rate, double width, double rise, double level, int *len)
 {
 	int16_t *win;
@@ -2394,25 +2418,6 @@ static int _init_fm_energy_dispersal(_mod_fm_t *fm, int sample_rate, rational_t
 	return(VID_OK);
 }
 
-static void inline _fm_modulator_add(_mod_fm_t *fm, int16_t *dst, int16_t sample)
-{
-	cint32_mul(&fm->phase, &fm->phase, &fm->lut[sample - INT16_MIN]);
-	
-	dst[0] += ((fm->phase.i >> 16) * fm->level) >> 15;
-	dst[1] += ((fm->phase.q >> 16) * fm->level) >> 15;
-	
-	/* Correct the amplitude after INT16_MAX samples */
-	if(--fm->counter == 0)
-	{
-		double ra = atan2(fm->phase.q, fm->phase.i);
-		
-		fm->phase.i = lround(cos(ra) * INT32_MAX);
-		fm->phase.q = lround(sin(ra) * INT32_MAX);
-		
-		fm->counter = INT16_MAX;
-	}
-}
-
 static void inline _fm_modulator_cgain(_mod_fm_t *fm, int16_t *dst, int16_t sample, const cint16_t *g)
 {
 	/* Only used by SECAM */
@@ -2477,42 +2482,366 @@ static void _free_fm_modulator(_mod_fm_t *fm)
 	free(fm->lut);
 }
 
-/* AM modulator */
-static int _init_am_modulator(_mod_am_t *am, int sample_rate, double frequency, double level)
+/* Block synthesiser for the audio carriers. Each carrier is a 32-bit phase
+ * accumulator indexing one cosine table shared by all of them, so there is
+ * no per-modulator table and no amplitude drift to correct. The table
+ * holds 2^_NCO_BITS entries, sine is read a quarter turn behind cosine.
+ * One spare entry at the end lets the AVX2 gathers read 32 bits from
+ * the last one */
+#define _NCO_BITS 14
+
+static int16_t *_init_nco_lut(void)
 {
-	double d;
+	int16_t *lut;
+	int i;
+	
+	lut = malloc(sizeof(int16_t) * ((1 << _NCO_BITS) + 1));
+	if(!lut)
+	{
+		return(NULL);
+	}
+	
+	for(i = 0; i < 1 << _NCO_BITS; i++)
+	{
+		lut[i] = lround(cos(2.0 * M_PI * i / (1 << _NCO_BITS)) * INT16_MAX);
+	}
+	
+	lut[i] = lut[0];
+	
+	return(lut);
+}
+
+static inline int16_t _nco_cos(const int16_t *lut, uint32_t phase)
+{
+	return(lut[(phase + (1 << (31 - _NCO_BITS))) >> (32 - _NCO_BITS)]);
+}
+
+static inline int16_t _nco_sin(const int16_t *lut, uint32_t phase)
+{
+	return(_nco_cos(lut, phase - 0x40000000));
+}
+
+static uint32_t _nco_delta(int sample_rate, double frequency)
+{
+	/* Negative frequencies wrap around to the top of the range */
+	return((uint32_t) llround(frequency / sample_rate * 4294967296.0));
+}
+
+static void _nco_loop_lock(_nco_loop_t *lp, uint32_t *delta, uint32_t phase, uint64_t len)
+{
+	/* The phase has drifted by d since the start of the loop. Take
+	 * the whole part off the NCO step, and spread the rest over the
+	 * loop with _nco_loop_step(), so each loop now ends exactly where
+	 * it started. The change in frequency is a fraction of a Hz */
+	uint32_t d = phase - lp->phase;
+	
+	if(len == 0) return;
+	
+	*delta -= d / len;
+	lp->r = d % len;
+	lp->acc = 0;
+	lp->len = len;
+}
+
+static inline uint32_t _nco_loop_step(_nco_loop_t *lp, int n)
+{
+	uint32_t c;
+	
+	/* The phase correction for the next n samples */
+	if(lp->len == 0) return(0);
+	
+	lp->acc += lp->r * n;
+	c = lp->acc / lp->len;
+	lp->acc %= lp->len;
+	
+	return(c);
+}
+
+#ifdef CPU_X86
+
+/* Looks up 8 phases in the cosine table, as int32. Each gather
+ * reads 32 bits at a 16-bit entry, so the table has one spare
+ * entry at the end, and only the low half is kept */
+__attribute__((target("avx2"), always_inline))
+static inline __m256i _nco_cos_avx2(const int16_t *lut, __m256i phase)
+{
+	__m256i i;
+	
+	i = _mm256_add_epi32(phase, _mm256_set1_epi32(1 << (31 - _NCO_BITS)));
+	i = _mm256_srli_epi32(i, 32 - _NCO_BITS);
+	i = _mm256_i32gather_epi32((const int *) lut, i, 2);
 	
-	am->level   = round(INT16_MAX * level);
-	am->counter = INT16_MAX;
-	am->phase.i = INT32_MAX;
-	am->phase.q = 0;
+	return(_mm256_srai_epi32(_mm256_slli_epi32(i, 16), 16));
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline __m256i _nco_sin_avx2(const int16_t *lut, __m256i phase)
+{
+	return(_nco_cos_avx2(lut, _mm256_sub_epi32(phase, _mm256_set1_epi32(0x40000000))));
+}
+
+/* Returns the phase after each of 8 steps, starting from phase */
+__attribute__((target("avx2"), always_inline))
+static inline __m256i _nco_steps_avx2(__m256i step, uint32_t phase)
+{
+	step = _mm256_add_epi32(step, _mm256_slli_si256(step, 4));
+	step = _mm256_add_epi32(step, _mm256_slli_si256(step, 8));
+	step = _mm256_add_epi32(step, _mm256_blend_epi32(
+		_mm256_setzero_si256(),
+		_mm256_permutevar8x32_epi32(step, _mm256_set1_epi32(3)),
+		0xF0
+	));
+	
+	return(_mm256_add_epi32(step, _mm256_set1_epi32(phase)));
+}
+
+/* Adds 8 IQ samples to dst. Like the scalar code only the low
+ * 16 bits of each are added, wrapping around */
+__attribute__((target("avx2"), always_inline))
+static inline void _nco_add_iq_avx2(int16_t *dst, __m256i i, __m256i q)
+{
+	__m256i v = _mm256_blend_epi16(i, _mm256_slli_epi32(q, 16), 0xAA);
+	
+	_mm256_storeu_si256((__m256i *) dst, _mm256_add_epi16(_mm256_loadu_si256((const __m256i *) dst), v));
+}
+
+__attribute__((target("avx2")))
+static int _fm_block_avx2(_mod_fm_t *fm, int16_t *dst, const int16_t *samples, int n, uint32_t *phase)
+{
+	const __m256i dev = _mm256_set1_epi64x(fm->nco_deviation);
+	const __m256i delta = _mm256_set1_epi32(fm->nco_delta);
+	const __m256i round = _mm256_set1_epi64x(32768);
+	const __m256i level = _mm256_set1_epi32(fm->level);
+	__m256i s, a, b, p;
+	int x;
+	
+	for(x = 0; x + 8 <= n; x += 8, dst += 16)
+	{
+		/* The phase step for each sample, the low 32 bits of
+		 * (samples[x] * nco_deviation + 32768) >> 16 */
+		s = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &samples[x]));
+		a = _mm256_srli_epi64(_mm256_add_epi64(_mm256_mul_epi32(s, dev), round), 16);
+		b = _mm256_srli_epi64(_mm256_add_epi64(_mm256_mul_epi32(_mm256_srli_epi64(s, 32), dev), round), 16);
+		s = _mm256_blend_epi32(a, _mm256_slli_epi64(b, 32), 0xAA);
+		
+		p = _nco_steps_avx2(_mm256_add_epi32(s, delta), *phase);
+		*phase = _mm256_extract_epi32(p, 7);
+		
+		_nco_add_iq_avx2(dst,
+			_mm256_srai_epi32(_mm256_mullo_epi32(_nco_cos_avx2(fm->nco_lut, p), level), 15),
+			_mm256_srai_epi32(_mm256_mullo_epi32(_nco_sin_avx2(fm->nco_lut, p), level), 15)
+		);
+	}
+	
+	return(x);
+}
+
+__attribute__((target("avx2")))
+static int _am_block_avx2(_mod_am_t *am, int16_t *dst, const int16_t *samples, int n, uint32_t *phase)
+{
+	const __m256i step = _mm256_set1_epi32(am->nco_delta);
+	const __m256i level = _mm256_set1_epi32(am->level);
+	const __m256i offset = _mm256_set1_epi32(-INT16_MIN);
+	__m256i s, p, i, q;
+	int x;
+	
+	for(x = 0; x + 8 <= n; x += 8, dst += 16)
+	{
+		s = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) &samples[x]));
+		s = _mm256_srli_epi32(_mm256_add_epi32(s, offset), 1);
+		
+		p = _nco_steps_avx2(step, *phase);
+		*phase = _mm256_extract_epi32(p, 7);
+		
+		i = _mm256_srai_epi32(_mm256_mullo_epi32(_nco_cos_avx2(am->nco_lut, p), s), 15);
+		q = _mm256_srai_epi32(_mm256_mullo_epi32(_nco_sin_avx2(am->nco_lut, p), s), 15);
+		
+		_nco_add_iq_avx2(dst,
+			_mm256_srai_epi32(_mm256_mullo_epi32(i, level), 15),
+			_mm256_srai_epi32(_mm256_mullo_epi32(q, level), 15)
+		);
+	}
+	
+	return(x);
+}
+
+__attribute__((target("avx2")))
+static int _a2stereo_pilot_block_avx2(_mod_am_t *pilot, _mod_am_t *signal, int16_t *dst, int n)
+{
+	const __m256i pstep = _mm256_set1_epi32(pilot->nco_delta);
+	const __m256i sstep = _mm256_set1_epi32(signal->nco_delta);
+	const __m256i plevel = _mm256_set1_epi32(pilot->level);
+	const __m256i slevel = _mm256_set1_epi32(signal->level);
+	const __m256i offset = _mm256_set1_epi32(-INT16_MIN);
+	__m256i s, p, v;
+	int x;
+	
+	for(x = 0; x + 8 <= n; x += 8)
+	{
+		p = _nco_steps_avx2(sstep, signal->nco_phase);
+		signal->nco_phase = _mm256_extract_epi32(p, 7);
+		
+		s = _mm256_srai_epi32(_mm256_mullo_epi32(_nco_cos_avx2(signal->nco_lut, p), _mm256_set1_epi32(-INT16_MIN / 2)), 15);
+		s = _mm256_srai_epi32(_mm256_mullo_epi32(s, slevel), 15);
+		s = _mm256_srli_epi32(_mm256_add_epi32(s, offset), 1);
+		
+		p = _nco_steps_avx2(pstep, pilot->nco_phase);
+		pilot->nco_phase = _mm256_extract_epi32(p, 7);
+		
+		v = _mm256_srai_epi32(_mm256_mullo_epi32(_nco_cos_avx2(pilot->nco_lut, p), s), 15);
+		v = _mm256_srai_epi32(_mm256_mullo_epi32(v, plevel), 15);
+		
+		/* Keep the low 16 bits of each, packus can't saturate them */
+		v = _mm256_and_si256(v, _mm256_set1_epi32(0xFFFF));
+		v = _mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), _MM_SHUFFLE(3, 1, 2, 0));
+		
+		_mm_storeu_si128((__m128i *) &dst[x], _mm_add_epi16(
+			_mm_loadu_si128((const __m128i *) &dst[x]),
+			_mm256_castsi256_si128(v)
+		));
+	}
+	
+	return(x);
+}
+
+#endif
+
+/* FM audio modulator
+ * deviation = peak deviation in Hz (+/-) from frequency */
+static int _init_fm_block_modulator(_mod_fm_t *fm, const int16_t *lut, int sample_rate, double frequency, double deviation, double level)
+{
+	fm->level = round(INT16_MAX * level);
+	fm->nco_lut = lut;
+	fm->nco_phase = 0;
+	fm->nco_delta = _nco_delta(sample_rate, frequency);
 	
-	d = 2.0 * M_PI / sample_rate * frequency;
-	am->delta.i = lround(cos(d) * INT32_MAX);
-	am->delta.q = lround(sin(d) * INT32_MAX);
+	/* Phase increment per unit of input, with 16 fractional bits */
+	fm->nco_deviation = llround(deviation / sample_rate * 4294967296.0 / INT16_MAX * 65536.0);
 	
 	return(VID_OK);
 }
 
-static void inline _am_modulator_add(_mod_am_t *am, int16_t *dst, int16_t sample)
+static void _fm_block_scalar(_mod_fm_t *fm, int16_t *dst, const int16_t *samples, int n, uint32_t *phase)
 {
-	cint32_mul(&am->phase, &am->phase, &am->delta);
+	const int16_t *lut = fm->nco_lut;
+	uint32_t p = *phase;
+	int x;
+	
+	for(x = 0; x < n; x++, dst += 2)
+	{
+		p += fm->nco_delta + (uint32_t) ((samples[x] * fm->nco_deviation + 32768) >> 16);
+		
+		dst[0] += (_nco_cos(lut, p) * fm->level) >> 15;
+		dst[1] += (_nco_sin(lut, p) * fm->level) >> 15;
+	}
 	
-	sample = ((int32_t) sample - INT16_MIN) / 2;
+	*phase = p;
+}
+
+static void _fm_modulator_add_block(_mod_fm_t *fm, int16_t *dst, const int16_t *samples, int n)
+{
+	uint32_t phase = fm->nco_phase - _nco_loop_step(&fm->nco_loop, n);
+	int x = 0;
+	
+#ifdef CPU_X86
+	/* The vector step is 32-bit, which covers any deviation
+	 * below about a quarter of the sample rate */
+	if((cpu_features() & CPU_AVX2) &&
+	   fm->nco_deviation >= INT32_MIN && fm->nco_deviation <= INT32_MAX)
+	{
+		x = _fm_block_avx2(fm, dst, samples, n, &phase);
+	}
+#endif
 	
-	dst[0] += ((((am->phase.i >> 16) * sample) >> 15) * am->level) >> 15;
-	dst[1] += ((((am->phase.q >> 16) * sample) >> 15) * am->level) >> 15;
+	/* The scalar path finishes the block */
+	_fm_block_scalar(fm, dst + x * 2, samples + x, n - x, &phase);
 	
-	/* Correct the amplitude after INT16_MAX samples */
-	if(--am->counter == 0)
+	fm->nco_phase = phase;
+}
+
+/* AM modulator */
+static int _init_am_modulator(_mod_am_t *am, const int16_t *lut, int sample_rate, double frequency, double level)
+{
+	am->level = round(INT16_MAX * level);
+	am->nco_lut = lut;
+	am->nco_phase = 0;
+	am->nco_delta = _nco_delta(sample_rate, frequency);
+	
+	return(VID_OK);
+}
+
+static void _am_block_scalar(_mod_am_t *am, int16_t *dst, const int16_t *samples, int n, uint32_t *phase)
+{
+	const int16_t *lut = am->nco_lut;
+	uint32_t p = *phase;
+	int32_t sample;
+	int x;
+	
+	for(x = 0; x < n; x++, dst += 2)
+	{
+		p += am->nco_delta;
+		
+		sample = ((int32_t) samples[x] - INT16_MIN) / 2;
+		
+		dst[0] += (((_nco_cos(lut, p) * sample) >> 15) * am->level) >> 15;
+		dst[1] += (((_nco_sin(lut, p) * sample) >> 15) * am->level) >> 15;
+	}
+	
+	*phase = p;
+}
+
+static void _am_modulator_add_block(_mod_am_t *am, int16_t *dst, const int16_t *samples, int n)
+{
+	uint32_t phase = am->nco_phase - _nco_loop_step(&am->nco_loop, n);
+	int x = 0;
+	
+#ifdef CPU_X86
+	if(cpu_features() & CPU_AVX2)
 	{
-		double ra = atan2(am->phase.q, am->phase.i);
+		x = _am_block_avx2(am, dst, samples, n, &phase);
+	}
+#endif
+	
+	_am_block_scalar(am, dst + x * 2, samples + x, n - x, &phase);
+	
+	am->nco_phase = phase;
+}
+
+static void _a2stereo_pilot_block_scalar(_mod_am_t *pilot, _mod_am_t *signal, int16_t *dst, int n)
+{
+	const int16_t *lut = pilot->nco_lut;
+	int32_t sample;
+	int x;
+	
+	/* The pilot tone is amplitude modulated by the
+	 * identification signal. Only the I part is used */
+	for(x = 0; x < n; x++)
+	{
+		signal->nco_phase += signal->nco_delta;
+		pilot->nco_phase += pilot->nco_delta;
 		
-		am->phase.i = lround(cos(ra) * INT32_MAX);
-		am->phase.q = lround(sin(ra) * INT32_MAX);
+		sample = (((_nco_cos(lut, signal->nco_phase) * (-INT16_MIN / 2)) >> 15) * signal->level) >> 15;
+		sample = (sample - INT16_MIN) / 2;
 		
-		am->counter = INT16_MAX;
+		dst[x] += (((_nco_cos(lut, pilot->nco_phase) * sample) >> 15) * pilot->level) >> 15;
+	}
+}
+
+static void _a2stereo_pilot_add_block(_mod_am_t *pilot, _mod_am_t *signal, int16_t *dst, int n)
+{
+	int x = 0;
+	
+	signal->nco_phase -= _nco_loop_step(&signal->nco_loop, n);
+	pilot->nco_phase -= _nco_loop_step(&pilot->nco_loop, n);
+	
+#ifdef CPU_X86
+	if(cpu_features() & CPU_AVX2)
+	{
+		x = _a2stereo_pilot_block_avx2(pilot, signal, dst, n);
 	}
+#endif
+	
+	_a2stereo_pilot_block_scalar(pilot, signal, dst + x, n - x);
 }
 
 static void _free_am_modulator(_mod_am_t *am)
@@ -2581,85 +2910,329 @@ static int _vid_next_line_rawbb(vid_t *s, void *arg, int nlines, vid_line_t **li
 	return(1);
 }
 
-static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+static int _colour_cycle_frames(vid_t *s)
 {
-	const char *seq;
-	int x;
-	int vy;
-	int pal = 0;
-	int fsc = 0;
-	uint8_t sc = 0;
-	int al, ar;
-	vid_line_t *l = lines[1];
+	int64_t a;
+	int frames = 1;
 	
-	l->width    = s->width;
-	l->frame    = s->bframe;
-	l->line     = s->bline;
-	l->vbialloc = 0;
-	l->lut      = NULL;
+	/* Find the number of frames before the PAL / NTSC subcarrier phase
+	 * at the start of each line repeats. The burst and PAL switch also
+	 * alternate each frame */
+	a = (int64_t) s->width * s->conf.lines % s->colour_lookup_width;
 	
-	/* Sequence codes: abcd
-	 * 
-	 * a: first sync
-	 *    h = horizontal sync pulse
-	 *    v = short vertical sync pulse
-	 *    V = long vertical sync pulse
-	 *    _ = no sync pulse
-	 * 
-	 * b: colour burst
-	 *    0 = line always has a colour burst
-	 *    _ = line never has a colour burst
-	 *    1 = line has a colour burst on odd frames
-	 *    2 = line has a colour burst on even frames
-	 * 
-	 * c: left content
-	 *    _ = blanking
-	 *    a = active video
-	 * 
-	 * d: right content
-	 *    _ = blanking
-	 *    a = active video
-	 *    v = short vertical sync pulse
-	 *    V = long vertical sync pulse
-	 * 
-	 **** I don't like this code, it's overly complicated for all it does.
-	*/
+	if(a > 0)
+	{
+		frames = s->colour_lookup_width / gcd(s->colour_lookup_width, a);
+	}
 	
-	vy = -1;
-	seq = "____";
+	if(frames & 1) frames *= 2;
 	
-	if(s->conf.type == VID_RASTER_625)
+	return(frames);
+}
+
+/* Raster line cache
+ * 
+ * The raster renderer produces the same samples for a line every time
+ * it sees the same line number, colour subcarrier phase and source
+ * frame, and lines without any active video don't depend on the frame
+ * at all. Rendered lines are kept here and copied back out when they
+ * come round again. The VBI inserters (teletext, WSS, VITC, VITS, etc.)
+ * run after the raster, so their data is added to the copy as normal.
+ * 
+ * The sync pulses at the start of a line begin slightly before it, in
+ * the tail of the previous line. That part is kept separately and added
+ * back to the previous line.
+ * 
+ * Hashing the source frame costs about as much as rendering it, so lines
+ * with active video are only cached while the source says it's a still
+ * image or that it repeats. Sync and VBI lines are always cached. The
+ * buffers are allocated when the first frame is loaded.
+*/
+
+#define _LINE_CACHE_MAX_FRAMES 8
+#define _LINE_CACHE_MAX_BYTES  (64 << 20)
+
+typedef struct {
+	int valid;
+	unsigned int lut_offset;
+	uint64_t hash;
+	int16_t *output;
+	int16_t *tail;
+} _vid_line_cache_entry_t;
+
+struct _vid_line_cache_t {
+	
+	/* Number of frames before the subcarrier phase repeats */
+	int frames;
+	
+	/* Samples of the previous line touched by the sync pulses */
+	int tail;
+	
+	/* Set while lines with active video can be cached */
+	int active;
+	
+	size_t length;
+	size_t stride;
+	_vid_line_cache_entry_t *entries;
+	int16_t *buffer;
+};
+
+static uint64_t _vid_frame_hash(vid_t *s)
+{
+	const av_frame_t *f = &s->vframe;
+	const uint32_t *p;
+	uint64_t h;
+	int x, y;
+	
+	/* FNV-1a over the frame position and the visible pixels */
+	h = 0xCBF29CE484222325ULL;
+	h = (h ^ (uint32_t) f->width) * 0x100000001B3ULL;
+	h = (h ^ (uint32_t) f->height) * 0x100000001B3ULL;
+	h = (h ^ (uint32_t) f->interlaced) * 0x100000001B3ULL;
+	h = (h ^ (uint32_t) s->vframe_x) * 0x100000001B3ULL;
+	h = (h ^ (uint32_t) s->vframe_y) * 0x100000001B3ULL;
+	
+	if(f->yuv[0] != NULL)
 	{
-		switch(l->line)
+		h = (h ^ (uint32_t) f->yuv_matrix) * 0x100000001B3ULL;
+		
+		for(y = 0; y < f->height; y++)
 		{
-		case 1:   seq = "V__V"; break;
-		case 2:   seq = "V__V"; break;
-		case 3:   seq = "V__v"; break;
-		case 4:   seq = "v__v"; break;
-		case 5:   seq = "v__v"; break;
-		case 6:   seq = "h1__"; break;
-		case 7:   seq = "h0__"; break;
-		case 8:   seq = "h0__"; break;
-		case 9:   seq = "h0__"; break;
-		case 10:  seq = "h0__"; break;
-		case 11:  seq = "h0__"; break;
-		case 12:  seq = "h0__"; break;
-		case 13:  seq = "h0__"; break;
-		case 14:  seq = "h0__"; break;
-		case 15:  seq = "h0__"; break;
-		case 16:  seq = "h0__"; break;
-		case 17:  seq = "h0__"; break;
-		case 18:  seq = "h0__"; break;
-		case 19:  seq = "h0__"; break;
-		case 20:  seq = "h0__"; break;
-		case 21:  seq = "h0__"; break;
-		case 22:  seq = "h0__"; break;
-		case 23:  seq = "h0_a"; break;
+			const uint8_t *py = f->yuv[0] + y * f->yuv_line_stride[0];
+			int c = ((y + f->yuv_cy) >> 1) * f->yuv_line_stride[1];
+			
+			for(x = 0; x < f->width; x++, py += f->yuv_pixel_stride[0])
+			{
+				int cx = c + ((x + f->yuv_cx) >> 1) * f->yuv_pixel_stride[1];
+				h = (h ^ (*py | f->yuv[1][cx] << 8 | f->yuv[2][cx] << 16)) * 0x100000001B3ULL;
+			}
+		}
 		
-		case 310: seq = "h1aa"; break;
-		case 311: seq = "v__v"; break;
-		case 312: seq = "v__v"; break;
-		case 313: seq = "v__V"; break;
+		return(h ^ 2);
+	}
+	
+	if(f->framebuffer == NULL)
+	{
+		return(h);
+	}
+	
+	for(y = 0; y < f->height; y++)
+	{
+		p = &f->framebuffer[y * f->line_stride];
+		
+		for(x = 0; x < f->width; x++, p += f->pixel_stride)
+		{
+			h = (h ^ *p) * 0x100000001B3ULL;
+		}
+	}
+	
+	return(h ^ 1);
+}
+
+static void _free_line_cache(vid_t *s)
+{
+	_vid_line_cache_t *c = s->line_cache;
+	
+	if(c == NULL) return;
+	
+	free(c->entries);
+	free(c->buffer);
+	free(c);
+	
+	s->line_cache = NULL;
+}
+
+static int _init_line_cache(vid_t *s)
+{
+	_vid_line_cache_t *c;
+	const vbidata_lut_t *lut;
+	int left = 0, right = 0;
+	int frames = 1;
+	size_t n, stride;
+	
+	/* SECAM and the field sequential colour modes carry
+	 * state from line to line and can't be cached */
+	if(s->conf.colour_mode == VID_SECAM ||
+	   s->conf.colour_mode == VID_APOLLO_FSC ||
+	   s->conf.colour_mode == VID_CBS_FSC)
+	{
+		return(VID_OK);
+	}
+	
+	/* Find how far the sync pulses reach outside the line */
+	for(lut = s->syncs; lut->length != -1; lut = (const vbidata_lut_t *) &lut->value[lut->length])
+	{
+		if(lut->offset < left) left = lut->offset;
+		if(lut->offset + lut->length > right) right = lut->offset + lut->length;
+	}
+	
+	/* Pulses running into the next line aren't supported */
+	if(-left > s->width || right > s->width)
+	{
+		return(VID_OK);
+	}
+	
+	if(s->conf.colour_mode == VID_PAL ||
+	   s->conf.colour_mode == VID_NTSC)
+	{
+		frames = _colour_cycle_frames(s);
+	}
+	
+	n = (size_t) s->conf.lines * frames;
+	stride = (size_t) s->width * 2 - left;
+	
+	if(frames > _LINE_CACHE_MAX_FRAMES ||
+	   n * stride * sizeof(int16_t) > _LINE_CACHE_MAX_BYTES)
+	{
+		return(VID_OK);
+	}
+	
+	c = calloc(1, sizeof(_vid_line_cache_t));
+	if(!c)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	s->line_cache = c;
+	
+	c->frames = frames;
+	c->tail = -left;
+	c->length = n;
+	c->stride = stride;
+	
+	return(VID_OK);
+}
+
+static int _alloc_line_cache(vid_t *s)
+{
+	_vid_line_cache_t *c = s->line_cache;
+	size_t i;
+	
+	c->entries = calloc(c->length, sizeof(_vid_line_cache_entry_t));
+	c->buffer = malloc(c->length * c->stride * sizeof(int16_t));
+	
+	if(!c->entries || !c->buffer)
+	{
+		free(c->entries);
+		free(c->buffer);
+		c->entries = NULL;
+		c->buffer = NULL;
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	for(i = 0; i < c->length; i++)
+	{
+		c->entries[i].output = &c->buffer[i * c->stride];
+		c->entries[i].tail = c->entries[i].output + s->width * 2;
+	}
+	
+	return(VID_OK);
+}
+
+static void _update_line_cache(vid_t *s)
+{
+	_vid_line_cache_t *c = s->line_cache;
+	
+	/* Called as each source frame is loaded */
+	if(c->entries == NULL && _alloc_line_cache(s) != VID_OK)
+	{
+		/* Carry on without it */
+		_free_line_cache(s);
+		return;
+	}
+	
+	/* Only hash the frame if the source says it repeats */
+	c->active = (s->av.period.den > 0);
+	
+	if(c->active)
+	{
+		s->vframe_hash = _vid_frame_hash(s);
+	}
+}
+
+static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	const char *seq;
+	int x;
+	int vy;
+	int pal = 0;
+	int fsc = 0;
+	uint8_t sc = 0;
+	int al, ar;
+	vid_line_t *l = lines[1];
+	_vid_line_cache_t *c = s->line_cache;
+	_vid_line_cache_entry_t *e = NULL;
+	unsigned int lut_offset = 0;
+	uint64_t hash = 0;
+	
+	l->width    = s->width;
+	l->frame    = s->bframe;
+	l->line     = s->bline;
+	l->vbialloc = 0;
+	l->lut      = NULL;
+	
+	/* Sequence codes: abcd
+	 * 
+	 * a: first sync
+	 *    h = horizontal sync pulse
+	 *    v = short vertical sync pulse
+	 *    V = long vertical sync pulse
+	 *    _ = no sync pulse
+	 * 
+	 * b: colour burst
+	 *    0 = line always has a colour burst
+	 *    _ = line never has a colour burst
+	 *    1 = line has a colour burst on odd frames
+	 *    2 = line has a colour burst on even frames
+	 * 
+	 * c: left content
+	 *    _ = blanking
+	 *    a = active video
+	 * 
+	 * d: right content
+	 *    _ = blanking
+	 *    a = active video
+	 *    v = short vertical sync pulse
+	 *    V = long vertical sync pulse
+	 * 
+	 **** I don't like this code, it's overly complicated for all it does.
+	*/
+	
+	vy = -1;
+	seq = "____";
+	
+	if(s->conf.type == VID_RASTER_625)
+	{
+		switch(l->line)
+		{
+		case 1:   seq = "V__V"; break;
+		case 2:   seq = "V__V"; break;
+		case 3:   seq = "V__v"; break;
+		case 4:   seq = "v__v"; break;
+		case 5:   seq = "v__v"; break;
+		case 6:   seq = "h1__"; break;
+		case 7:   seq = "h0__"; break;
+		case 8:   seq = "h0__"; break;
+		case 9:   seq = "h0__"; break;
+		case 10:  seq = "h0__"; break;
+		case 11:  seq = "h0__"; break;
+		case 12:  seq = "h0__"; break;
+		case 13:  seq = "h0__"; break;
+		case 14:  seq = "h0__"; break;
+		case 15:  seq = "h0__"; break;
+		case 16:  seq = "h0__"; break;
+		case 17:  seq = "h0__"; break;
+		case 18:  seq = "h0__"; break;
+		case 19:  seq = "h0__"; break;
+		case 20:  seq = "h0__"; break;
+		case 21:  seq = "h0__"; break;
+		case 22:  seq = "h0__"; break;
+		case 23:  seq = "h0_a"; break;
+		
+		case 310: seq = "h1aa"; break;
+		case 311: seq = "v__v"; break;
+		case 312: seq = "v__v"; break;
+		case 313: seq = "v__V"; break;
 		case 314: seq = "V__V"; break;
 		case 315: seq = "V__V"; break;
 		case 316: seq = "v__v"; break;
@@ -3008,7 +3581,8 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		pal |= seq[1] == '2' && (l->frame & 1) == 1;
 		
 		/* Calculate colour sub-carrier lookup-positions for the start of this line */
-		l->lut = &s->colour_lookup[s->colour_lookup_offset];
+		lut_offset = s->colour_lookup_offset;
+		l->lut = &s->colour_lookup[lut_offset];
 		
 		/* Update offset for the next line */
 		s->colour_lookup_offset += s->width;
@@ -3039,6 +3613,45 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		lines[2]->output[x * 2] = s->blanking_level;
 	}
 	
+	/* Only lines with active video depend on the source frame,
+	 * and they can't be cached if it hasn't been hashed */
+	if(seq[2] == 'a' || seq[3] == 'a')
+	{
+		if(c != NULL && !c->active) c = NULL;
+		hash = s->vframe_hash;
+	}
+	
+	/* The first line has no previous line for the sync
+	 * pulses to run into, and isn't cached */
+	if(c != NULL && lines[0]->width == s->width)
+	{
+		e = &c->entries[(l->frame % c->frames) * s->conf.lines + l->line - 1];
+		
+		if(e->valid && e->lut_offset == lut_offset && e->hash == hash)
+		{
+			/* Nothing has changed, copy the line from the cache */
+			memcpy(l->output, e->output, sizeof(int16_t) * 2 * s->width);
+			
+			for(x = 0; x < c->tail; x++)
+			{
+				lines[0]->output[(s->width - c->tail + x) * 2] += e->tail[x];
+			}
+			
+			for(x = s->width; x < s->max_width; x++)
+			{
+				l->output[x * 2 + 1] = 0;
+			}
+			
+			return(1);
+		}
+		
+		/* Save the end of the previous line before the sync pulses are added */
+		for(x = 0; x < c->tail; x++)
+		{
+			e->tail[x] = lines[0]->output[(s->width - c->tail + x) * 2];
+		}
+	}
+	
 	x = 0;
 	
 	/* Draw the sync pulses */
@@ -3061,10 +3674,11 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 	/* Render the active video if required */
 	if(seq[2] == 'a' || seq[3] == 'a')
 	{
-		uint32_t rgb = 0x000000;
-		uint32_t *prgb = &rgb;
-		int stride = 0;
 		int16_t *o;
+		int16_t *py = s->yiq_line;
+		int16_t *pi = py + s->active_width;
+		int16_t *pq = pi + s->active_width;
+		int n;
 		
 		/* Calculate active video portion of this line */
 		al = (seq[2] == 'a' ? s->active_left : (seq[3] == 'a' ? s->half_width : -1));
@@ -3072,39 +3686,33 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		
 		for(x = al, o = &l->output[al * 2]; x < s->active_left + s->vframe_x; x++, o += 2)
 		{
-			*o = s->yiq_level_lookup[0x000000].y;
+			*o = s->yiq.black.y;
 		}
 		
-		if(s->vframe.framebuffer && vy >= 0)
+		/* Convert the visible part of the line to YIQ levels */
+		n = (s->active_left + s->vframe_x + s->vframe.width < ar ? s->active_left + s->vframe_x + s->vframe.width : ar) - x;
+		
+		if(n > 0)
 		{
-			prgb  = &s->vframe.framebuffer[vy * s->vframe.line_stride];
-			prgb += (x - s->active_left - s->vframe_x) * s->vframe.pixel_stride;
-			stride = s->vframe.pixel_stride;
+			vid_frame_levels(s, py, pal ? pi : NULL, pal ? pq : NULL, x - s->active_left - s->vframe_x, vy, 1, n,
+				s->conf.colour_mode == VID_APOLLO_FSC || s->conf.colour_mode == VID_CBS_FSC ? 8 * fsc : -1
+			);
 		}
 		
-		for(; x < s->active_left + s->vframe_x + s->vframe.width && x < ar; x++, o += 2, prgb += stride)
+		for(; n > 0; n--, x++, o += 2, py++, pi++, pq++)
 		{
-			rgb = *prgb & 0xFFFFFF;
-			
-			if(s->conf.colour_mode == VID_APOLLO_FSC ||
-			   s->conf.colour_mode == VID_CBS_FSC)
-			{
-				rgb  = (rgb >> (8 * fsc)) & 0xFF;
-				rgb |= (rgb << 8) | (rgb << 16);
-			}
-			
-			*o = s->yiq_level_lookup[rgb].y;
+			*o = *py;
 			
 			if(pal)
 			{
-				*o += (s->yiq_level_lookup[rgb].i * l->lut[x].q +
-				       s->yiq_level_lookup[rgb].q * l->lut[x].i * pal) >> 15;
+				*o += (*pi * l->lut[x].q +
+				       *pq * l->lut[x].i * pal) >> 15;
 			}
 		}
 		
 		for(; x < ar; x++, o += 2)
 		{
-			*o = s->yiq_level_lookup[0x000000].y;
+			*o = s->yiq.black.y;
 		}
 	}
 	
@@ -3157,13 +3765,13 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 			
 			if(((l->frame * s->conf.lines) + l->line) & 1)
 			{
-				level = s->yiq_level_lookup[0x000000].q; // D'r
+				level = s->yiq.black.q; // D'r
 				dev = s->secam_fsync_level;
 				rw = 15e-6;
 			}
 			else
 			{
-				level = s->yiq_level_lookup[0x000000].i; // D'b
+				level = s->yiq.black.i; // D'b
 				dev = -s->secam_fsync_level;
 				rw = 18e-6;
 			}
@@ -3185,15 +3793,12 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		}
 		else if(seq[2] == 'a' || seq[3] == 'a')
 		{
-			uint32_t rgb = 0x000000;
-			uint32_t *prgb = &rgb;
-			int stride = 0;
+			int16_t *py = s->yiq_line;
+			int16_t *pi = py + s->active_width;
+			int16_t *pq = pi + s->active_width;
+			int n;
 			
-			if(s->vframe.framebuffer && vy >= 0)
-			{
-				prgb = &s->vframe.framebuffer[vy * s->vframe.line_stride];
-				stride = s->vframe.pixel_stride;
-			}
+			vid_frame_levels(s, py, pi, pq, 0, vy, 1, s->vframe.width, -1);
 			
 			if(((l->frame * s->conf.lines) + l->line) & 1)
 			{
@@ -3201,17 +3806,17 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 				
 				for(x = 0; x < s->active_left + s->vframe_x; x++)
 				{
-					l->output[x * 2 + 1] = s->yiq_level_lookup[0x000000].q;
+					l->output[x * 2 + 1] = s->yiq.black.q;
 				}
 				
-				for(; x < s->active_left + s->vframe_x + s->vframe.width; x++, prgb += stride)
+				for(n = 0; n < s->vframe.width; n++, x++)
 				{
-					l->output[x * 2 + 1] = s->yiq_level_lookup[*prgb & 0xFFFFFF].q;
+					l->output[x * 2 + 1] = pq[n];
 				}
 				
 				for(; x < s->width; x++)
 				{
-					l->output[x * 2 + 1] = s->yiq_level_lookup[0x000000].q;
+					l->output[x * 2 + 1] = s->yiq.black.q;
 				}
 			}
 			else
@@ -3220,17 +3825,17 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 				
 				for(x = 0; x < s->active_left + s->vframe_x; x++)
 				{
-					l->output[x * 2 + 1] = s->yiq_level_lookup[0x000000].i;
+					l->output[x * 2 + 1] = s->yiq.black.i;
 				}
 				
-				for(; x < s->active_left + s->vframe_x + s->vframe.width; x++, prgb += stride)
+				for(n = 0; n < s->vframe.width; n++, x++)
 				{
-					l->output[x * 2 + 1] = s->yiq_level_lookup[*prgb & 0xFFFFFF].i;
+					l->output[x * 2 + 1] = pi[n];
 				}
 				
 				for(; x < s->width; x++)
 				{
-					l->output[x * 2 + 1] = s->yiq_level_lookup[0x000000].i;
+					l->output[x * 2 + 1] = s->yiq.black.i;
 				}
 			}
 			
@@ -3272,6 +3877,21 @@ static int _vid_next_line_raster(vid_t *s, void *arg, int nlines, vid_line_t **l
 		l->output[x * 2 + 1] = 0;
 	}
 	
+	if(e != NULL)
+	{
+		/* Update the cache with this line and the
+		 * changes it made to the previous one */
+		for(x = 0; x < c->tail; x++)
+		{
+			e->tail[x] = lines[0]->output[(s->width - c->tail + x) * 2] - e->tail[x];
+		}
+		
+		memcpy(e->output, l->output, sizeof(int16_t) * 2 * s->width);
+		e->lut_offset = lut_offset;
+		e->hash = hash;
+		e->valid = 1;
+	}
+	
 	return(1);
 }
 
@@ -3294,92 +3914,145 @@ static void _vid_filter_free(vid_t *s, void *arg)
 	free(p);
 }
 
-static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+static int _vid_audio_preprocess(vid_t *s, const int16_t *audio, size_t samples)
 {
-	vid_line_t *l = lines[0];
-	int16_t audio[2] = { 0, 0 };
-	int x;
+	int16_t *pre;
+	size_t i;
 	
-	for(x = 0; x < l->width; x++)
+	/* Prepare the carrier inputs for a block of 32 kHz audio,
+	 * audio may be NULL for silence */
+	if(samples > s->audio_pre_size)
+	{
+		pre = realloc(s->audio_pre, sizeof(int16_t) * _AUDIO_CHANNELS * samples);
+		if(!pre)
+		{
+			return(VID_OUT_OF_MEMORY);
+		}
+		
+		s->audio_pre = pre;
+		s->audio_pre_size = samples;
+	}
+	
+	pre = s->audio_pre;
+	s->audio_pre_len = samples;
+	
+	for(i = 0; i < samples; i++, pre += _AUDIO_CHANNELS)
 	{
-		int16_t add[2] = { 0, 0 };
+		int16_t l = audio ? audio[i * 2 + 0] : 0;
+		int16_t r = audio ? audio[i * 2 + 1] : 0;
 		
-		/* TODO: Replace this with a real FIR filter... */
-		s->interp += HACKTV_AUDIO_SAMPLE_RATE;
-		if(s->interp >= s->sample_rate)
+		pre[_AUDIO_MONO] = (l + r) / 2;
+		pre[_AUDIO_LEFT] = l;
+		pre[_AUDIO_RIGHT] = r;
+		pre[_AUDIO_AM] = (l + r) / 2;
+	}
+	
+	pre = s->audio_pre;
+	
+	if(s->fm_mono.limiter.width)
+	{
+		limiter_process(&s->fm_mono.limiter, &pre[_AUDIO_MONO], &pre[_AUDIO_MONO], &pre[_AUDIO_MONO], samples, _AUDIO_CHANNELS);
+	}
+	
+	if(s->fm_left.limiter.width)
+	{
+		limiter_process(&s->fm_left.limiter, &pre[_AUDIO_LEFT], &pre[_AUDIO_LEFT], &pre[_AUDIO_LEFT], samples, _AUDIO_CHANNELS);
+	}
+	
+	if(s->fm_right.limiter.width)
+	{
+		limiter_process(&s->fm_right.limiter, &pre[_AUDIO_RIGHT], &pre[_AUDIO_RIGHT], &pre[_AUDIO_RIGHT], samples, _AUDIO_CHANNELS);
+	}
+	
+	if(s->conf.a2stereo)
+	{
+		for(i = 0; i < samples; i++, pre += _AUDIO_CHANNELS)
 		{
-			s->interp -= s->sample_rate;
-			
-			if(s->audiobuffer_samples == 0)
-			{
-				s->audiobuffer = av_read_audio(&s->av, &s->audiobuffer_samples);
-				
-				if(s->conf.systeraudio == 1)
-				{
-					ng_invert_audio(&s->ng, s->audiobuffer, s->audiobuffer_samples);
-				}
-			}
-			
-			if(s->audiobuffer)
-			{
-				/* Fetch next sample */
-				audio[0] = s->audiobuffer[0];
-				audio[1] = s->audiobuffer[1];
-				s->audiobuffer += 2;
-				s->audiobuffer_samples--;
-			}
-			else
-			{
-				/* No audio from the source */
-				audio[0] = 0;
-				audio[1] = 0;
-			}
+			/* Reduce volume of audio in A2 Stereo mode to
+			 * leave room for the pilot/mode signal */
+			pre[_AUDIO_MONO] *= 0.95;
+			pre[_AUDIO_RIGHT] *= 0.95;
 			
-			if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
+			if(s->a2stereo_system_m)
 			{
-				s->am_mono.sample = (audio[0] + audio[1]) / 2;
+				/* The System M variant is L-R, not R */
+				pre[_AUDIO_RIGHT] = pre[_AUDIO_MONO] - pre[_AUDIO_RIGHT];
 			}
+		}
+	}
+	
+	return(VID_OK);
+}
+
+static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	vid_line_t *l = lines[0];
+	const int16_t *audio;
+	const int16_t *pre;
+	int16_t a[2];
+	int i, j, c, n;
+	
+	/* Number of 32 kHz samples that fall within this line */
+	n = (s->interp + l->width * HACKTV_AUDIO_SAMPLE_RATE) / s->sample_rate;
+	s->interp = (s->interp + l->width * HACKTV_AUDIO_SAMPLE_RATE) % s->sample_rate;
+	
+	for(i = 0; i < n; i += c)
+	{
+		if(s->audiobuffer_samples == 0)
+		{
+			s->audiobuffer = av_read_audio(&s->av, &s->audiobuffer_samples);
 			
-			if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
+			if(s->audiobuffer && s->audiobuffer_samples > 0)
 			{
-				s->fm_mono.sample = (audio[0] + audio[1]) / 2;
-				if(s->fm_mono.limiter.width)
+				if(s->conf.systeraudio == 1)
 				{
-					limiter_process(&s->fm_mono.limiter, &s->fm_mono.sample, &s->fm_mono.sample, &s->fm_mono.sample, 1, 1);
+					ng_invert_audio(&s->ng, s->audiobuffer, s->audiobuffer_samples);
 				}
 				
-				/* Reduce volume of audio in A2 Stereo mode to
-				 * leave room for the pilot/mode signal */
-				if(s->conf.a2stereo) s->fm_mono.sample *= 0.95;
-			}
-			
-			if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
-			{
-				s->fm_left.sample = audio[0];
-				if(s->fm_left.limiter.width)
+				if(_vid_audio_preprocess(s, s->audiobuffer, s->audiobuffer_samples) != VID_OK)
 				{
-					limiter_process(&s->fm_left.limiter, &s->fm_left.sample, &s->fm_left.sample, &s->fm_left.sample, 1, 1);
+					s->audiobuffer = NULL;
 				}
 			}
+		}
+		
+		if(s->audiobuffer && s->audiobuffer_samples > 0)
+		{
+			/* Take what we can from the current buffer */
+			c = n - i < s->audiobuffer_samples ? n - i : s->audiobuffer_samples;
+			audio = s->audiobuffer;
+			pre = &s->audio_pre[(s->audio_pre_len - s->audiobuffer_samples) * _AUDIO_CHANNELS];
 			
-			if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
-			{
-				s->fm_right.sample = audio[1];
-				if(s->fm_right.limiter.width)
-				{
-					limiter_process(&s->fm_right.limiter, &s->fm_right.sample, &s->fm_right.sample, &s->fm_right.sample, 1, 1);
-				}
-				
-				/* Reduce volume of audio in A2 Stereo mode to
-				 * leave room for the pilot/mode signal */
-				if(s->conf.a2stereo) s->fm_right.sample *= 0.95;
-			}
+			s->audiobuffer += c * 2;
+			s->audiobuffer_samples -= c;
+		}
+		else
+		{
+			/* No audio from the source */
+			c = n - i;
+			audio = NULL;
+			s->audiobuffer_samples = 0;
 			
-			if((s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0) ||
+			/* Can't fail, audio_pre always has room for one line */
+			_vid_audio_preprocess(s, NULL, c);
+			pre = s->audio_pre;
+		}
+		
+		if(l->audio_in)
+		{
+			memcpy(&l->audio_in[i * _AUDIO_CHANNELS], pre, sizeof(int16_t) * _AUDIO_CHANNELS * c);
+		}
+		
+		for(j = 0; j < c; j++)
+		{
+			a[0] = audio ? audio[j * 2 + 0] : 0;
+			a[1] = audio ? audio[j * 2 + 1] : 0;
+			
+			if((s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0) ||
 			   s->conf.type == VID_MAC || s->conf.sis)
 			{
-				s->nicam_buf[s->nicam_buf_len++] = audio[0];
-				s->nicam_buf[s->nicam_buf_len++] = audio[1];
+				s->nicam_buf[s->nicam_buf_len++] = a[0];
+				s->nicam_buf[s->nicam_buf_len++] = a[1];
 				
 				if(s->nicam_buf_len == NICAM_AUDIO_LEN * 2)
 				{
@@ -3404,8 +4077,8 @@ static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **line
 			
 			if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)
 			{
-				s->dance_buf[s->dance_buf_len++] = audio[0];
-				s->dance_buf[s->dance_buf_len++] = audio[1];
+				s->dance_buf[s->dance_buf_len++] = a[0];
+				s->dance_buf[s->dance_buf_len++] = a[1];
 				
 				if(s->dance_buf_len == DANCE_A_AUDIO_LEN * 2)
 				{
@@ -3414,58 +4087,175 @@ static int _vid_audio_process(vid_t *s, void *arg, int nlines, vid_line_t **line
 				}
 			}
 		}
+	}
+	
+	l->audio_samples = n;
+	
+	if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
+	{
+		nicam_mod_output(&s->nicam, l->output, l->width);
+	}
+	
+	if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)
+	{
+		dance_mod_output(&s->dance, l->output, l->width);
+	}
+	
+	return(1);
+}
+
+static int _vid_audio_resampler_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	_vid_audio_resampler_t *p = arg;
+	vid_line_t *l = lines[0];
+	const int16_t *f;
+	int16_t *dst;
+	int64_t v, dv;
+	int c, i, j, k, x;
+	
+	/* Interpolate the new samples onto the end of the fifo */
+	for(c = 0; c < _AUDIO_CHANNELS; c++)
+	{
+		fir_int16_process(&p->fir[c], &p->fifo[p->fifo_len * _AUDIO_CHANNELS + c], &l->audio_in[c], l->audio_samples, _AUDIO_CHANNELS);
+	}
+	
+	p->fifo_len += l->audio_samples * _AUDIO_INTERP;
+	
+	/* Linearly interpolate up to the sample rate. The fifo advances
+	 * every few dozen samples, between those each output is a ramp */
+	for(x = j = 0; x < l->width; x += k)
+	{
+		k = (s->sample_rate - p->acc + HACKTV_AUDIO_SAMPLE_RATE * _AUDIO_INTERP - 1) / (HACKTV_AUDIO_SAMPLE_RATE * _AUDIO_INTERP);
+		if(k > l->width - x) k = l->width - x;
 		
-		if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
+		f = &p->fifo[j * _AUDIO_CHANNELS];
+		
+		for(c = 0; c < _AUDIO_CHANNELS; c++)
 		{
-			_fm_modulator_add(&s->fm_mono, add, s->fm_mono.sample);
+			dst = &l->audio[c * s->max_width + x];
+			
+			v = (f[c + _AUDIO_CHANNELS] - f[c]) * 65536LL;
+			dv = v * HACKTV_AUDIO_SAMPLE_RATE * _AUDIO_INTERP / s->sample_rate;
+			v = f[c] * 65536LL + v * p->acc / s->sample_rate;
+			
+			for(i = 0; i < k; i++, v += dv)
+			{
+				dst[i] = v >> 16;
+			}
 		}
 		
-		if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
+		p->acc += k * HACKTV_AUDIO_SAMPLE_RATE * _AUDIO_INTERP;
+		j += p->acc / s->sample_rate;
+		p->acc %= s->sample_rate;
+	}
+	
+	/* Drop the used samples */
+	p->fifo_len -= j;
+	memmove(p->fifo, &p->fifo[j * _AUDIO_CHANNELS], sizeof(int16_t) * _AUDIO_CHANNELS * p->fifo_len);
+	
+	return(1);
+}
+
+static void _vid_audio_resampler_free(vid_t *s, void *arg)
+{
+	_vid_audio_resampler_t *p = arg;
+	int c;
+	
+	for(c = 0; c < _AUDIO_CHANNELS; c++)
+	{
+		fir_int16_free(&p->fir[c]);
+	}
+	
+	free(p->fifo);
+	free(p);
+}
+
+static void _vid_loop_lock(vid_t *s, int frames)
+{
+	_mod_fm_t *fm[3] = { &s->fm_mono, &s->fm_left, &s->fm_right };
+	_mod_am_t *pilot[2] = { &s->a2stereo_pilot, &s->a2stereo_signal };
+	int i;
+	
+	/* The A2 pilot is part of the right channel's audio, so it's
+	 * locked a loop before the FM carriers are measured */
+	if(s->conf.a2stereo && frames == s->loop_frames * 2)
+	{
+		for(i = 0; i < 2; i++)
+		{
+			pilot[i]->nco_loop.phase = pilot[i]->nco_phase;
+		}
+	}
+	else if(s->conf.a2stereo && frames == s->loop_frames)
+	{
+		for(i = 0; i < 2; i++)
 		{
-			_fm_modulator_add(&s->fm_left, add, s->fm_left.sample);
+			_nco_loop_lock(&pilot[i]->nco_loop, &pilot[i]->nco_delta, pilot[i]->nco_phase, s->loop_samples);
+		}
+	}
+	
+	if(frames == s->loop_frames)
+	{
+		for(i = 0; i < 3; i++)
+		{
+			fm[i]->nco_loop.phase = fm[i]->nco_phase;
 		}
 		
-		if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
+		s->am_mono.nco_loop.phase = s->am_mono.nco_phase;
+	}
+	else if(frames == 0)
+	{
+		for(i = 0; i < 3; i++)
 		{
-			int16_t a2 = s->fm_right.sample;
-			
-			if(s->conf.a2stereo)
-			{
-				int16_t s1[2] = { 0, 0 };
-				int16_t s2[2] = { 0, 0 };
-				
-				if(s->a2stereo_system_m)
-				{
-					/* The System M variant is L-R, not R */
-					a2 = s->fm_mono.sample - s->fm_right.sample;
-				}
-				
-				/* Add the pilot tone */
-				_am_modulator_add(&s->a2stereo_signal, s1, 0);
-				_am_modulator_add(&s->a2stereo_pilot, s2, s1[0]);
-				a2 += s2[0];
-			}
-			
-			_fm_modulator_add(&s->fm_right, add, a2);
+			_nco_loop_lock(&fm[i]->nco_loop, &fm[i]->nco_delta, fm[i]->nco_phase, s->loop_samples);
 		}
 		
-		if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
+		_nco_loop_lock(&s->am_mono.nco_loop, &s->am_mono.nco_delta, s->am_mono.nco_phase, s->loop_samples);
+	}
+	
+	s->loop_samples = 0;
+}
+
+static int _vid_audio_carrier_process(vid_t *s, void *arg, int nlines, vid_line_t **lines)
+{
+	vid_line_t *l = lines[0];
+	
+	if(s->loop_frames > 0)
+	{
+		/* Measure the phase drift over the loop before the first,
+		 * and correct for it from the start of the first loop */
+		if(l->line == 1 && (s->loop_start - l->frame) % s->loop_frames == 0)
 		{
-			_am_modulator_add(&s->am_mono, add, s->am_mono.sample);
+			_vid_loop_lock(s, s->loop_start - l->frame);
 		}
 		
-		l->output[x * 2 + 0] += add[0];
-		l->output[x * 2 + 1] += add[1];
+		s->loop_samples += l->width;
 	}
 	
-	if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
+	/* Synthesise the whole line of each carrier */
+	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
 	{
-		nicam_mod_output(&s->nicam, l->output, l->width);
+		_fm_modulator_add_block(&s->fm_mono, l->output, &l->audio[_AUDIO_MONO * s->max_width], l->width);
 	}
 	
-	if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)
+	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
 	{
-		dance_mod_output(&s->dance, l->output, l->width);
+		_fm_modulator_add_block(&s->fm_left, l->output, &l->audio[_AUDIO_LEFT * s->max_width], l->width);
+	}
+	
+	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
+	{
+		if(s->conf.a2stereo)
+		{
+			/* Add the pilot tone */
+			_a2stereo_pilot_add_block(&s->a2stereo_pilot, &s->a2stereo_signal, &l->audio[_AUDIO_RIGHT * s->max_width], l->width);
+		}
+		
+		_fm_modulator_add_block(&s->fm_right, l->output, &l->audio[_AUDIO_RIGHT * s->max_width], l->width);
+	}
+	
+	if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
+	{
+		_am_modulator_add_block(&s->am_mono, l->output, &l->audio[_AUDIO_AM * s->max_width], l->width);
 	}
 	
 	return(1);
@@ -3572,6 +4362,7 @@ static int _add_lineprocess(vid_t *s, const char *name, int nlines, void *arg, v
 	strncpy(p->name, name, 15);
 	p->vid = s;
 	p->nlines = nlines;
+	p->stage = s->nstages - 1;
 	p->arg = arg;
 	p->process = pprocess;
 	p->free = pfree;
@@ -3588,6 +4379,16 @@ static int _add_lineprocess(vid_t *s, const char *name, int nlines, void *arg, v
 	return(VID_OK);
 }
 
+static void _new_stage(vid_t *s)
+{
+	/* Processes added after this point may run on a different
+	 * thread to the ones before it. Empty stages are not created */
+	if(s->nprocesses > 0 && s->processes[s->nprocesses - 1].stage == s->nstages - 1)
+	{
+		s->nstages++;
+	}
+}
+
 static int _calc_filter_delay(int width, int ntaps)
 {
 	int delay;
@@ -3624,6 +4425,24 @@ static int _init_vresampler(vid_t *s)
 	return(VID_OK);
 }	
 
+static void _init_vfilter_fir(fir_int16_t *fir, const double *taps, int ntaps, int scomplex, int width)
+{
+	int delay = _calc_filter_delay(width, ntaps);
+	
+	/* Use FFT convolution where it's cheaper than the direct
+	 * form. Both have the same delay */
+	if(fir_int16_fft_preferred(ntaps, scomplex ? 2 : 1))
+	{
+		if(scomplex) fir_int16_scomplex_fft_init(fir, taps, ntaps, delay);
+		else fir_int16_fft_init(fir, taps, ntaps, delay);
+	}
+	else
+	{
+		if(scomplex) fir_int16_scomplex_init(fir, taps, ntaps, 1, 1, delay);
+		else fir_int16_init(fir, taps, ntaps, 1, 1, delay);
+	}
+}
+
 static int _init_vfilter(vid_t *s)
 {
 	_vid_filter_process_t *p;
@@ -3646,7 +4465,7 @@ static int _init_vfilter(vid_t *s)
 		ntaps = 51;
 		
 		fir_complex_band_pass(taps, ntaps, s->sample_rate, -s->conf.vsb_lower_bw, s->conf.vsb_upper_bw, 750000, 1);
-		fir_int16_scomplex_init(&p->fir, taps, ntaps, 1, 1, _calc_filter_delay(width, ntaps));
+		_init_vfilter_fir(&p->fir, taps, ntaps, 1, width);
 	}
 	else if(s->conf.modulation == VID_FM)
 	{
@@ -3709,7 +4528,7 @@ static int _init_vfilter(vid_t *s)
 			}
 		}
 		
-		fir_int16_init(&p->fir, taps, ntaps, 1, 1, _calc_filter_delay(width, ntaps));
+		_init_vfilter_fir(&p->fir, taps, ntaps, 0, width);
 	}
 	else if(s->conf.modulation == VID_AM ||
 	        s->conf.modulation == VID_NONE)
@@ -3719,7 +4538,7 @@ static int _init_vfilter(vid_t *s)
 		ntaps = 51;
 		
 		fir_low_pass(taps, ntaps, s->sample_rate, s->conf.video_bw, 0.75e6, 1);
-		fir_int16_init(&p->fir, taps, ntaps, 1, 1, _calc_filter_delay(width, ntaps));
+		_init_vfilter_fir(&p->fir, taps, ntaps, 0, width);
 	}
 	
 	if(p->fir.type == 0)
@@ -3736,6 +4555,340 @@ static int _init_vfilter(vid_t *s)
 	return(VID_OK);
 }
 
+static int _vid_load_frame(vid_t *s)
+{
+	/* Load the next frame */
+	if(s->bline == 1 || (s->conf.interlace && s->bline == s->conf.hline))
+	{
+		/* Have we reached the end of the video? */
+		if(av_eof(&s->av))
+		{
+			return(VID_ERROR);
+		}
+		
+		av_read_video(&s->av, &s->vframe);
+		
+		av_rotate_frame(&s->vframe, s->conf.frame_orientation & 3);
+		if(s->conf.frame_orientation & VID_HFLIP) av_hflip_frame(&s->vframe);
+		if(s->conf.frame_orientation & VID_VFLIP) av_vflip_frame(&s->vframe);
+		
+		/* Crop frame to fit inside active video area */
+		av_crop_frame(&s->vframe,
+			(s->vframe.width - s->active_width) / 2,
+			(s->vframe.height - s->conf.active_lines) / 2,
+			s->active_width,
+			s->conf.active_lines
+		);
+		
+		/* Calculate frame offset from top left */
+		s->vframe_x = (s->active_width - s->vframe.width) / 2;
+		s->vframe_y = (s->conf.active_lines - s->vframe.height) / 2;
+		
+		if(s->line_cache)
+		{
+			_update_line_cache(s);
+		}
+	}
+	
+	return(VID_OK);
+}
+
+static void _vid_run_processes(vid_t *s, int first, int last)
+{
+	int i, j;
+	
+	for(i = first; i < last; i++)
+	{
+		_lineprocess_t *p = &s->processes[i];
+		
+		if(p->process)
+		{
+			p->process(p->vid, p->arg, p->nlines, p->lines);
+		}
+		
+		for(j = 0; j < p->nlines; j++)
+		{
+			p->lines[j] = p->lines[j]->next;
+		}
+	}
+}
+
+static void _vid_advance_line(vid_t *s)
+{
+	/* Advance the next line/frame counter */
+	if(s->bline++ == s->conf.lines)
+	{
+		s->bline = 1;
+		s->bframe++;
+	}
+}
+
+/* Threaded line renderer
+ * 
+ * The line processes are divided into a number of stages, each run by
+ * its own worker thread. A stage can render its next line once the stage
+ * before it has finished with that line, and can get no more than
+ * _PIPELINE_DEPTH lines ahead of the stage that follows it. The line
+ * counters form a bounded single-producer / single-consumer queue
+ * between each pair of stages, the final consumer being vid_next_line().
+ * 
+ * Each stage owns the state of the processes it runs, and sees the
+ * lines in the same order as the non-threaded renderer, so the output
+ * is identical. The output buffer is enlarged so that the windows of
+ * stages running ahead never overlap those of the stages behind them.
+*/
+
+#define _PIPELINE_DEPTH 32
+
+typedef struct {
+	_vid_pipeline_t *pipeline;
+	
+	/* The range of processes run by this stage */
+	int first;
+	int last;
+	
+	pthread_t thread;
+	pthread_cond_t cond;
+	
+	/* Number of lines completed by this stage */
+	unsigned int lines;
+	int finished;
+	
+} _vid_stage_t;
+
+struct _vid_pipeline_t {
+	
+	vid_t *vid;
+	pthread_mutex_t mutex;
+	
+	/* The worker stages, plus one for the output */
+	int nworkers;
+	_vid_stage_t *stages;
+	
+	int running;
+	int abort;
+	
+	/* Set while the caller holds the last output line */
+	int held;
+};
+
+static void *_vid_stage_thread(void *arg)
+{
+	_vid_stage_t *st = arg;
+	_vid_pipeline_t *p = st->pipeline;
+	_vid_stage_t *prev = (st == p->stages ? NULL : st - 1);
+	_vid_stage_t *next = st + 1;
+	vid_t *s = p->vid;
+	int r;
+	
+	pthread_mutex_lock(&p->mutex);
+	
+	while(!p->abort)
+	{
+		if(prev != NULL && prev->lines == st->lines)
+		{
+			/* Wait for a line from the previous stage, or
+			 * stop if it has already finished */
+			if(prev->finished) break;
+			pthread_cond_wait(&st->cond, &p->mutex);
+			continue;
+		}
+		
+		if(st->lines - next->lines >= _PIPELINE_DEPTH)
+		{
+			/* Wait for the next stage to catch up */
+			pthread_cond_wait(&st->cond, &p->mutex);
+			continue;
+		}
+		
+		pthread_mutex_unlock(&p->mutex);
+		
+		r = VID_OK;
+		
+		if(prev == NULL)
+		{
+			r = _vid_load_frame(s);
+		}
+		
+		if(r == VID_OK)
+		{
+			_vid_run_processes(s, st->first, st->last);
+			
+			if(prev == NULL)
+			{
+				_vid_advance_line(s);
+			}
+		}
+		
+		pthread_mutex_lock(&p->mutex);
+		
+		if(r != VID_OK)
+		{
+			/* End of the source */
+			break;
+		}
+		
+		st->lines++;
+		
+		if(prev != NULL)
+		{
+			pthread_cond_signal(&prev->cond);
+		}
+		
+		pthread_cond_signal(&next->cond);
+	}
+	
+	st->finished = 1;
+	pthread_cond_signal(&next->cond);
+	
+	pthread_mutex_unlock(&p->mutex);
+	
+	return(NULL);
+}
+
+static void _stop_pipeline(vid_t *s)
+{
+	_vid_pipeline_t *p = s->pipeline;
+	int i;
+	
+	if(p == NULL || !p->running)
+	{
+		return;
+	}
+	
+	pthread_mutex_lock(&p->mutex);
+	p->abort = 1;
+	for(i = 0; i <= p->nworkers; i++)
+	{
+		pthread_cond_signal(&p->stages[i].cond);
+	}
+	pthread_mutex_unlock(&p->mutex);
+	
+	for(i = 0; i < p->nworkers; i++)
+	{
+		pthread_join(p->stages[i].thread, NULL);
+	}
+	
+	p->running = 0;
+	p->abort = 0;
+}
+
+static int _start_pipeline(vid_t *s)
+{
+	_vid_pipeline_t *p = s->pipeline;
+	int i;
+	
+	/* The stages continue from the line they stopped at */
+	for(i = 0; i <= p->nworkers; i++)
+	{
+		p->stages[i].finished = 0;
+	}
+	
+	p->abort = 0;
+	
+	for(i = 0; i < p->nworkers; i++)
+	{
+		if(pthread_create(&p->stages[i].thread, NULL, &_vid_stage_thread, &p->stages[i]) != 0)
+		{
+			fprintf(stderr, "Error starting line renderer thread\n");
+			
+			/* Stop any stages already running */
+			pthread_mutex_lock(&p->mutex);
+			p->abort = 1;
+			pthread_mutex_unlock(&p->mutex);
+			
+			while(i--)
+			{
+				pthread_cond_signal(&p->stages[i].cond);
+				pthread_join(p->stages[i].thread, NULL);
+			}
+			
+			p->abort = 0;
+			
+			return(VID_ERROR);
+		}
+	}
+	
+	p->running = 1;
+	
+	return(VID_OK);
+}
+
+static void _free_pipeline(vid_t *s)
+{
+	_vid_pipeline_t *p = s->pipeline;
+	int i;
+	
+	if(p == NULL)
+	{
+		return;
+	}
+	
+	_stop_pipeline(s);
+	
+	for(i = 0; i <= p->nworkers; i++)
+	{
+		pthread_cond_destroy(&p->stages[i].cond);
+	}
+	
+	pthread_mutex_destroy(&p->mutex);
+	free(p->stages);
+	free(p);
+	
+	s->pipeline = NULL;
+}
+
+static int _init_pipeline(vid_t *s)
+{
+	_vid_pipeline_t *p;
+	int i, w;
+	
+	p = calloc(1, sizeof(_vid_pipeline_t));
+	if(!p)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	p->vid = s;
+	p->nworkers = s->conf.threads < s->nstages ? s->conf.threads : s->nstages;
+	
+	p->stages = calloc(p->nworkers + 1, sizeof(_vid_stage_t));
+	if(!p->stages)
+	{
+		free(p);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	pthread_mutex_init(&p->mutex, NULL);
+	
+	for(i = 0; i <= p->nworkers; i++)
+	{
+		p->stages[i].pipeline = p;
+		pthread_cond_init(&p->stages[i].cond, NULL);
+	}
+	
+	/* Spread the stages over the worker threads. The final
+	 * output process is handled by vid_next_line() */
+	for(i = 0; i < s->nprocesses - 1; i++)
+	{
+		w = s->processes[i].stage * p->nworkers / s->nstages;
+		
+		if(p->stages[w].first == p->stages[w].last)
+		{
+			p->stages[w].first = i;
+		}
+		
+		p->stages[w].last = i + 1;
+	}
+	
+	/* Allow each worker to run ahead of the one that follows */
+	s->olines += p->nworkers * _PIPELINE_DEPTH;
+	
+	s->pipeline = p;
+	
+	return(VID_OK);
+}
+
 vbidata_lut_t *_render_sync_pulses(vid_t *s, const double syncs[][4], int num)
 {
 	int i, l;
@@ -3787,9 +4940,9 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	int r, x;
 	int64_t c;
 	double d;
-	double glut[0x100];
 	double width;
 	double level, slevel;
+	int split;
 	vid_line_t *l;
 	
 	/* Seed the system's PRNG, used by some of the video scramblers */
@@ -3857,65 +5010,30 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		return(VID_OUT_OF_MEMORY);
 	}
 	
-	/* Allocate memory for YUV lookup tables */
-	s->yiq_level_lookup = malloc(0x1000000 * sizeof(_yiq16_t));
-	if(s->yiq_level_lookup == NULL)
-	{
-		vid_free(s);
-		return(VID_OUT_OF_MEMORY);
-	}
-	
-	/* Generate the gamma lookup table. LUTception */
+	/* Generate the RGB > signal level tables */
 	if(s->conf.gamma <= 0)
 	{
 		s->conf.gamma = 1.0;
 	}
 	
-	for(c = 0; c < 0x100; c++)
-	{
-		glut[c] = pow((double) c / 255, 1 / s->conf.gamma);
-	}
-	
-	/* Generate the RGB > signal level lookup tables */
-	for(c = 0x000000; c <= 0xFFFFFF; c++)
-	{
-		double r, g, b;
-		double y, u, v;
-		double i, q;
-		
-		/* Calculate RGB 0..1 values */
-		r = glut[(c & 0xFF0000) >> 16];
-		g = glut[(c & 0x00FF00) >> 8];
-		b = glut[(c & 0x0000FF) >> 0];
-		
-		/* Calculate Y, Cb and Cr values */
-		y = r * s->conf.rw_co
-		  + g * s->conf.gw_co
-		  + b * s->conf.bw_co;
-		u = (b - y);
-		v = (r - y);
-		
-		i = s->conf.eu_co * u;
-		q = s->conf.ev_co * v;
-		
-		/* Adjust values to correct signal level */
-		y = (s->conf.black_level + (y * (s->conf.white_level - s->conf.black_level))) * level;
-		
-		if(s->conf.colour_mode != VID_SECAM)
-		{
-			i *= (s->conf.white_level - s->conf.black_level) * level;
-			q *= (s->conf.white_level - s->conf.black_level) * level;
-		}
-		else
-		{
-			i = (i + SECAM_CB_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
-			q = (q + SECAM_CR_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
-		}
-		
-		/* Convert to INT16 range and store in tables */
-		s->yiq_level_lookup[c].y = round(_dlimit(y, -1, 1) * INT16_MAX);
-		s->yiq_level_lookup[c].i = round(_dlimit(i, -1, 1) * INT16_MAX);
-		s->yiq_level_lookup[c].q = round(_dlimit(q, -1, 1) * INT16_MAX);
+	r = yiq_init(&s->yiq, s->conf.yiq_mode, s->conf.gamma,
+		s->conf.rw_co, s->conf.gw_co, s->conf.bw_co,
+		s->conf.eu_co, s->conf.ev_co,
+		s->conf.black_level, s->conf.white_level, level,
+		s->conf.colour_mode == VID_SECAM
+	);
+	if(r != 0)
+	{
+		vid_free(s);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	/* Line buffer for the Y, I and Q levels of the active video */
+	s->yiq_line = malloc(sizeof(int16_t) * 3 * s->active_width);
+	if(s->yiq_line == NULL)
+	{
+		vid_free(s);
+		return(VID_OUT_OF_MEMORY);
 	}
 	
 	if(s->conf.colour_mode == VID_PAL ||
@@ -4094,6 +5212,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		.interlaced = 0,
 	};
 	s->olines = 1;
+	s->nstages = 1;
 	s->audio = 0;
 	
 	if(s->conf.raw_bb_file != NULL)
@@ -4122,6 +5241,13 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	}
 	else
 	{
+		r = _init_line_cache(s);
+		if(r != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
+		
 		_add_lineprocess(s, "raster", 3, NULL, _vid_next_line_raster, NULL);
 	}
 	
@@ -4245,16 +5371,31 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		}
 	}
 	
+	/* The filters and audio may run in their own pipeline stages. MAC
+	 * and SiS share audio state with the raster and VBI processes, so
+	 * in those modes everything up to the audio stays in one stage */
+	split = (s->conf.type != VID_MAC && s->conf.sis == NULL);
+	
 	if(s->pixel_rate != s->sample_rate)
 	{
+		if(split) _new_stage(s);
 		_init_vresampler(s);
 	}
 	
 	if(s->conf.vfilter)
 	{
+		if(split) _new_stage(s);
 		_init_vfilter(s);
 	}
 	
+	/* Shared table for the audio carrier synthesisers */
+	s->nco_lut = _init_nco_lut();
+	if(!s->nco_lut)
+	{
+		vid_free(s);
+		return(VID_OUT_OF_MEMORY);
+	}
+	
 	if(s->conf.a2stereo)
 	{
 		/* Enable Zweikanalton / A2 Stereo */
@@ -4264,7 +5405,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		s->conf.fm_right_deviation = s->conf.fm_mono_deviation;
 		s->conf.fm_right_preemph = s->conf.fm_mono_preemph;
 		
-		r = _init_am_modulator(&s->a2stereo_pilot, s->sample_rate, (s->a2stereo_system_m ? 55.06993e3 : 54.6875e3), 0.05);
+		r = _init_am_modulator(&s->a2stereo_pilot, s->nco_lut, s->sample_rate, (s->a2stereo_system_m ? 55.06993e3 : 54.6875e3), 0.05);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4272,7 +5413,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 		}
 		
 		/* 117.5 Hz == Stereo (149.9 Hz for M variant) */
-		r = _init_am_modulator(&s->a2stereo_signal, s->sample_rate, (s->a2stereo_system_m ? 149.9 : 117.5), 1.0);
+		r = _init_am_modulator(&s->a2stereo_signal, s->nco_lut, s->sample_rate, (s->a2stereo_system_m ? 149.9 : 117.5), 1.0);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4286,7 +5427,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	/* FM audio */
 	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
 	{
-		r = _init_fm_modulator(&s->fm_mono, s->sample_rate, s->conf.fm_mono_carrier, s->conf.fm_mono_deviation, s->conf.fm_mono_level * slevel);
+		r = _init_fm_block_modulator(&s->fm_mono, s->nco_lut, s->sample_rate, s->conf.fm_mono_carrier, s->conf.fm_mono_deviation, s->conf.fm_mono_level * slevel);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4327,7 +5468,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	
 	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
 	{
-		r = _init_fm_modulator(&s->fm_left, s->sample_rate, s->conf.fm_left_carrier, s->conf.fm_left_deviation, s->conf.fm_left_level * slevel);
+		r = _init_fm_block_modulator(&s->fm_left, s->nco_lut, s->sample_rate, s->conf.fm_left_carrier, s->conf.fm_left_deviation, s->conf.fm_left_level * slevel);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4368,7 +5509,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	
 	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
 	{
-		r = _init_fm_modulator(&s->fm_right, s->sample_rate, s->conf.fm_right_carrier, s->conf.fm_right_deviation, s->conf.fm_right_level * slevel);
+		r = _init_fm_block_modulator(&s->fm_right, s->nco_lut, s->sample_rate, s->conf.fm_right_carrier, s->conf.fm_right_deviation, s->conf.fm_right_level * slevel);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4440,7 +5581,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	/* AM audio */
 	if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
 	{
-		r = _init_am_modulator(&s->am_mono, s->sample_rate, s->conf.am_mono_carrier, s->conf.am_audio_level * slevel);
+		r = _init_am_modulator(&s->am_mono, s->nco_lut, s->sample_rate, s->conf.am_mono_carrier, s->conf.am_audio_level * slevel);
 		if(r != VID_OK)
 		{
 			vid_free(s);
@@ -4453,9 +5594,64 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	/* Add the audio process */
 	if(s->audio == 1)
 	{
+		/* Most 32 kHz samples in one line */
+		s->audio_in_len = (s->max_width * HACKTV_AUDIO_SAMPLE_RATE + s->sample_rate - 1) / s->sample_rate + 1;
+		
+		s->audio_pre = malloc(sizeof(int16_t) * _AUDIO_CHANNELS * s->audio_in_len);
+		s->audio_pre_size = s->audio_in_len;
+		if(!s->audio_pre)
+		{
+			vid_free(s);
+			return(VID_OUT_OF_MEMORY);
+		}
+		
+		if(split) _new_stage(s);
 		_add_lineprocess(s, "audio", 1, NULL, _vid_audio_process, NULL);
 	}
 	
+	/* Add the audio carrier resampler and synthesiser */
+	s->audio_carriers = (s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0) ||
+	                    (s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0) ||
+	                    (s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0) ||
+	                    (s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0);
+	
+	if(s->audio_carriers)
+	{
+		_vid_audio_resampler_t *p;
+		double taps[_AUDIO_TAPS - 1];
+		
+		p = calloc(1, sizeof(_vid_audio_resampler_t));
+		if(!p)
+		{
+			vid_free(s);
+			return(VID_OUT_OF_MEMORY);
+		}
+		
+		p->fifo = calloc((_AUDIO_LAG + (s->audio_in_len + 1) * _AUDIO_INTERP) * _AUDIO_CHANNELS, sizeof(int16_t));
+		p->fifo_len = _AUDIO_LAG;
+		p->acc = 0;
+		
+		fir_low_pass(taps, _AUDIO_TAPS - 1, HACKTV_AUDIO_SAMPLE_RATE * _AUDIO_INTERP, 15000, 3300, _AUDIO_INTERP);
+		
+		for(r = 0; r < _AUDIO_CHANNELS; r++)
+		{
+			fir_int16_init(&p->fir[r], taps, _AUDIO_TAPS - 1, _AUDIO_INTERP, 1, 0);
+		}
+		
+		if(!p->fifo)
+		{
+			_vid_audio_resampler_free(s, p);
+			vid_free(s);
+			return(VID_OUT_OF_MEMORY);
+		}
+		
+		if(split) _new_stage(s);
+		_add_lineprocess(s, "audioresampler", 1, p, _vid_audio_resampler_process, _vid_audio_resampler_free);
+		
+		if(split) _new_stage(s);
+		_add_lineprocess(s, "audiocarriers", 1, NULL, _vid_audio_carrier_process, NULL);
+	}
+	
 	/* FM video */
 	if(s->conf.modulation == VID_FM)
 	{
@@ -4477,6 +5673,7 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			);
 		}
 		
+		_new_stage(s);
 		_add_lineprocess(s, "fmmod", 1, NULL, _vid_fmmod_process, NULL);
 	}
 	
@@ -4534,6 +5731,17 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 	_add_lineprocess(s, "output", 1, NULL, NULL, NULL);
 	s->output_process = &s->processes[s->nprocesses - 1];
 	
+	/* Setup the threaded line renderer, if enabled */
+	if(s->conf.threads > 0)
+	{
+		r = _init_pipeline(s);
+		if(r != VID_OK)
+		{
+			vid_free(s);
+			return(r);
+		}
+	}
+	
 	/* Output line buffer(s) */
 	s->oline = calloc(sizeof(vid_line_t), s->olines);
 	if(!s->oline)
@@ -4551,6 +5759,18 @@ int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const
 			return(VID_OUT_OF_MEMORY);
 		}
 		
+		if(s->audio_carriers)
+		{
+			s->oline[r].audio_in = malloc(sizeof(int16_t) * _AUDIO_CHANNELS * s->audio_in_len);
+			s->oline[r].audio = malloc(sizeof(int16_t) * _AUDIO_CHANNELS * s->max_width);
+			
+			if(!s->oline[r].audio_in || !s->oline[r].audio)
+			{
+				vid_free(s);
+				return(VID_OUT_OF_MEMORY);
+			}
+		}
+		
 		/* Blank the lines */
 		for(x = 0; x < s->width; x++)
 		{
@@ -4587,6 +5807,9 @@ void vid_free(vid_t *s)
 {
 	int i;
 	
+	/* Stop the line renderer threads */
+	_free_pipeline(s);
+	
 	/* Close the AV source */
 	av_close(&s->av);
 	
@@ -4658,8 +5881,10 @@ void vid_free(vid_t *s)
 	}
 	
 	/* Free allocated memory */
-	free(s->yiq_level_lookup);
+	yiq_free(&s->yiq);
+	free(s->yiq_line);
 	free(s->colour_lookup);
+	_free_line_cache(s);
 	fir_int16_free(&s->secam_l_fir);
 	fir_int16_free(&s->fm_secam_fir);
 	iir_int16_free(&s->fm_secam_iir);
@@ -4676,12 +5901,16 @@ void vid_free(vid_t *s)
 	dance_mod_free(&s->dance);
 	nicam_mod_free(&s->nicam);
 	_free_am_modulator(&s->am_mono);
+	free(s->nco_lut);
+	free(s->audio_pre);
 	
 	if(s->oline)
 	{
 		for(i = 0; i < s->olines; i++)
 		{
 			free(s->oline[i].output);
+			free(s->oline[i].audio_in);
+			free(s->oline[i].audio);
 		}
 		free(s->oline);
 	}
@@ -4714,60 +5943,111 @@ size_t vid_get_framebuffer_length(vid_t *s)
 	return(sizeof(uint32_t) * s->active_width * s->conf.active_lines);
 }
 
+int vid_accepts_yuv(vid_t *s)
+{
+	/* Planar YUV maps linearly to the signal levels only without
+	 * gamma correction, and the field sequential colour modes
+	 * need the individual RGB channels */
+	return(s->conf.gamma == 1.0 &&
+	       s->conf.colour_mode != VID_APOLLO_FSC &&
+	       s->conf.colour_mode != VID_CBS_FSC);
+}
+
+void vid_frame_levels(vid_t *s, int16_t *y, int16_t *i, int16_t *q, int x, int vy, int step, int n, int grey)
+{
+	const av_frame_t *f = &s->vframe;
+	uint32_t rgb = 0x000000;
+	int c;
+	
+	if(vy >= 0 && f->framebuffer != NULL)
+	{
+		yiq_process(&s->yiq, y, i, q,
+			&f->framebuffer[vy * f->line_stride + x * f->pixel_stride],
+			f->pixel_stride * step, n, grey
+		);
+	}
+	else if(vy >= 0 && f->yuv[0] != NULL)
+	{
+		c  = ((vy + f->yuv_cy) >> 1) * f->yuv_line_stride[1];
+		c += ((x + f->yuv_cx) >> 1) * f->yuv_pixel_stride[1];
+		
+		yiq_process_yuv(&s->yiq, y, i, q,
+			f->yuv[0] + vy * f->yuv_line_stride[0] + x * f->yuv_pixel_stride[0],
+			f->yuv_pixel_stride[0] * step,
+			f->yuv[1] + c, f->yuv[2] + c,
+			f->yuv_pixel_stride[1], (x + f->yuv_cx) & 1, step, n,
+			f->yuv_matrix
+		);
+	}
+	else
+	{
+		/* Outside the frame, or there isn't one */
+		yiq_process(&s->yiq, y, i, q, &rgb, 0, n, grey);
+	}
+}
+
 static vid_line_t *_vid_next_line(vid_t *s, size_t *samples)
 {
 	vid_line_t *l = s->output_process->lines[0];
-	int i, j;
 	
-	/* Load the next frame */
-	if(s->bline == 1 || (s->conf.interlace && s->bline == s->conf.hline))
+	if(_vid_load_frame(s) != VID_OK)
 	{
-		/* Have we reached the end of the video? */
-		if(av_eof(&s->av))
-		{
-			return(NULL);
-		}
-		
-		av_read_video(&s->av, &s->vframe);
-		
-		av_rotate_frame(&s->vframe, s->conf.frame_orientation & 3);
-		if(s->conf.frame_orientation & VID_HFLIP) av_hflip_frame(&s->vframe);
-		if(s->conf.frame_orientation & VID_VFLIP) av_vflip_frame(&s->vframe);
-		
-		/* Crop frame to fit inside active video area */
-		av_crop_frame(&s->vframe,
-			(s->vframe.width - s->active_width) / 2,
-			(s->vframe.height - s->conf.active_lines) / 2,
-			s->active_width,
-			s->conf.active_lines
-		);
-		
-		/* Calculate frame offset from top left */
-		s->vframe_x = (s->active_width - s->vframe.width) / 2;
-		s->vframe_y = (s->conf.active_lines - s->vframe.height) / 2;
+		return(NULL);
 	}
 	
-	for(i = 0; i < s->nprocesses; i++)
+	_vid_run_processes(s, 0, s->nprocesses);
+	_vid_advance_line(s);
+	
+	/* Return a pointer to the output buffer */
+	if(samples)
 	{
-		_lineprocess_t *p = &s->processes[i];
-		
-		if(p->process)
+		*samples = l->width;
+	}
+	
+	return(l);
+}
+
+static vid_line_t *_vid_next_line_threaded(vid_t *s, size_t *samples)
+{
+	_vid_pipeline_t *p = s->pipeline;
+	_vid_stage_t *out = &p->stages[p->nworkers];
+	_vid_stage_t *last = out - 1;
+	vid_line_t *l;
+	
+	if(!p->running && _start_pipeline(s) != VID_OK)
+	{
+		return(NULL);
+	}
+	
+	pthread_mutex_lock(&p->mutex);
+	
+	if(p->held)
+	{
+		/* Hand the previous output line back to the pipeline */
+		s->output_process->lines[0] = s->output_process->lines[0]->next;
+		out->lines++;
+		p->held = 0;
+		pthread_cond_signal(&last->cond);
+	}
+	
+	while(last->lines == out->lines)
+	{
+		if(last->finished)
 		{
-			p->process(p->vid, p->arg, p->nlines, p->lines);
+			/* The source has ended and the pipeline is empty */
+			pthread_mutex_unlock(&p->mutex);
+			_stop_pipeline(s);
+			return(NULL);
 		}
 		
-		for(j = 0; j < p->nlines; j++)
-		{
-			p->lines[j] = p->lines[j]->next;
-		}
+		pthread_cond_wait(&out->cond, &p->mutex);
 	}
 	
-	/* Advance the next line/frame counter */
-	if(s->bline++ == s->conf.lines)
-	{
-		s->bline = 1;
-		s->bframe++;
-	}
+	p->held = 1;
+	
+	pthread_mutex_unlock(&p->mutex);
+	
+	l = s->output_process->lines[0];
 	
 	/* Return a pointer to the output buffer */
 	if(samples)
@@ -4785,7 +6065,7 @@ int16_t *vid_next_line(vid_t *s, size_t *samples)
 	/* Drop any delay lines introduced by scramblers / filters */
 	do
 	{
-		l = _vid_next_line(s, samples);
+		l = s->pipeline ? _vid_next_line_threaded(s, samples) : _vid_next_line(s, samples);
 		if(l == NULL) return(NULL);
 	}
 	while(l->line < 1);
@@ -4796,3 +6076,237 @@ int16_t *vid_next_line(vid_t *s, size_t *samples)
 	return(l->output);
 }
 
+int vid_next_block(vid_t *s, int16_t *dst, size_t max_samples, size_t *written)
+{
+	int lines = 0;
+	
+	/* Copy as many whole lines into dst as will fit. A line
+	 * that doesn't fit is held over for the next call. Returns
+	 * the number of lines, or 0 at the end of the source */
+	*written = 0;
+	
+	while(1)
+	{
+		if(s->block_line == NULL)
+		{
+			s->block_line = vid_next_line(s, &s->block_samples);
+			if(s->block_line == NULL) break;
+		}
+		
+		if(*written + s->block_samples > max_samples)
+		{
+			/* dst is too small for even one line */
+			if(lines == 0) return(VID_ERROR);
+			break;
+		}
+		
+		memcpy(&dst[*written * 2], s->block_line, s->block_samples * 2 * sizeof(int16_t));
+		*written += s->block_samples;
+		s->block_line = NULL;
+		lines++;
+	}
+	
+	return(lines);
+}
+
+int vid_av_close(vid_t *s)
+{
+	/* Stop the line renderer threads before closing the source */
+	_stop_pipeline(s);
+	
+	s->block_line = NULL;
+	s->loop_frames = 0;
+	
+	/* Drop any audio still buffered from this source */
+	s->audiobuffer = NULL;
+	s->audiobuffer_samples = 0;
+	
+	return(av_close(&s->av));
+}
+
+
+/* Seamless loops
+ * 
+ * With a source that repeats, the output repeats once every periodic
+ * part of the signal has completed a whole number of cycles. These are
+ * the colour subcarrier sequence, each of the audio and data carriers
+ * and clocks, and the source itself. The DQPSK modulators for NICAM and
+ * DANCE add a carrier phase rotation that can differ each time round,
+ * which is always back where it started after four loops.
+*/
+
+#define _LOOP_MAX_FRAMES (1 << 16)
+
+static int64_t _loop_lcm(int64_t a, int64_t b)
+{
+	if(a == 0 || b == 0) return(0);
+	
+	a = a / gcd(a, b) * b;
+	
+	return(a <= _LOOP_MAX_FRAMES ? a : 0);
+}
+
+static int64_t _loop_frames_hz(vid_t *s, double hz)
+{
+	int64_t n, d;
+	
+	/* The number of frames that hold a whole number of cycles.
+	 * Frequencies are rounded to the nearest mHz */
+	n = llabs(llround(hz * 1000)) * s->conf.frame_rate.den;
+	d = (int64_t) s->conf.frame_rate.num * 1000;
+	
+	if(n == 0) return(1);
+	
+	return(d / gcd(n, d));
+}
+
+int vid_loop_frames(vid_t *s)
+{
+	int64_t frames = 1;
+	int dqpsk = 0;
+	
+	/* These generate new data every frame and never repeat */
+	if(s->conf.type == VID_MAC ||
+	   s->conf.raw_bb_file ||
+	   s->conf.passthru ||
+	   s->conf.teletext ||
+	   s->conf.vitc ||
+	   s->conf.sis ||
+	   s->conf.videocrypt ||
+	   s->conf.videocrypt2 ||
+	   s->conf.videocrypts ||
+	   s->conf.syster)
+	{
+		return(0);
+	}
+	
+	/* The phase of an FM video carrier drifts with the picture */
+	if(s->conf.modulation == VID_FM)
+	{
+		return(0);
+	}
+	
+	/* Only a source that says it repeats, or is a still image */
+	if(s->av.period.den <= 0)
+	{
+		return(0);
+	}
+	
+	/* The colour sequence */
+	if(s->conf.colour_mode == VID_PAL ||
+	   s->conf.colour_mode == VID_NTSC)
+	{
+		frames = _colour_cycle_frames(s);
+	}
+	else if(s->conf.colour_mode == VID_SECAM)
+	{
+		/* Lines alternate D'r / D'b, and the FM phase resets every third line */
+		frames = _loop_lcm(s->conf.lines % 2 ? 2 : 1, s->conf.lines % 3 ? 3 : 1);
+	}
+	else if(s->conf.colour_mode == VID_APOLLO_FSC ||
+	        s->conf.colour_mode == VID_CBS_FSC)
+	{
+		frames = 3;
+	}
+	
+	if(s->conf.acp)
+	{
+		/* The AGC pulses cycle over 428 frames */
+		frames = _loop_lcm(frames, 428);
+	}
+	
+	if(s->conf.offset != 0)
+	{
+		frames = _loop_lcm(frames, _loop_frames_hz(s, s->conf.offset));
+	}
+	
+	if(s->audio)
+	{
+		/* The audio sample clock */
+		frames = _loop_lcm(frames, _loop_frames_hz(s, HACKTV_AUDIO_SAMPLE_RATE));
+	}
+	
+	if(s->av.period.num > 0)
+	{
+		int64_t n = (int64_t) s->av.period.num * s->conf.frame_rate.num;
+		int64_t d = (int64_t) s->av.period.den * s->conf.frame_rate.den;
+		
+		/* A source that doesn't end on a frame boundary never lines up */
+		frames = (n % d == 0 ? _loop_lcm(frames, n / d) : 0);
+	}
+	
+	if(s->conf.fm_mono_level > 0 && s->conf.fm_mono_carrier != 0)
+	{
+		frames = _loop_lcm(frames, _loop_frames_hz(s, s->conf.fm_mono_carrier));
+	}
+	
+	if(s->conf.fm_left_level > 0 && s->conf.fm_left_carrier != 0)
+	{
+		frames = _loop_lcm(frames, _loop_frames_hz(s, s->conf.fm_left_carrier));
+	}
+	
+	if(s->conf.fm_right_level > 0 && s->conf.fm_right_carrier != 0)
+	{
+		frames = _loop_lcm(frames, _loop_frames_hz(s, s->conf.fm_right_carrier));
+	}
+	
+	if(s->conf.a2stereo)
+	{
+		/* The pilot and its identification tone */
+		frames = _loop_lcm(frames, _loop_frames_hz(s, s->a2stereo_system_m ? 55.06993e3 : 54.6875e3));
+		frames = _loop_lcm(frames, _loop_frames_hz(s, s->a2stereo_system_m ? 149.9 : 117.5));
+	}
+	
+	if(s->conf.am_audio_level > 0 && s->conf.am_mono_carrier != 0)
+	{
+		frames = _loop_lcm(frames, _loop_frames_hz(s, s->conf.am_mono_carrier));
+	}
+	
+	if(s->conf.nicam_level > 0 && s->conf.nicam_carrier != 0)
+	{
+		/* The carrier, the 364 kHz symbol clock and
+		 * the C0 flag, which toggles every 8 ms */
+		frames = _loop_lcm(frames, _loop_frames_hz(s, s->conf.nicam_carrier));
+		frames = _loop_lcm(frames, _loop_frames_hz(s, NICAM_SYMBOL_RATE));
+		frames = _loop_lcm(frames, _loop_frames_hz(s, 1000.0 / 16));
+		dqpsk = 1;
+	}
+	
+	if(s->conf.dance_level > 0 && s->conf.dance_carrier != 0)
+	{
+		/* The carrier, the 1.024 MHz symbol clock and the
+		 * 1 ms frames, which are interleaved in pairs */
+		frames = _loop_lcm(frames, _loop_frames_hz(s, s->conf.dance_carrier));
+		frames = _loop_lcm(frames, _loop_frames_hz(s, DANCE_SYMBOL_RATE));
+		frames = _loop_lcm(frames, _loop_frames_hz(s, 1000.0 / 2));
+		dqpsk = 1;
+	}
+	
+	if(dqpsk)
+	{
+		/* A DQPSK carrier can end each pass a quarter turn
+		 * from where it started, only four line up */
+		frames = (frames <= _LOOP_MAX_FRAMES / 4 ? frames * 4 : 0);
+	}
+	
+	return(frames);
+}
+
+int vid_loop_start(vid_t *s, int frames)
+{
+	/* Sets up the loop of frames returned by vid_loop_frames().
+	 * Call this before the first line is rendered. The audio
+	 * carriers need a pass or two to measure their phase drift,
+	 * the loop begins at line 1 of the frame number returned */
+	s->loop_frames = frames;
+	s->loop_start = s->bframe + 1;
+	
+	if(s->audio_carriers)
+	{
+		s->loop_start += frames * (s->conf.a2stereo ? 2 : 1);
+	}
+	
+	s->loop_samples = 0;
+	
+	return(s->loop_start);
+}
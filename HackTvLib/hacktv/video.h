@@ -24,6 +24,7 @@
 #include "nicam728.h"
 #include "dance.h"
 #include "fir.h"
+#include "yiq.h"
 
 typedef struct vid_line_t vid_line_t;
 typedef struct vid_t vid_t;
@@ -87,6 +88,15 @@ typedef struct vid_t vid_t;
 
 /* RF modulation */
 
+/* Phase correction for the audio carrier synthesisers,
+ * used to close a seamless loop. See vid_loop_start() */
+typedef struct {
+    uint32_t phase;
+    uint64_t r;
+    uint64_t acc;
+    uint64_t len;
+} _nco_loop_t;
+
 typedef struct {
     int16_t level;
     int32_t counter;
@@ -94,22 +104,27 @@ typedef struct {
     cint32_t *lut;
 
     limiter_t limiter;
-    int16_t sample;
 
     /* FM energy dispersal */
     div_t ed_delta;
     div_t ed_counter;
     div_t ed_overflow;
 
+    /* Block synthesiser state, used by the audio carriers */
+    const int16_t *nco_lut;
+    uint32_t nco_phase;
+    uint32_t nco_delta;
+    int64_t nco_deviation;
+    _nco_loop_t nco_loop;
+
 } _mod_fm_t;
 
 typedef struct {
     int16_t level;
-    int32_t counter;
-    cint32_t phase;
-    cint32_t delta;
-
-    int16_t sample;
+    const int16_t *nco_lut;
+    uint32_t nco_phase;
+    uint32_t nco_delta;
+    _nco_loop_t nco_loop;
 
 } _mod_am_t;
 
@@ -273,6 +288,12 @@ typedef struct {
     /* Video filter enable flag */
     int vfilter;
 
+    /* Number of line renderer threads (0 = render inline) */
+    int threads;
+
+    /* RGB to YIQ conversion mode (YIQ_*) */
+    int yiq_mode;
+
 } vid_config_t;
 
 typedef struct {
@@ -281,12 +302,6 @@ typedef struct {
     const char *desc;
 } vid_configs_t;
 
-typedef struct {
-    int16_t y;
-    int16_t i;
-    int16_t q;
-} _yiq16_t;
-
 struct vid_line_t {
 
     /* The output line buffer */
@@ -300,6 +315,13 @@ struct vid_line_t {
     /* Colour subcarrier (complex) */
     const cint16_t *lut;
 
+    /* Audio carrier input. The 32 kHz samples that fall within this
+     * line with the channels interleaved, then the same resampled to
+     * one per output sample, one channel every max_width samples */
+    int16_t *audio_in;
+    int audio_samples;
+    int16_t *audio;
+
     /* Status */
     int vbialloc;
 
@@ -312,6 +334,8 @@ struct vid_line_t {
 typedef int (*vid_lineprocess_process_t)(vid_t *s, void *arg, int nlines, vid_line_t **lines);
 typedef void (*vid_lineprocess_free_t)(vid_t *s, void *arg);
 typedef struct _lineprocess_t _lineprocess_t;
+typedef struct _vid_pipeline_t _vid_pipeline_t;
+typedef struct _vid_line_cache_t _vid_line_cache_t;
 
 struct _lineprocess_t {
 
@@ -322,6 +346,9 @@ struct _lineprocess_t {
     int nlines;
     vid_line_t **lines;
 
+    /* Pipeline stage this process belongs to */
+    int stage;
+
     /* Process callbacks */
     vid_lineprocess_process_t process;
     vid_lineprocess_free_t free;
@@ -355,7 +382,8 @@ struct vid_t {
     int16_t blanking_level;
     int16_t sync_level;
 
-    _yiq16_t *yiq_level_lookup;
+    yiq_t yiq;
+    int16_t *yiq_line;
 
     unsigned int colour_lookup_width;
     unsigned int colour_lookup_offset;
@@ -381,6 +409,7 @@ struct vid_t {
     av_frame_t vframe;
     int vframe_x;
     int vframe_y;
+    uint64_t vframe_hash;
 
     /* The frame and line number being rendered next */
     int bframe;
@@ -390,6 +419,10 @@ struct vid_t {
     int frame;
     int line;
 
+    /* A line that didn't fit in the last vid_next_block() */
+    int16_t *block_line;
+    size_t block_samples;
+
     /* Raw baseband video file */
     FILE *raw_bb_file;
 
@@ -417,8 +450,14 @@ struct vid_t {
 
     /* Audio state */
     int audio;
+    int audio_carriers;
+    int audio_in_len;
+    int16_t *nco_lut;
     int16_t *audiobuffer;
     size_t audiobuffer_samples;
+    int16_t *audio_pre;
+    size_t audio_pre_len;
+    size_t audio_pre_size;
     int interp;
 
     /* FM Mono/Stereo audio state */
@@ -469,6 +508,18 @@ struct vid_t {
     int nprocesses;
     _lineprocess_t *processes;
     _lineprocess_t *output_process;
+
+    /* Threaded line renderer */
+    int nstages;
+    _vid_pipeline_t *pipeline;
+
+    /* Rendered raster lines */
+    _vid_line_cache_t *line_cache;
+
+    /* Seamless loop */
+    int loop_frames;
+    int loop_start;
+    uint64_t loop_samples;
 };
 
 extern const vid_configs_t vid_configs[];
@@ -480,9 +531,14 @@ extern "C" {
 int vid_init(vid_t *s, unsigned int sample_rate, unsigned int pixel_rate, const vid_config_t * const conf);
 void vid_free(vid_t *s);
 int vid_av_close(vid_t *s);
+int vid_loop_frames(vid_t *s);
+int vid_loop_start(vid_t *s, int frames);
 void vid_info(vid_t *s);
 size_t vid_get_framebuffer_length(vid_t *s);
+int vid_accepts_yuv(vid_t *s);
+void vid_frame_levels(vid_t *s, int16_t *y, int16_t *i, int16_t *q, int x, int vy, int step, int n, int grey);
 int16_t *vid_next_line(vid_t *s, size_t *samples);
+int vid_next_block(vid_t *s, int16_t *dst, size_t max_samples, size_t *written);
 
 #ifdef __cplusplus
 }
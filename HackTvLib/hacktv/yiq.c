@@ -0,0 +1,529 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* RGB to YIQ level conversion.
+ * 
+ * The levels were originally looked up in a table with an entry for
+ * every 24-bit RGB value. That table is 96MB, slow to generate and
+ * scattered lookups into it are unkind to the CPU caches. Here each
+ * pixel is calculated from small per-channel tables instead, using the
+ * same double precision operations in the same order as the table was
+ * generated with, so the output is identical. The full table is still
+ * available as YIQ_TABLE for comparison.
+ * 
+ * The SIMD versions rely on the compiler not fusing multiply-adds, which
+ * is the case for the targets enabled here. Where a compiler does fuse
+ * them the levels may differ from the table by +/-1.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "yiq.h"
+#include "common.h"
+
+#ifdef CPU_X86
+#include <immintrin.h>
+#endif
+
+#define SECAM_FM_DEV 1000e3
+#define SECAM_FM_FREQ 4328125 /* 277 fH */
+#define SECAM_CB_FREQ 4250000 /* 272 fH */
+#define SECAM_CR_FREQ 4406250 /* 282 fH */
+
+static double _dlimit(double v, double min, double max)
+{
+	if(v < min) return(min);
+	if(v > max) return(max);
+	return(v);
+}
+
+static inline void _channels(uint32_t c, int grey, int *r, int *g, int *b)
+{
+	if(grey >= 0)
+	{
+		*r = *g = *b = (c >> grey) & 0xFF;
+	}
+	else
+	{
+		*r = (c & 0xFF0000) >> 16;
+		*g = (c & 0x00FF00) >> 8;
+		*b = (c & 0x0000FF) >> 0;
+	}
+}
+
+static inline void _yiq_calc(const yiq_t *s, int16_t *py, int16_t *pi, int16_t *pq, int r, int g, int b)
+{
+	double y, u, v;
+	double i, q;
+	
+	/* Calculate Y, Cb and Cr values */
+	y = s->rw[r] + s->gw[g] + s->bw[b];
+	
+	if(pi != NULL)
+	{
+		u = (s->g[b] - y);
+		v = (s->g[r] - y);
+		
+		i = s->eu_co * u;
+		q = s->ev_co * v;
+		
+		if(!s->secam)
+		{
+			i *= s->iq_level;
+			q *= s->iq_level;
+		}
+		else
+		{
+			i = (i + SECAM_CB_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
+			q = (q + SECAM_CR_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV;
+		}
+		
+		*pi = round(_dlimit(i, -1, 1) * INT16_MAX);
+		*pq = round(_dlimit(q, -1, 1) * INT16_MAX);
+	}
+	
+	/* Adjust values to correct signal level */
+	y = (s->black_level + (y * s->white_black)) * s->level;
+	
+	*py = round(_dlimit(y, -1, 1) * INT16_MAX);
+}
+
+static void _yiq_scalar(const yiq_t *s, int16_t *y, int16_t *i, int16_t *q, const uint32_t *src, int stride, int n, int grey)
+{
+	int x, r, g, b;
+	
+	for(x = 0; x < n; x++, src += stride)
+	{
+		_channels(*src, grey, &r, &g, &b);
+		_yiq_calc(s, &y[x], i ? &i[x] : NULL, i ? &q[x] : NULL, r, g, b);
+	}
+}
+
+static void _yiq_table(const yiq_t *s, int16_t *y, int16_t *i, int16_t *q, const uint32_t *src, int stride, int n, int grey)
+{
+	const _yiq16_t *p;
+	uint32_t c;
+	int x;
+	
+	for(x = 0; x < n; x++, src += stride)
+	{
+		c = *src & 0xFFFFFF;
+		
+		if(grey >= 0)
+		{
+			c  = (c >> grey) & 0xFF;
+			c |= (c << 8) | (c << 16);
+		}
+		
+		p = &s->lut[c];
+		
+		y[x] = p->y;
+		
+		if(i != NULL)
+		{
+			i[x] = p->i;
+			q[x] = p->q;
+		}
+	}
+}
+
+#ifdef CPU_X86
+
+/* round(_dlimit(v, -1, 1) * INT16_MAX), two doubles at a time. Rounds
+ * half away from zero, the same as round() */
+__attribute__((target("sse2")))
+static inline __m128i _level_sse2(__m128d v)
+{
+	const __m128d one = _mm_set1_pd(1.0);
+	const __m128d half = _mm_set1_pd(0.5);
+	__m128d t, d, a;
+	__m128i r;
+	
+	v = _mm_min_pd(_mm_max_pd(v, _mm_set1_pd(-1.0)), one);
+	v = _mm_mul_pd(v, _mm_set1_pd(INT16_MAX));
+	
+	r = _mm_cvttpd_epi32(v);
+	t = _mm_cvtepi32_pd(r);
+	d = _mm_sub_pd(v, t);
+	
+	a = _mm_and_pd(_mm_cmpge_pd(d, half), one);
+	a = _mm_sub_pd(a, _mm_and_pd(_mm_cmple_pd(d, _mm_sub_pd(_mm_setzero_pd(), half)), one));
+	
+	return(_mm_cvttpd_epi32(_mm_add_pd(t, a)));
+}
+
+__attribute__((target("sse2")))
+static void _yiq_sse2(const yiq_t *s, int16_t *y, int16_t *i, int16_t *q, const uint32_t *src, int stride, int n, int grey)
+{
+	const __m128d black_level = _mm_set1_pd(s->black_level);
+	const __m128d white_black = _mm_set1_pd(s->white_black);
+	const __m128d level = _mm_set1_pd(s->level);
+	const __m128d eu_co = _mm_set1_pd(s->eu_co);
+	const __m128d ev_co = _mm_set1_pd(s->ev_co);
+	const __m128d iq_level = _mm_set1_pd(s->iq_level);
+	const __m128d cb = _mm_set1_pd(SECAM_CB_FREQ);
+	const __m128d cr = _mm_set1_pd(SECAM_CR_FREQ);
+	const __m128d fm = _mm_set1_pd(SECAM_FM_FREQ);
+	const __m128d dev = _mm_set1_pd(SECAM_FM_DEV);
+	int x, r[2], g[2], b[2];
+	__m128d vy, vu, vv;
+	__m128i l;
+	
+	for(x = 0; x + 2 <= n; x += 2)
+	{
+		_channels(src[(x + 0) * stride], grey, &r[0], &g[0], &b[0]);
+		_channels(src[(x + 1) * stride], grey, &r[1], &g[1], &b[1]);
+		
+		vy = _mm_add_pd(
+			_mm_add_pd(
+				_mm_set_pd(s->rw[r[1]], s->rw[r[0]]),
+				_mm_set_pd(s->gw[g[1]], s->gw[g[0]])
+			),
+			_mm_set_pd(s->bw[b[1]], s->bw[b[0]])
+		);
+		
+		if(i != NULL)
+		{
+			vu = _mm_mul_pd(eu_co, _mm_sub_pd(_mm_set_pd(s->g[b[1]], s->g[b[0]]), vy));
+			vv = _mm_mul_pd(ev_co, _mm_sub_pd(_mm_set_pd(s->g[r[1]], s->g[r[0]]), vy));
+			
+			if(!s->secam)
+			{
+				vu = _mm_mul_pd(vu, iq_level);
+				vv = _mm_mul_pd(vv, iq_level);
+			}
+			else
+			{
+				vu = _mm_div_pd(_mm_sub_pd(_mm_add_pd(vu, cb), fm), dev);
+				vv = _mm_div_pd(_mm_sub_pd(_mm_add_pd(vv, cr), fm), dev);
+			}
+			
+			l = _mm_packs_epi32(_level_sse2(vu), _level_sse2(vv));
+			i[x + 0] = _mm_extract_epi16(l, 0);
+			i[x + 1] = _mm_extract_epi16(l, 1);
+			q[x + 0] = _mm_extract_epi16(l, 4);
+			q[x + 1] = _mm_extract_epi16(l, 5);
+		}
+		
+		vy = _mm_mul_pd(_mm_add_pd(black_level, _mm_mul_pd(vy, white_black)), level);
+		
+		l = _mm_packs_epi32(_level_sse2(vy), _level_sse2(vy));
+		y[x + 0] = _mm_extract_epi16(l, 0);
+		y[x + 1] = _mm_extract_epi16(l, 1);
+	}
+	
+	if(x < n)
+	{
+		_yiq_scalar(s, &y[x], i ? &i[x] : NULL, q ? &q[x] : NULL, &src[x * stride], stride, n - x, grey);
+	}
+}
+
+__attribute__((target("avx2")))
+static inline __m128i _level_avx2(__m256d v)
+{
+	const __m256d one = _mm256_set1_pd(1.0);
+	const __m256d half = _mm256_set1_pd(0.5);
+	__m256d t, d, a;
+	
+	v = _mm256_min_pd(_mm256_max_pd(v, _mm256_set1_pd(-1.0)), one);
+	v = _mm256_mul_pd(v, _mm256_set1_pd(INT16_MAX));
+	
+	t = _mm256_cvtepi32_pd(_mm256_cvttpd_epi32(v));
+	d = _mm256_sub_pd(v, t);
+	
+	a = _mm256_and_pd(_mm256_cmp_pd(d, half, _CMP_GE_OQ), one);
+	a = _mm256_sub_pd(a, _mm256_and_pd(_mm256_cmp_pd(d, _mm256_sub_pd(_mm256_setzero_pd(), half), _CMP_LE_OQ), one));
+	
+	return(_mm256_cvttpd_epi32(_mm256_add_pd(t, a)));
+}
+
+__attribute__((target("avx2")))
+static void _yiq_avx2(const yiq_t *s, int16_t *y, int16_t *i, int16_t *q, const uint32_t *src, int stride, int n, int grey)
+{
+	const __m256d black_level = _mm256_set1_pd(s->black_level);
+	const __m256d white_black = _mm256_set1_pd(s->white_black);
+	const __m256d level = _mm256_set1_pd(s->level);
+	const __m256d eu_co = _mm256_set1_pd(s->eu_co);
+	const __m256d ev_co = _mm256_set1_pd(s->ev_co);
+	const __m256d iq_level = _mm256_set1_pd(s->iq_level);
+	const __m256d cb = _mm256_set1_pd(SECAM_CB_FREQ);
+	const __m256d cr = _mm256_set1_pd(SECAM_CR_FREQ);
+	const __m256d fm = _mm256_set1_pd(SECAM_FM_FREQ);
+	const __m256d dev = _mm256_set1_pd(SECAM_FM_DEV);
+	const __m128i mask = _mm_set1_epi32(0xFF);
+	const __m128i vstride = _mm_mullo_epi32(_mm_set_epi32(3, 2, 1, 0), _mm_set1_epi32(stride));
+	const __m128i rs = _mm_cvtsi32_si128(grey >= 0 ? grey : 16);
+	const __m128i gs = _mm_cvtsi32_si128(grey >= 0 ? grey : 8);
+	const __m128i bs = _mm_cvtsi32_si128(grey >= 0 ? grey : 0);
+	__m128i px, r, g, b;
+	__m256d vy, vu, vv;
+	int x;
+	
+	for(x = 0; x + 4 <= n; x += 4)
+	{
+		if(stride == 1)
+		{
+			px = _mm_loadu_si128((const __m128i *) &src[x]);
+		}
+		else
+		{
+			px = _mm_i32gather_epi32((const int *) &src[x * stride], vstride, 4);
+		}
+		
+		r = _mm_and_si128(_mm_srl_epi32(px, rs), mask);
+		g = _mm_and_si128(_mm_srl_epi32(px, gs), mask);
+		b = _mm_and_si128(_mm_srl_epi32(px, bs), mask);
+		
+		vy = _mm256_add_pd(
+			_mm256_add_pd(
+				_mm256_i32gather_pd(s->rw, r, 8),
+				_mm256_i32gather_pd(s->gw, g, 8)
+			),
+			_mm256_i32gather_pd(s->bw, b, 8)
+		);
+		
+		if(i != NULL)
+		{
+			vu = _mm256_mul_pd(eu_co, _mm256_sub_pd(_mm256_i32gather_pd(s->g, b, 8), vy));
+			vv = _mm256_mul_pd(ev_co, _mm256_sub_pd(_mm256_i32gather_pd(s->g, r, 8), vy));
+			
+			if(!s->secam)
+			{
+				vu = _mm256_mul_pd(vu, iq_level);
+				vv = _mm256_mul_pd(vv, iq_level);
+			}
+			else
+			{
+				vu = _mm256_div_pd(_mm256_sub_pd(_mm256_add_pd(vu, cb), fm), dev);
+				vv = _mm256_div_pd(_mm256_sub_pd(_mm256_add_pd(vv, cr), fm), dev);
+			}
+			
+			_mm_storel_epi64((__m128i *) &i[x], _mm_packs_epi32(_level_avx2(vu), _mm_setzero_si128()));
+			_mm_storel_epi64((__m128i *) &q[x], _mm_packs_epi32(_level_avx2(vv), _mm_setzero_si128()));
+		}
+		
+		vy = _mm256_mul_pd(_mm256_add_pd(black_level, _mm256_mul_pd(vy, white_black)), level);
+		
+		_mm_storel_epi64((__m128i *) &y[x], _mm_packs_epi32(_level_avx2(vy), _mm_setzero_si128()));
+	}
+	
+	if(x < n)
+	{
+		_yiq_scalar(s, &y[x], i ? &i[x] : NULL, q ? &q[x] : NULL, &src[x * stride], stride, n - x, grey);
+	}
+}
+
+#endif
+
+static void _yiq_yuv_init(yiq_t *s, double rw_co, double gw_co, double bw_co)
+{
+	static const double k[2][2] = {
+		{ 0.299,  0.114  }, /* AV_YUV_BT601 */
+		{ 0.2126, 0.0722 }, /* AV_YUV_BT709 */
+	};
+	double rgb[3][3], l[3][3], c[3], kr, kb, kg, v;
+	int m, j, n, x;
+	
+	for(m = 0; m < 2; m++)
+	{
+		kr = k[m][0];
+		kb = k[m][1];
+		kg = 1.0 - kr - kb;
+		
+		/* R, G and B from normalised Y, Pb and Pr */
+		rgb[0][0] = 1; rgb[0][1] = 0;                            rgb[0][2] = 2 * (1 - kr);
+		rgb[1][0] = 1; rgb[1][1] = -2 * kb * (1 - kb) / kg;      rgb[1][2] = -2 * kr * (1 - kr) / kg;
+		rgb[2][0] = 1; rgb[2][1] = 2 * (1 - kb);                 rgb[2][2] = 0;
+		
+		/* Then the standard's Y, B-Y and R-Y, scaled to levels */
+		for(j = 0; j < 3; j++)
+		{
+			v = rw_co * rgb[0][j] + gw_co * rgb[1][j] + bw_co * rgb[2][j];
+			
+			l[0][j] = v * s->white_black * s->level;
+			l[1][j] = s->eu_co * (rgb[2][j] - v) * (s->secam ? 1 / SECAM_FM_DEV : s->iq_level);
+			l[2][j] = s->ev_co * (rgb[0][j] - v) * (s->secam ? 1 / SECAM_FM_DEV : s->iq_level);
+		}
+		
+		/* The offsets are carried in the Y table */
+		c[0] = s->black_level * s->level;
+		c[1] = s->secam ? (SECAM_CB_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV : 0;
+		c[2] = s->secam ? (SECAM_CR_FREQ - SECAM_FM_FREQ) / SECAM_FM_DEV : 0;
+		
+		for(x = 0; x < 0x100; x++)
+		{
+			for(n = 0; n < 3; n++)
+			{
+				s->yuv[m][n][0][x] = lround((c[n] + l[n][0] * (x - 16) / 219) * INT16_MAX * 256);
+				s->yuv[m][n][1][x] = lround(l[n][1] * (x - 128) / 224 * INT16_MAX * 256);
+				s->yuv[m][n][2][x] = lround(l[n][2] * (x - 128) / 224 * INT16_MAX * 256);
+			}
+		}
+	}
+}
+
+static inline int16_t _yuv_level(const int32_t t[3][0x100], int y, int u, int v)
+{
+	int32_t l = (t[0][y] + t[1][u] + t[2][v] + 128) >> 8;
+	
+	if(l < -INT16_MAX) l = -INT16_MAX;
+	if(l > INT16_MAX) l = INT16_MAX;
+	
+	return(l);
+}
+
+/* Convert n pixels of planar YUV to Y, I and Q levels, step pixels apart.
+ * Luma is read ystride bytes apart. Pixel x takes its chroma from sample
+ * (cx + x * step) / 2 of the chroma lines, which are cstride bytes apart.
+ * Each level is the sum of three small table lookups, there being no
+ * gamma correction to make it non-linear */
+void yiq_process_yuv(const yiq_t *s, int16_t *y, int16_t *i, int16_t *q, const uint8_t *py, int ystride, const uint8_t *pu, const uint8_t *pv, int cstride, int cx, int step, int n, int matrix)
+{
+	const int32_t (*t)[3][0x100] = s->yuv[matrix];
+	int x, c, u, v;
+	
+	for(x = 0; x < n; x++, py += ystride)
+	{
+		c = ((cx + x * step) >> 1) * cstride;
+		u = pu[c];
+		v = pv[c];
+		
+		y[x] = _yuv_level(t[0], *py, u, v);
+		
+		if(i != NULL)
+		{
+			i[x] = _yuv_level(t[1], *py, u, v);
+			q[x] = _yuv_level(t[2], *py, u, v);
+		}
+	}
+}
+
+static void _yiq_table_init(yiq_t *s)
+{
+	uint32_t c;
+	int r, g, b;
+	
+	for(c = 0x000000; c <= 0xFFFFFF; c++)
+	{
+		_channels(c, -1, &r, &g, &b);
+		_yiq_calc(s, &s->lut[c].y, &s->lut[c].i, &s->lut[c].q, r, g, b);
+	}
+}
+
+int yiq_init(yiq_t *s, int mode, double gamma, double rw_co, double gw_co, double bw_co, double eu_co, double ev_co, double black_level, double white_level, double level, int secam)
+{
+	unsigned int features = cpu_features();
+	int c;
+	
+	s->lut = NULL;
+	
+	/* Generate the gamma and per-channel luminance tables */
+	for(c = 0; c < 0x100; c++)
+	{
+		s->g[c]  = pow((double) c / 255, 1 / gamma);
+		s->rw[c] = s->g[c] * rw_co;
+		s->gw[c] = s->g[c] * gw_co;
+		s->bw[c] = s->g[c] * bw_co;
+	}
+	
+	s->black_level = black_level;
+	s->white_black = white_level - black_level;
+	s->level = level;
+	s->eu_co = eu_co;
+	s->ev_co = ev_co;
+	s->iq_level = (white_level - black_level) * level;
+	s->secam = secam;
+	
+	_yiq_yuv_init(s, rw_co, gw_co, bw_co);
+	
+	if(mode == YIQ_AUTO)
+	{
+		mode = YIQ_SCALAR;
+		if(features & CPU_SSE2) mode = YIQ_SSE2;
+		if(features & CPU_AVX2) mode = YIQ_AVX2;
+	}
+	else if((mode == YIQ_SSE2 && !(features & CPU_SSE2)) ||
+	        (mode == YIQ_AVX2 && !(features & CPU_AVX2)))
+	{
+		fprintf(stderr, "Warning: %s is not supported by this CPU, using scalar RGB to YIQ conversion.\n", yiq_mode_name(mode));
+		mode = YIQ_SCALAR;
+	}
+	
+	s->mode = mode;
+	
+	switch(mode)
+	{
+	case YIQ_TABLE:
+		s->lut = malloc(0x1000000 * sizeof(_yiq16_t));
+		if(s->lut == NULL)
+		{
+			return(-1);
+		}
+		
+		_yiq_table_init(s);
+		s->process = _yiq_table;
+		break;
+	
+#ifdef CPU_X86
+	case YIQ_SSE2: s->process = _yiq_sse2; break;
+	case YIQ_AVX2: s->process = _yiq_avx2; break;
+#endif
+	
+	default:
+		s->mode = YIQ_SCALAR;
+		s->process = _yiq_scalar;
+		break;
+	}
+	
+	s->black = yiq_pixel(s, 0x000000);
+	
+	return(0);
+}
+
+void yiq_free(yiq_t *s)
+{
+	free(s->lut);
+	s->lut = NULL;
+}
+
+_yiq16_t yiq_pixel(const yiq_t *s, uint32_t rgb)
+{
+	_yiq16_t p;
+	int r, g, b;
+	
+	_channels(rgb, -1, &r, &g, &b);
+	_yiq_calc(s, &p.y, &p.i, &p.q, r, g, b);
+	
+	return(p);
+}
+
+const char *yiq_mode_name(int mode)
+{
+	switch(mode)
+	{
+	case YIQ_AUTO: return("auto");
+	case YIQ_TABLE: return("table");
+	case YIQ_SCALAR: return("scalar");
+	case YIQ_SSE2: return("sse2");
+	case YIQ_AVX2: return("avx2");
+	}
+	
+	return("unknown");
+}
+
@@ -0,0 +1,96 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef _YIQ_H
+#define _YIQ_H
+
+#include <stdint.h>
+
+/* RGB to YIQ conversion modes */
+#define YIQ_AUTO   0 /* Fastest available */
+#define YIQ_TABLE  1 /* Full 24-bit lookup table */
+#define YIQ_SCALAR 2
+#define YIQ_SSE2   3
+#define YIQ_AVX2   4
+
+typedef struct {
+	int16_t y;
+	int16_t i;
+	int16_t q;
+} _yiq16_t;
+
+typedef struct yiq_t yiq_t;
+
+typedef void (*yiq_process_t)(const yiq_t *s, int16_t *y, int16_t *i, int16_t *q, const uint32_t *src, int stride, int n, int grey);
+
+struct yiq_t {
+	
+	int mode;
+	yiq_process_t process;
+	
+	/* Gamma corrected levels, and the same weighted
+	 * for each channel's contribution to luminance */
+	double g[0x100];
+	double rw[0x100];
+	double gw[0x100];
+	double bw[0x100];
+	
+	/* Signal level scaling */
+	double black_level;
+	double white_black;
+	double level;
+	double eu_co;
+	double ev_co;
+	double iq_level;
+	int secam;
+	
+	/* Full lookup table, YIQ_TABLE mode only */
+	_yiq16_t *lut;
+	
+	/* The level of a black pixel */
+	_yiq16_t black;
+	
+	/* Contribution of each limited range Y, U and V value to the Y, I
+	 * and Q levels, for each AV_YUV_* matrix. Fixed point, 8 fractional
+	 * bits. Only valid without gamma correction */
+	int32_t yuv[2][3][3][0x100];
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern int yiq_init(yiq_t *s, int mode, double gamma, double rw_co, double gw_co, double bw_co, double eu_co, double ev_co, double black_level, double white_level, double level, int secam);
+extern void yiq_free(yiq_t *s);
+extern _yiq16_t yiq_pixel(const yiq_t *s, uint32_t rgb);
+extern void yiq_process_yuv(const yiq_t *s, int16_t *y, int16_t *i, int16_t *q, const uint8_t *py, int ystride, const uint8_t *pu, const uint8_t *pv, int cstride, int cx, int step, int n, int matrix);
+extern const char *yiq_mode_name(int mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+/* Convert n RGB32 pixels to Y, I and Q levels. The source pixels are
+ * stride pixels apart. i and q may be NULL if only Y is needed. If grey
+ * is >= 0 the channel at that bit offset is used as a grey level */
+static inline void yiq_process(const yiq_t *s, int16_t *y, int16_t *i, int16_t *q, const uint32_t *src, int stride, int n, int grey)
+{
+	s->process(s, y, i, q, src, stride, n, grey);
+}
+
+#endif
+
@@ -1,5 +1,6 @@
 #include "hacktvlib.h"
 #include <QThread>
+#include <QTemporaryFile>
 #include <getopt.h>
 #include <cstdarg>
 #include <cstdio>
@@ -11,11 +12,17 @@
 #include <algorithm>
 #include <cstring>
 #include <cstdlib>
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
 #include "hacktv/av.h"
 #include "hacktv/rf.h"
 
 #define VERSION "1.0"
 
+/* Samples passed to the RF sink per write */
+#define TX_BLOCK_SAMPLES 65536
+
 static hacktv_t s;
 const vid_configs_t *vid_confs;
 vid_config_t vid_conf;
@@ -75,6 +82,18 @@ enum {
     _OPT_PILLARBOX,
     _OPT_VERSION,
     _OPT_MODE,
+    _OPT_THREADS,
+    _OPT_YIQ_MODE,
+    _OPT_RENDER_ONCE,
+    _OPT_LATENCY,
+    _OPT_BUFFERS,
+    _OPT_BUFFER_LENGTH,
+    _OPT_DIRECT_IO,
+    _OPT_RX_FAST,
+    _OPT_FRAME_QUEUE,
+    _OPT_SCALER,
+    _OPT_SCALER_THREADS,
+    _OPT_LOOP_MAX_MB,
 };
 
 static struct option long_options[] = {
@@ -94,6 +113,8 @@ static struct option long_options[] = {
     { "pillarbox",      no_argument,       0, _OPT_PILLARBOX },
     { "repeat",         no_argument,       0, 'r' },
     { "shuffle",        no_argument,       0, _OPT_SHUFFLE },
+    { "render-once",    no_argument,       0, _OPT_RENDER_ONCE },
+    { "loop-max-mb",    required_argument, 0, _OPT_LOOP_MAX_MB },
     { "verbose",        no_argument,       0, 'v' },
     { "teletext",       required_argument, 0, _OPT_TELETEXT },
     { "wss",            required_argument, 0, _OPT_WSS },
@@ -143,6 +164,16 @@ static struct option long_options[] = {
     { "type",           required_argument, 0, 't' },
     { "version",        no_argument,       0, _OPT_VERSION },
     { "rx-tx-mode",     required_argument, 0, _OPT_MODE },
+    { "threads",        required_argument, 0, _OPT_THREADS },
+    { "yiq-mode",       required_argument, 0, _OPT_YIQ_MODE },
+    { "latency",        required_argument, 0, _OPT_LATENCY },
+    { "buffers",        required_argument, 0, _OPT_BUFFERS },
+    { "buffer-length",  required_argument, 0, _OPT_BUFFER_LENGTH },
+    { "direct-io",      no_argument,       0, _OPT_DIRECT_IO },
+    { "rx-fast",        no_argument,       0, _OPT_RX_FAST },
+    { "frame-queue",    required_argument, 0, _OPT_FRAME_QUEUE },
+    { "scaler",         required_argument, 0, _OPT_SCALER },
+    { "scaler-threads", required_argument, 0, _OPT_SCALER_THREADS },
     { 0,                0,                 0,  0  }
 };
 
@@ -242,6 +273,8 @@ bool HackTvLib::start()
     s.fit_mode = AV_FIT_FIT;
     s.repeat = 0;
     s.shuffle = 0;
+    s.render_once = 0;
+    s.loop_max_mb = 1024;
     s.verbose = 0;
     s.teletext = NULL;
     s.wss = NULL;
@@ -267,11 +300,21 @@ bool HackTvLib::start()
     s.mac_audio_protection = MAC_FIRST_LEVEL_PROTECTION;
     s.frequency = 0;
     s.amp = 0;
+    s.latency = 0;
+    s.buffer_count = 0;
+    s.buffer_length = 0;
     s.gain = 0;
     s.antenna = NULL;
     s.file_type = RF_INT16;
+    s.file_direct = 0;
+    s.rx_fast = 0;
+    s.frame_queue = 0;
+    s.scaler = NULL;
+    s.scaler_threads = 0;
     s.raw_bb_blanking_level = 0;
     s.raw_bb_white_level = INT16_MAX;
+    s.threads = 0;
+    s.yiq_mode = YIQ_AUTO;
     m_rxTxMode = TX_MODE;
 
     m_abort = false;
@@ -329,6 +372,22 @@ bool HackTvLib::start()
                 return false;
             }
         }
+        else if(strcmp(s.output_type, "file") == 0 || strcmp(s.output_type, "mmap") == 0)
+        {
+            /* Replay a recording, complex unless SigMF says otherwise */
+            memset(&s.rf, 0, sizeof(s.rf));
+            if(rf_mmap_open_source(&s.rf, s.output, s.file_type, 1, s.samplerate, !s.rx_fast) != RF_OK)
+            {
+                log("Could not open the RX file.");
+                return false;
+            }
+
+            m_abort = false;
+            m_signal = 0;
+            m_thread = std::thread(&HackTvLib::rfRxLoop, this);
+            log("HackTvLib started at RX mode with a file.");
+            return true;
+        }
     }
 
     if(micEnabled && m_rxTxMode == TX_MODE)
@@ -470,6 +529,43 @@ void HackTvLib::setRxAmpGain(unsigned int rx_amp_gain)
     }
 }
 
+bool HackTvLib::getBufferLevel(unsigned int &fill_ms, unsigned int &depth_ms)
+{
+    /* Report how much output is buffered in the sink, if it can say */
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t samples, capacity;
+
+    if (!m_thread.joinable() || s.vid.sample_rate == 0 ||
+        rf_fill(&s.rf, &samples, &capacity) != RF_OK)
+    {
+        return false;
+    }
+
+    fill_ms = samples * 1000 / s.vid.sample_rate;
+    depth_ms = capacity * 1000 / s.vid.sample_rate;
+
+    return true;
+}
+
+bool HackTvLib::getFrameQueueLevel(int &video_frames, int &audio_frames, int &depth)
+{
+    /* Report how many decoded frames the source has ready. The
+     * source belongs to the TX thread and may be closed or switched
+     * at any time, so read the levels it last published instead */
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_thread.joinable() || m_frameDepth.load() < 0)
+    {
+        return false;
+    }
+
+    video_frames = m_videoFrames.load();
+    audio_frames = m_audioFrames.load();
+    depth = m_frameDepth.load();
+
+    return true;
+}
+
 void HackTvLib::dataReceived(const int8_t *data, size_t len)
 {
     emitReceivedData(data, len);
@@ -496,10 +592,13 @@ bool HackTvLib::setArguments(const std::vector<std::string>& args)
 
 bool HackTvLib::openDevice()
 {
+    /* Clear any callbacks left by the previous sink */
+    memset(&s.rf, 0, sizeof(s.rf));
+
     if(strcmp(s.output_type, "hackrf") == 0)
     {
 #ifdef HAVE_HACKRF
-        if(rf_hackrf_open(m_rxTxMode, &s.rf, s.output, s.vid.sample_rate, s.frequency, s.amp) != RF_OK)
+        if(rf_hackrf_open(m_rxTxMode, &s.rf, s.output, s.vid.sample_rate, s.frequency, s.amp, s.latency, s.buffer_count, s.buffer_length) != RF_OK)
         {            
             vid_free(&s.vid);
             log("Could not open HackRF. Please check the device.");
@@ -529,7 +628,7 @@ bool HackTvLib::openDevice()
     else if(strcmp(s.output_type, "fl2k") == 0)
     {
 #ifdef HAVE_FL2K
-        if(rf_fl2k_open(&s.rf, s.output, s.vid.sample_rate) != RF_OK)
+        if(rf_fl2k_open(&s.rf, s.output, s.vid.sample_rate, s.latency, s.buffer_count) != RF_OK)
         {
             vid_free(&s.vid);
             log("Could not open FL2K. Please check the device.");
@@ -543,7 +642,39 @@ bool HackTvLib::openDevice()
     }
     else if(strcmp(s.output_type, "file") == 0)
     {
-        if(rf_file_open(&s.rf, s.output, s.file_type, s.vid.conf.output_type == RF_INT16_COMPLEX) != RF_OK)
+        if(rf_file_open(&s.rf, s.output, s.file_type, s.vid.conf.output_type == RF_INT16_COMPLEX, s.file_direct) != RF_OK)
+        {
+            vid_free(&s.vid);
+            return false;
+        }
+    }
+    else if(strcmp(s.output_type, "mmap") == 0)
+    {
+        if(rf_mmap_open(&s.rf, s.output, s.file_type, s.vid.conf.output_type == RF_INT16_COMPLEX, s.vid.sample_rate, s.frequency, s.mode) != RF_OK)
+        {
+            vid_free(&s.vid);
+            return false;
+        }
+    }
+    else if(strcmp(s.output_type, "null") == 0)
+    {
+        if(rf_null_open(&s.rf, s.vid.sample_rate) != RF_OK)
+        {
+            vid_free(&s.vid);
+            return false;
+        }
+    }
+    else if(strcmp(s.output_type, "loopback") == 0)
+    {
+        /* Blocks arrive on the loopback thread */
+        auto callback = [](void *user, const int16_t *iq_data, size_t samples) {
+            HackTvLib *lib = static_cast<HackTvLib *>(user);
+            if (lib->m_loopbackCallback) {
+                lib->m_loopbackCallback(iq_data, samples);
+            }
+        };
+
+        if(rf_loopback_open(&s.rf, callback, this) != RF_OK)
         {
             vid_free(&s.vid);
             return false;
@@ -811,6 +942,8 @@ bool HackTvLib::setVideo()
     vid_conf.raw_bb_blanking_level = s.raw_bb_blanking_level;
     vid_conf.raw_bb_white_level = s.raw_bb_white_level;
     vid_conf.secam_field_id = s.secam_field_id;
+    vid_conf.threads = s.threads;
+    vid_conf.yiq_mode = s.yiq_mode;
 
     /* Setup video encoder */
     r = vid_init(&s.vid, s.samplerate, s.pixelrate, &vid_conf);
@@ -877,6 +1010,16 @@ bool HackTvLib::initAv()
         s.vid.av.height = s.vid.active_width;
     }
 
+    /* Let sources skip the RGB conversion where the renderer allows */
+    s.vid.av.yuv = vid_accepts_yuv(&s.vid);
+    s.vid.av.frame_queue = s.frame_queue;
+    s.vid.av.scaler = s.scaler;
+    s.vid.av.scaler_threads = s.scaler_threads;
+
+    /* Let a source that's opening or waiting on input give up on stop */
+    s.vid.av.interrupt = [](void *abort) -> int { return static_cast<std::atomic<bool> *>(abort)->load(); };
+    s.vid.av.interrupt_opaque = &m_abort;
+
     return true;
 }
 
@@ -910,6 +1053,21 @@ bool HackTvLib::parseArguments()
                 s.output_type = "file";
                 s.output = sub;
             }
+            else if(strcmp(pre, "mmap") == 0)
+            {
+                s.output_type = "mmap";
+                s.output = sub;
+            }
+            else if(strcmp(pre, "null") == 0)
+            {
+                s.output_type = "null";
+                s.output = sub;
+            }
+            else if(strcmp(pre, "loopback") == 0)
+            {
+                s.output_type = "loopback";
+                s.output = sub;
+            }
             else if(strcmp(pre, "hackrf") == 0)
             {
                 s.output_type = "hackrf";
@@ -1034,6 +1192,14 @@ bool HackTvLib::parseArguments()
             s.shuffle = 1;
             break;
 
+        case _OPT_RENDER_ONCE: /* --render-once */
+            s.render_once = 1;
+            break;
+
+        case _OPT_LOOP_MAX_MB: /* --loop-max-mb <size> */
+            s.loop_max_mb = atoi(optarg);
+            break;
+
         case 'v': /* -v, --verbose */
             s.verbose = 1;
             break;
@@ -1198,6 +1364,40 @@ bool HackTvLib::parseArguments()
             s.fopts = optarg;
             break;
 
+        case _OPT_THREADS: /* --threads <number> */
+            s.threads = atoi(optarg);
+            break;
+
+        case _OPT_YIQ_MODE: /* --yiq-mode <auto|table|scalar|sse2|avx2> */
+
+            if(strcmp(optarg, "auto") == 0)
+            {
+                s.yiq_mode = YIQ_AUTO;
+            }
+            else if(strcmp(optarg, "table") == 0)
+            {
+                s.yiq_mode = YIQ_TABLE;
+            }
+            else if(strcmp(optarg, "scalar") == 0)
+            {
+                s.yiq_mode = YIQ_SCALAR;
+            }
+            else if(strcmp(optarg, "sse2") == 0)
+            {
+                s.yiq_mode = YIQ_SSE2;
+            }
+            else if(strcmp(optarg, "avx2") == 0)
+            {
+                s.yiq_mode = YIQ_AVX2;
+            }
+            else
+            {
+                fprintf(stderr, "Unrecognised RGB to YIQ mode.\n");
+                return false;
+            }
+
+            break;
+
         case 'f': /* -f, --frequency <value> */
             s.frequency = (uint64_t) strtod(optarg, NULL);
             break;
@@ -1206,6 +1406,38 @@ bool HackTvLib::parseArguments()
             s.amp = 1;
             break;
 
+        case _OPT_LATENCY: /* --latency <ms> */
+            s.latency = atoi(optarg);
+            break;
+
+        case _OPT_BUFFERS: /* --buffers <count> */
+            s.buffer_count = atoi(optarg);
+            break;
+
+        case _OPT_BUFFER_LENGTH: /* --buffer-length <bytes> */
+            s.buffer_length = atoi(optarg);
+            break;
+
+        case _OPT_DIRECT_IO: /* --direct-io */
+            s.file_direct = 1;
+            break;
+
+        case _OPT_RX_FAST: /* --rx-fast */
+            s.rx_fast = 1;
+            break;
+
+        case _OPT_FRAME_QUEUE: /* --frame-queue <frames> */
+            s.frame_queue = atoi(optarg);
+            break;
+
+        case _OPT_SCALER: /* --scaler <algorithm> */
+            s.scaler = optarg;
+            break;
+
+        case _OPT_SCALER_THREADS: /* --scaler-threads <number> */
+            s.scaler_threads = atoi(optarg);
+            break;
+
         case 'g': /* -g, --gain <value> */
             s.gain = atoi(optarg);
             break;
@@ -1290,6 +1522,11 @@ void HackTvLib::setReceivedDataCallback(DataCallback callback)
     m_dataCallback = std::move(callback);
 }
 
+void HackTvLib::setLoopbackCallback(LoopbackCallback callback)
+{
+    m_loopbackCallback = std::move(callback);
+}
+
 void HackTvLib::emitReceivedData(const int8_t *data, size_t len)
 {
     if (m_dataCallback) {
@@ -1297,86 +1534,329 @@ void HackTvLib::emitReceivedData(const int8_t *data, size_t len)
     }
 }
 
-void HackTvLib::rfTxLoop()
+static bool _is_stdin(const char *arg)
+{
+    if (strncmp(arg, "ffmpeg:", 7) == 0)
+    {
+        arg += 7;
+    }
+
+    return strcmp(arg, "-") == 0 || strncmp(arg, "pipe:", 5) == 0;
+}
+
+bool HackTvLib::openInput(av_t *av, char *arg)
+{
+    char* pre = arg;
+    char* sub = strchr(pre, ':');
+    size_t l;
+    if (sub != NULL)
+    {
+        l = sub - pre;
+        sub++;
+    }
+    else
+    {
+        l = strlen(pre);
+    }
+
+    int r = HACKTV_ERROR;
+    if (strncmp(pre, "test", l) == 0)
+    {
+        r = av_test_open(av);
+    }
+    else if (strncmp(pre, "ffmpeg", l) == 0)
+    {
+        r = av_ffmpeg_open(av, sub, s.ffmt, s.fopts);
+    }
+    else
+    {
+        r = av_ffmpeg_open(av, pre, s.ffmt, s.fopts);
+    }
+
+    return r == HACKTV_OK;
+}
+
+void HackTvLib::shuffleInputs()
 {
+    // Shuffle the input source list
+    for (size_t c = optind; c < m_argv.size() - 1; c++)
+    {
+        size_t l = c + (rand() % (m_argv.size() - c - (c == optind ? 1 : 0)));
+        std::swap(m_argv[c], m_argv[l]);
+    }
+}
+
+bool HackTvLib::nextInput(size_t &index)
+{
+    /* At the end of the playlist start again from the top if
+     * repeating, reshuffled. Returns false when it's finished */
+    if (index < m_argv.size()) return true;
+    if (!s.repeat) return false;
+
+    index = (size_t) optind;
+    if (s.shuffle) shuffleInputs();
+
+    return true;
+}
+
+bool HackTvLib::openNextInput(av_t *av, size_t &index)
+{
+    /* Open the next input in the playlist into av, starting at index.
+     * Returns false at the end of the playlist, or if none will open */
+    size_t failed = 0;
+
+    while (!m_abort && nextInput(index))
+    {
+        if (openInput(av, m_argv[index++])) return true;
+        if (++failed >= m_argv.size() - optind) return false;
+    }
+
+    return false;
+}
+
+static bool _reserve_file(QFile &file, qint64 bytes)
+{
+    /* Allocate the disk space up front, so running out shows up
+     * here rather than as a SIGBUS while writing to the mapping.
+     * On Windows, setting the size allocates it */
+#if defined(__linux__)
+    if (posix_fallocate(file.handle(), 0, bytes) != 0) return false;
+#elif defined(__APPLE__)
+    fstore_t store = { F_ALLOCATEALL, F_PEOFPOSMODE, 0, bytes, 0 };
+    if (fcntl(file.handle(), F_PREALLOCATE, &store) == -1) return false;
+#endif
+
+    return file.resize(bytes);
+}
+
+bool HackTvLib::rfReplayLoop()
+{
+    /* Render one seamless loop of the first input into a memory
+     * mapped buffer, then send it to the sink until stopped. Returns
+     * false if the output can't be looped and should be rendered live */
+    if (!openInput(&s.vid.av, m_argv[optind]))
+    {
+        return false;
+    }
+
+    int frames = vid_loop_frames(&s.vid);
+    if (frames <= 0)
+    {
+        log("The output doesn't repeat with this input and mode, rendering live.");
+        vid_av_close(&s.vid);
+        return false;
+    }
+
+    const size_t frameSamples = (size_t) s.vid.sample_rate * s.vid.conf.frame_rate.den / s.vid.conf.frame_rate.num;
+    const size_t loopSamples = frameSamples * frames;
+    const qint64 bytes = loopSamples * 2 * sizeof(int16_t);
+
+    if (bytes > (qint64) s.loop_max_mb * 1000000)
+    {
+        log("A %d frame loop needs %.1f MB, over the %d MB limit (--loop-max-mb), rendering live.",
+            frames, bytes / 1e6, s.loop_max_mb);
+        vid_av_close(&s.vid);
+        return false;
+    }
+
+    QTemporaryFile file;
+    int16_t* buffer = NULL;
+
+    if (file.open() && _reserve_file(file, bytes))
+    {
+        buffer = reinterpret_cast<int16_t*>(file.map(0, bytes));
+    }
+
+    if (buffer == NULL)
+    {
+        log("Could not map a %.1f MB loop buffer, rendering live.", bytes / 1e6);
+        vid_av_close(&s.vid);
+        return false;
+    }
+
+    log("Rendering a %d frame loop (%.1f MB).", frames, bytes / 1e6);
+
+    /* Skip ahead to the first line of the loop, giving
+     * the filters and audio carriers time to settle */
+    int start = vid_loop_start(&s.vid, frames);
+    size_t samples;
+    size_t offset = 0;
+    int16_t* data;
+    const int progress = std::max(1, frames / 10);
+
     do
     {
-        if (s.shuffle)
+        data = vid_next_line(&s.vid, &samples);
+    }
+    while (data != NULL && !m_abort && (s.vid.frame != start || s.vid.line != 1));
+
+    for (int lines = 0; data != NULL && !m_abort && lines < frames * s.vid.conf.lines; lines++)
+    {
+        if (lines > 0) data = vid_next_line(&s.vid, &samples);
+        if (data == NULL || offset + samples > loopSamples) break;
+
+        memcpy(&buffer[offset * 2], data, samples * 2 * sizeof(int16_t));
+        offset += samples;
+
+        /* Nothing reaches the sink until the loop is done */
+        if ((lines + 1) % (s.vid.conf.lines * progress) == 0)
         {
-            // Shuffle the input source list
-            for (int c = optind; c < m_argv.size() - 1; c++)
-            {
-                int l = c + (rand() % (m_argv.size() - c - (c == optind ? 1 : 0)));
-                std::swap(m_argv[c], m_argv[l]);
-            }
+            log("Rendered %d of %d frames.", (lines + 1) / s.vid.conf.lines, frames);
         }
+    }
+
+    vid_av_close(&s.vid);
+
+    if (m_abort)
+    {
+        return true;
+    }
 
-        for (size_t c = optind; c < m_argv.size() && !m_abort; c++)
+    if (offset != loopSamples)
+    {
+        log("The input ended before the loop was rendered, rendering live.");
+        return false;
+    }
+
+    /* Replay the loop a frame at a time */
+    while (!m_abort)
+    {
+        for (int c = 0; c < frames && !m_abort; c++)
         {
-            char* pre = m_argv[c];
-            char* sub = strchr(pre, ':');
-            size_t l;
-            if (sub != NULL)
+            if (rf_write(&s.rf, &buffer[c * frameSamples * 2], frameSamples) != RF_OK)
             {
-                l = sub - pre;
-                sub++;
-            }
-            else
-            {
-                l = strlen(pre);
+                return true;
             }
+        }
+    }
 
-            int r = HACKTV_ERROR;
-            if (strncmp(pre, "test", l) == 0)
-            {
-                r = av_test_open(&s.vid.av);
-            }
-            else if (strncmp(pre, "ffmpeg", l) == 0)
-            {
-                r = av_ffmpeg_open(&s.vid.av, sub, s.ffmt, s.fopts);
-            }
-            else
-            {
-                r = av_ffmpeg_open(&s.vid.av, pre, s.ffmt, s.fopts);
-            }
+    return true;
+}
 
-            if (r != HACKTV_OK)
-            {
-                continue;
-            }
+void HackTvLib::publishFrameQueueLevel()
+{
+    /* Called from the TX thread, which owns s.vid.av. A depth
+     * of -1 means no source is open or it can't report */
+    int video_frames, audio_frames, depth;
 
-            while (!m_abort)
-            {
-                size_t samples;
-                int16_t* data = vid_next_line(&s.vid, &samples);
-                if (data == NULL) break;
-                if (rf_write(&s.rf, data, samples) != RF_OK) break;
-            }
+    if (av_fill(&s.vid.av, &video_frames, &audio_frames, &depth) != AV_OK)
+    {
+        m_frameDepth.store(-1);
+        return;
+    }
 
-            if (m_signal.load() != 0)
-            {
-                log("Caught signal %d", m_signal.load());
-                m_signal.store(0);
-            }
-            av_close(&s.vid.av);
+    m_videoFrames.store(video_frames);
+    m_audioFrames.store(audio_frames);
+    m_frameDepth.store(depth);
+}
+
+void HackTvLib::rfTxLoop()
+{
+    if (s.shuffle)
+    {
+        shuffleInputs();
+    }
+
+    if (s.render_once && rfReplayLoop())
+    {
+        return;
+    }
+
+    /* Lines are passed to the sink in blocks */
+    std::vector<int16_t> block(std::max<size_t>(TX_BLOCK_SAMPLES, s.vid.max_width) * 2);
+
+    /* While each input plays, the next one is opened on a background
+     * thread and starts decoding. It takes over as soon as the current
+     * input ends, so the sink isn't left waiting on the open */
+    av_t next = s.vid.av;
+    size_t index = optind;
+    bool playing = openNextInput(&s.vid.av, index);
+
+    while (playing)
+    {
+        /* The next input is chosen here, the opener only opens it.
+         * Some inputs can't be opened while another is playing,
+         * such as stdin, those wait for the current one to end */
+        char *arg = NULL;
+        bool opened = false;
+        std::thread opener;
+
+        if (nextInput(index) && !_is_stdin(m_argv[index]))
+        {
+            arg = m_argv[index++];
+            opener = std::thread([this, &next, &opened, arg] { opened = openInput(&next, arg); });
+        }
+
+        while (!m_abort)
+        {
+            size_t samples;
+            if (vid_next_block(&s.vid, block.data(), block.size() / 2, &samples) <= 0) break;
+            publishFrameQueueLevel();
+            if (rf_write(&s.rf, block.data(), samples) != RF_OK) break;
+        }
+
+        m_frameDepth.store(-1);
+
+        if (m_signal.load() != 0)
+        {
+            log("Caught signal %d", m_signal.load());
+            m_signal.store(0);
+        }
+
+        /* An open still in progress gives up once m_abort is set */
+        if (opener.joinable()) opener.join();
+        vid_av_close(&s.vid);
+
+        if (!opened && !m_abort)
+        {
+            /* Open the input that had to wait, or carry
+             * on with the one after an input that failed */
+            if (arg != NULL) log("Could not open '%s', skipping it.", arg);
+            opened = openNextInput(&next, index);
         }
-    } while (s.repeat && !m_abort);
+
+        if (opened && m_abort)
+        {
+            av_close(&next);
+            opened = false;
+        }
+
+        /* Switch over to the next input */
+        if (opened) av_move(&s.vid.av, &next);
+        playing = opened;
+    }
 }
 
 void HackTvLib::rfRxLoop()
 {
     const size_t SAMPLES_PER_READ = 131072;  // Number of I/Q pairs to read
-    const size_t BUFFER_SIZE = SAMPLES_PER_READ * 2;  // Correct, as each I/Q pair is 2 int8_t values
+    const size_t BUFFER_SIZE = SAMPLES_PER_READ * 2;  // Each I/Q pair is 2 values
     std::vector<int16_t> buffer(BUFFER_SIZE);
+    std::vector<int8_t> iq8(BUFFER_SIZE);
+    int r;
 
+    /* The source paces itself, blocking until the samples are due */
     while (!m_abort)
     {
-        size_t bytes_read = rf_read(&s.rf, buffer.data(), BUFFER_SIZE);
-        if (bytes_read != 0)
+        r = rf_read(&s.rf, buffer.data(), SAMPLES_PER_READ);
+        if (r < 0)
+        {
+            log("RX read failed.");
+            break;
+        }
+        else if (r == 0)
         {
-            log("Bytes read: %zu", bytes_read);
+            log("End of the RX file.");
+            break;
+        }
+
+        /* Pass on as 8-bit IQ, the same as the radios */
+        for (size_t i = 0; i < (size_t) r * 2; i++)
+        {
+            iq8[i] = buffer[i] >> 8;
         }
-        QThread::msleep(10);
+
+        dataReceived(iq8.data(), (size_t) r * 2);
     }
 
     if (m_signal.load() != 0)
@@ -1409,6 +1889,18 @@ bool HackTvLib::stop()
                 return true;
             }
         }
+        else if(m_thread.joinable())
+        {
+            m_abort = true;
+            m_thread.join();
+
+            /* getBufferLevel() may be reading the sink */
+            std::lock_guard<std::mutex> lock(m_mutex);
+            rf_close(&s.rf);
+            memset(&s.rf, 0, sizeof(s.rf));
+            log("HackTvLib stopped.");
+            return true;
+        }
         return false;
     }
 
@@ -1426,6 +1918,7 @@ bool HackTvLib::stop()
     m_thread.join();
 
     rf_close(&s.rf);
+    memset(&s.rf, 0, sizeof(s.rf));
     vid_free(&s.vid);
     av_ffmpeg_deinit();
     fprintf(stderr, "\n");
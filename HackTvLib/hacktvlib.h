@@ -40,6 +40,8 @@ typedef struct {
     rational_t max_aspect;
     int repeat;
     int shuffle;
+    int render_once;
+    int loop_max_mb;
     int verbose;
     char *teletext;
     char *wss;
@@ -61,9 +63,17 @@ typedef struct {
     int scramble_audio;
     uint64_t frequency;
     int amp;
+    int latency;
+    int buffer_count;
+    int buffer_length;
     int gain;
     char *antenna;
     int file_type;
+    int file_direct;
+    int rx_fast;
+    int frame_queue;
+    char *scaler;
+    int scaler_threads;
     int chid;
     int mac_audio_stereo;
     int mac_audio_quality;
@@ -82,6 +92,8 @@ typedef struct {
     int json;
     char *ffmt;
     char *fopts;
+    int threads;
+    int yiq_mode;
 
     /* Video encoder state */
     vid_t vid;
@@ -98,6 +110,7 @@ class HackTvLib
 public:
     using LogCallback = std::function<void(const std::string&)>;
     using DataCallback = std::function<void(const int8_t*, size_t)>;
+    using LoopbackCallback = std::function<void(const int16_t*, size_t)>;
 
      HackTvLib();
     ~HackTvLib();
@@ -105,6 +118,7 @@ public:
     bool stop();
     void setLogCallback(LogCallback callback);
     void setReceivedDataCallback(DataCallback callback);
+    void setLoopbackCallback(LoopbackCallback callback);
     bool setArguments(const std::vector<std::string>& args);
     void setMicEnabled(bool newMicEnabled);
     void setFrequency(uint64_t frequency_hz);
@@ -118,6 +132,8 @@ public:
     void setVgaGain(unsigned int vga_gain);
     void setTxAmpGain(unsigned int tx_amp_gain);
     void setRxAmpGain(unsigned int rx_amp_gain);
+    bool getBufferLevel(unsigned int &fill_ms, unsigned int &depth_ms);
+    bool getFrameQueueLevel(int &video_frames, int &audio_frames, int &depth);
 
 private slots:
     void emitReceivedData(const int8_t *data, size_t data_len);
@@ -125,19 +141,29 @@ private slots:
 private:
     LogCallback m_logCallback;
     DataCallback m_dataCallback;
+    LoopbackCallback m_loopbackCallback;
     std::thread m_thread;
     std::mutex m_mutex;
     std::atomic<bool> m_abort;
     std::atomic<int> m_signal;
+    std::atomic<int> m_videoFrames{0};
+    std::atomic<int> m_audioFrames{0};
+    std::atomic<int> m_frameDepth{-1};
     std::vector<char*> m_argv;
     bool openDevice();
     bool setVideo();
     bool initAv();
     bool parseArguments();
+    bool openInput(av_t *av, char *arg);
+    bool openNextInput(av_t *av, size_t &index);
+    bool nextInput(size_t &index);
+    void shuffleInputs();
     bool micEnabled = false;
     void log(const char* format, ...);
     void cleanupArgv();
     void rfTxLoop();
+    void publishFrameQueueLevel();
+    bool rfReplayLoop();
     void rfRxLoop();
     HackRfDevice *hackRfDevice{};
     RTLSDRDevice *rtlSdrDevice{};
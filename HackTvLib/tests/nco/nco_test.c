@@ -0,0 +1,371 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Tests for the audio carrier block synthesisers in video.c.
+ * 
+ * The AVX2 kernels, finished by the scalar path as the modulators
+ * use them, must match the scalar path alone bit for bit, phase
+ * included. The modulators must also stay close to the per-sample
+ * phase rotators they replaced, copied below. Those had no lookup
+ * table error, but drifted in amplitude between corrections. The
+ * inputs are random, full scale, and constant at either limit, with
+ * positive and negative carriers and block lengths that are mostly
+ * not a multiple of 8.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Built in, to reach the synthesisers */
+#include "video.c"
+
+/* The most a modulator output may differ from the old per-sample
+ * modulator, in units of the output. The 2^14 entry table is within
+ * half a step, 1.9e-4 rad, which is 6.3 at full scale, plus rounding
+ * in the old rotator and the phase drift over a run */
+#define _TOLERANCE 12
+
+/* The per-sample modulators this replaced */
+typedef struct {
+	int16_t level;
+	int32_t counter;
+	cint32_t phase;
+	cint32_t delta;
+	cint32_t *lut;
+} _ref_mod_t;
+
+static int _ref_init_fm(_ref_mod_t *fm, int sample_rate, double frequency, double deviation, double level)
+{
+	int r;
+	double d;
+	
+	fm->level   = round(INT16_MAX * level);
+	fm->counter = INT16_MAX;
+	fm->phase.i = INT32_MAX;
+	fm->phase.q = 0;
+	fm->lut     = malloc(sizeof(cint32_t) * (UINT16_MAX + 1));
+	
+	if(!fm->lut)
+	{
+		return(VID_OUT_OF_MEMORY);
+	}
+	
+	for(r = INT16_MIN; r <= INT16_MAX; r++)
+	{
+		d = 2.0 * M_PI / sample_rate * (frequency + (double) r / INT16_MAX * deviation);
+		
+		fm->lut[r - INT16_MIN].i = lround(cos(d) * INT32_MAX);
+		fm->lut[r - INT16_MIN].q = lround(sin(d) * INT32_MAX);
+	}
+	
+	return(VID_OK);
+}
+
+static void _ref_init_am(_ref_mod_t *am, int sample_rate, double frequency, double level)
+{
+	double d;
+	
+	am->level   = round(INT16_MAX * level);
+	am->counter = INT16_MAX;
+	am->phase.i = INT32_MAX;
+	am->phase.q = 0;
+	am->lut     = NULL;
+	
+	d = 2.0 * M_PI / sample_rate * frequency;
+	am->delta.i = lround(cos(d) * INT32_MAX);
+	am->delta.q = lround(sin(d) * INT32_MAX);
+}
+
+static void _ref_correct(_ref_mod_t *m)
+{
+	/* Correct the amplitude after INT16_MAX samples */
+	if(--m->counter == 0)
+	{
+		double ra = atan2(m->phase.q, m->phase.i);
+		
+		m->phase.i = lround(cos(ra) * INT32_MAX);
+		m->phase.q = lround(sin(ra) * INT32_MAX);
+		
+		m->counter = INT16_MAX;
+	}
+}
+
+static void _ref_fm_add(_ref_mod_t *fm, int16_t *dst, int16_t sample)
+{
+	cint32_mul(&fm->phase, &fm->phase, &fm->lut[sample - INT16_MIN]);
+	
+	dst[0] += ((fm->phase.i >> 16) * fm->level) >> 15;
+	dst[1] += ((fm->phase.q >> 16) * fm->level) >> 15;
+	
+	_ref_correct(fm);
+}
+
+static void _ref_am_add(_ref_mod_t *am, int16_t *dst, int16_t sample)
+{
+	cint32_mul(&am->phase, &am->phase, &am->delta);
+	
+	sample = ((int32_t) sample - INT16_MIN) / 2;
+	
+	dst[0] += ((((am->phase.i >> 16) * sample) >> 15) * am->level) >> 15;
+	dst[1] += ((((am->phase.q >> 16) * sample) >> 15) * am->level) >> 15;
+	
+	_ref_correct(am);
+}
+
+static const int _sample_rates[] = { 13500000, 16000000, 20000000, 20250000 };
+
+static double _uniform(double min, double max)
+{
+	return(min + (max - min) * rand() / RAND_MAX);
+}
+
+static int16_t _rand16(void)
+{
+	return((int16_t) (rand() ^ (rand() << 8)));
+}
+
+static void _fill(int16_t *samples, int n, int kind)
+{
+	int x;
+	
+	for(x = 0; x < n; x++)
+	{
+		switch(kind)
+		{
+		case 0: samples[x] = _rand16(); break;
+		case 1: samples[x] = x & 1 ? INT16_MIN : INT16_MAX; break;
+		case 2: samples[x] = INT16_MAX; break;
+		default: samples[x] = INT16_MIN; break;
+		}
+	}
+}
+
+static int _block_length(void)
+{
+	/* Mostly not a multiple of 8, sometimes shorter than 8 */
+	return(rand() & 1 ? 1 + rand() % 15 : 1 + rand() % 1200);
+}
+
+#ifdef CPU_X86
+
+static int _test_avx2(const int16_t *lut)
+{
+	int16_t samples[1200], a[2400], b[2400];
+	_mod_fm_t fm;
+	_mod_am_t am, pilot[2], signal[2];
+	uint32_t pa, pb;
+	int i, n, x, sr, bad = 0;
+	
+	for(i = 0; i < 20000; i++)
+	{
+		sr = _sample_rates[rand() % 4];
+		n = _block_length();
+		
+		_fill(samples, n, rand() % 4);
+		
+		for(x = 0; x < n * 2; x++)
+		{
+			a[x] = b[x] = _rand16() / 2;
+		}
+		
+		pa = pb = rand() ^ (rand() << 16);
+		
+		/* FM, up to the largest deviation the vector path takes */
+		_init_fm_block_modulator(&fm, lut, sr,
+			_uniform(-sr / 2, sr / 2),
+			_uniform(0, sr / 4.5),
+			i & 1 ? 1.0 : _uniform(0, 1)
+		);
+		
+		x = _fm_block_avx2(&fm, a, samples, n, &pa);
+		_fm_block_scalar(&fm, a + x * 2, samples + x, n - x, &pa);
+		_fm_block_scalar(&fm, b, samples, n, &pb);
+		
+		if(pa != pb || memcmp(a, b, sizeof(int16_t) * 2 * n) != 0)
+		{
+			if(bad++ < 10) fprintf(stderr, "FM AVX2 mismatch, n = %d\n", n);
+		}
+		
+		/* AM */
+		_init_am_modulator(&am, lut, sr, _uniform(-sr / 2, sr / 2), i & 1 ? 1.0 : _uniform(0, 1));
+		
+		x = _am_block_avx2(&am, a, samples, n, &pa);
+		_am_block_scalar(&am, a + x * 2, samples + x, n - x, &pa);
+		_am_block_scalar(&am, b, samples, n, &pb);
+		
+		if(pa != pb || memcmp(a, b, sizeof(int16_t) * 2 * n) != 0)
+		{
+			if(bad++ < 10) fprintf(stderr, "AM AVX2 mismatch, n = %d\n", n);
+		}
+		
+		/* A2 stereo pilot, real output only */
+		_init_am_modulator(&pilot[0], lut, sr, _uniform(-sr / 2, sr / 2), _uniform(0, 1));
+		_init_am_modulator(&signal[0], lut, sr, _uniform(-sr / 2, sr / 2), i & 1 ? 1.0 : _uniform(0, 1));
+		pilot[0].nco_phase = pa;
+		signal[0].nco_phase = pb * 3;
+		pilot[1] = pilot[0];
+		signal[1] = signal[0];
+		
+		x = _a2stereo_pilot_block_avx2(&pilot[0], &signal[0], a, n);
+		_a2stereo_pilot_block_scalar(&pilot[0], &signal[0], a + x, n - x);
+		_a2stereo_pilot_block_scalar(&pilot[1], &signal[1], b, n);
+		
+		if(pilot[0].nco_phase != pilot[1].nco_phase ||
+		   signal[0].nco_phase != signal[1].nco_phase ||
+		   memcmp(a, b, sizeof(int16_t) * n) != 0)
+		{
+			if(bad++ < 10) fprintf(stderr, "A2 pilot AVX2 mismatch, n = %d\n", n);
+		}
+	}
+	
+	printf("AVX2 against scalar: %s\n", bad ? "FAILED" : "ok");
+	
+	return(bad);
+}
+
+#endif
+
+static int _compare(const int16_t *a, const int16_t *b, int n, int *worst)
+{
+	int x, d;
+	
+	for(x = 0; x < n; x++)
+	{
+		d = abs(a[x] - b[x]);
+		if(d > *worst) *worst = d;
+	}
+	
+	return(*worst > _TOLERANCE);
+}
+
+static int _test_reference(const int16_t *lut)
+{
+	int16_t samples[1200], a[2400], b[2400];
+	_mod_fm_t fm;
+	_mod_am_t am, pilot, signal;
+	_ref_mod_t rfm, ram, rpilot, rsignal;
+	int16_t s1[2], s2[2];
+	int fm_worst = 0, am_worst = 0, a2_worst = 0;
+	int i, j, n, x, sr, kind;
+	double f, dev, level;
+	int bad = 0;
+	
+	for(i = 0; i < 40; i++)
+	{
+		sr = _sample_rates[i % 4];
+		f = _uniform(-sr / 2.5, sr / 2.5);
+		dev = _uniform(0, sr / 40);
+		level = i & 1 ? 1.0 : _uniform(0.1, 1);
+		kind = i / 4 % 4;
+		
+		memset(&fm, 0, sizeof(fm));
+		memset(&am, 0, sizeof(am));
+		memset(&pilot, 0, sizeof(pilot));
+		memset(&signal, 0, sizeof(signal));
+		
+		_init_fm_block_modulator(&fm, lut, sr, f, dev, level);
+		_init_am_modulator(&am, lut, sr, -f, level);
+		_init_am_modulator(&pilot, lut, sr, 54.6875e3, 0.05);
+		_init_am_modulator(&signal, lut, sr, 117.5, 1.0);
+		
+		if(_ref_init_fm(&rfm, sr, f, dev, level) != VID_OK) return(1);
+		_ref_init_am(&ram, sr, -f, level);
+		_ref_init_am(&rpilot, sr, 54.6875e3, 0.05);
+		_ref_init_am(&rsignal, sr, 117.5, 1.0);
+		
+		/* About 100,000 samples, past a few amplitude corrections */
+		for(j = 0; j < 200; j++)
+		{
+			n = _block_length();
+			_fill(samples, n, kind);
+			
+			memset(a, 0, sizeof(int16_t) * 2 * n);
+			memset(b, 0, sizeof(int16_t) * 2 * n);
+			
+			_fm_modulator_add_block(&fm, a, samples, n);
+			
+			for(x = 0; x < n; x++)
+			{
+				_ref_fm_add(&rfm, &b[x * 2], samples[x]);
+			}
+			
+			bad |= _compare(a, b, n * 2, &fm_worst);
+			
+			memset(a, 0, sizeof(int16_t) * 2 * n);
+			memset(b, 0, sizeof(int16_t) * 2 * n);
+			
+			_am_modulator_add_block(&am, a, samples, n);
+			
+			for(x = 0; x < n; x++)
+			{
+				_ref_am_add(&ram, &b[x * 2], samples[x]);
+			}
+			
+			bad |= _compare(a, b, n * 2, &am_worst);
+			
+			memset(a, 0, sizeof(int16_t) * n);
+			memset(b, 0, sizeof(int16_t) * n);
+			
+			_a2stereo_pilot_add_block(&pilot, &signal, a, n);
+			
+			for(x = 0; x < n; x++)
+			{
+				s1[0] = s1[1] = s2[0] = s2[1] = 0;
+				_ref_am_add(&rsignal, s1, 0);
+				_ref_am_add(&rpilot, s2, s1[0]);
+				b[x] += s2[0];
+			}
+			
+			bad |= _compare(a, b, n, &a2_worst);
+		}
+		
+		free(rfm.lut);
+	}
+	
+	printf("Against the per-sample modulators, largest difference FM %d, AM %d, A2 pilot %d (limit %d): %s\n",
+		fm_worst, am_worst, a2_worst, _TOLERANCE, bad ? "FAILED" : "ok");
+	
+	return(bad);
+}
+
+int main(int argc, char *argv[])
+{
+	int16_t *lut;
+	int r = 0;
+	
+	srand(1);
+	
+	lut = _init_nco_lut();
+	if(lut == NULL) return(1);
+	
+#ifdef CPU_X86
+	if(cpu_features() & CPU_AVX2)
+	{
+		r |= _test_avx2(lut);
+	}
+	else
+	{
+		printf("AVX2 against scalar: skipped, no AVX2\n");
+	}
+#endif
+	
+	r |= _test_reference(lut);
+	
+	free(lut);
+	
+	return(r);
+}
@@ -0,0 +1,11 @@
+include(../tests.pri)
+
+TARGET = ring_test
+
+LIBS += -lhackrf
+
+# ring_test.c includes rf_hackrf.c, to reach the ring
+SOURCES += \
+    ring_test.c \
+    $$HACKTV/common.c \
+    $$HACKTV/rf_convert.c
@@ -0,0 +1,148 @@
+/* hacktv - Analogue video transmitter for the HackRF                    */
+/*=======================================================================*/
+/* Copyright 2017 Philip Heron <phil@sanslogic.co.uk>                    */
+/*                                                                       */
+/* This program is free software: you can redistribute it and/or modify  */
+/* it under the terms of the GNU General Public License as published by  */
+/* the Free Software Foundation, either version 3 of the License, or     */
+/* (at your option) any later version.                                   */
+/*                                                                       */
+/* This program is distributed in the hope that it will be useful,       */
+/* but WITHOUT ANY WARRANTY; without even the implied warranty of        */
+/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         */
+/* GNU General Public License for more details.                          */
+/*                                                                       */
+/* You should have received a copy of the GNU General Public License     */
+/* along with this program.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Stress test for the HackRF sample ring. The main thread writes a
+ * counting byte sequence through _buffer_write_ptr() and
+ * _buffer_write() in random sized pieces, while a second thread
+ * reads it back through _buffer_read() in random sized pieces, as
+ * the USB callback does. Every byte must arrive once and in order,
+ * across many wraps of the head and tail indexes. Small rings wrap
+ * every few blocks and keep the writer waiting on a full ring.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+/* Built in, to reach the ring */
+#include "rf_hackrf.c"
+
+typedef struct {
+	buffers_t buffers;
+	size_t total;
+	unsigned int seed;
+	int errors;
+} _ring_test_t;
+
+static void *_reader(void *arg)
+{
+	_ring_test_t *t = arg;
+	buffers_t *b = &t->buffers;
+	int8_t dst[1000];
+	uint8_t expect = 0;
+	size_t got = 0;
+	int head, tail, r, i;
+	
+	while(got < t->total)
+	{
+		/* Only read when there is something to, as an empty
+		 * ring reports an underrun on every call */
+		head = atomic_load_explicit(&b->head, memory_order_acquire);
+		tail = atomic_load_explicit(&b->tail, memory_order_relaxed);
+		
+		if(!atomic_load_explicit(&b->ready, memory_order_acquire) ||
+		   _buffer_used(b, head, tail) == 0)
+		{
+			usleep(10);
+			continue;
+		}
+		
+		r = _buffer_read(b, dst, 1 + rand_r(&t->seed) % sizeof(dst));
+		
+		for(i = 0; i < r; i++, got++)
+		{
+			if((uint8_t) dst[i] != expect++)
+			{
+				if(t->errors++ < 10)
+				{
+					fprintf(stderr, "Byte %zu is %d, expected %d\n", got, (uint8_t) dst[i], (uint8_t) (expect - 1));
+				}
+				
+				/* Resynchronise so one slip isn't counted for every byte */
+				expect = (uint8_t) dst[i] + 1;
+			}
+		}
+	}
+	
+	return(NULL);
+}
+
+static int _test(int count, size_t length, size_t blocks)
+{
+	_ring_test_t t;
+	pthread_t thread;
+	int8_t *dst;
+	uint8_t next = 0;
+	size_t sent = 0, r, n, i;
+	unsigned int seed = 1;
+	
+	if(_buffer_init(&t.buffers, count, length) != 0)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return(1);
+	}
+	
+	/* Only whole blocks are handed to the reader */
+	t.total = length * blocks;
+	t.seed = 2;
+	t.errors = 0;
+	
+	pthread_create(&thread, NULL, _reader, &t);
+	
+	while(sent < t.total)
+	{
+		n = 1 + rand_r(&seed) % (length + length / 2);
+		if(n > t.total - sent) n = t.total - sent;
+		
+		/* A piece may span blocks, as in _rf_write() */
+		while(n > 0)
+		{
+			r = _buffer_write_ptr(&t.buffers, &dst, 1);
+			if(r > n) r = n;
+			
+			for(i = 0; i < r; i++)
+			{
+				dst[i] = (int8_t) next++;
+			}
+			
+			_buffer_write(&t.buffers, r);
+			sent += r;
+			n -= r;
+		}
+	}
+	
+	pthread_join(thread, NULL);
+	_buffer_free(&t.buffers);
+	
+	printf("%d blocks of %zu bytes, %zu wraps: %s\n", count, length,
+		blocks / (count * 2), t.errors ? "FAILED" : "ok");
+	
+	return(t.errors ? 1 : 0);
+}
+
+int main(int argc, char *argv[])
+{
+	int r = 0;
+	
+	r |= _test(2, 1, 8000);
+	r |= _test(2, 4096, 8000);
+	r |= _test(3, 1000, 6000);
+	r |= _test(16, 4096, 8000);
+	r |= _test(4, TRANSFER_BUFFER_SIZE, 100);
+	
+	return(r);
+}
@@ -0,0 +1,7 @@
+# Tests for the hacktv sources. Build with qmake && make, and run
+# them all with make check. Each exits non-zero on a failure
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    nco \
+    ring